@@ -0,0 +1,586 @@
+// Headless benchmarks for the networking library, everything runs over loopback.
+//
+//   NetBenchmark loopback [--sizes 16,256,4096] [--clients 1,8,32] [--rates 0,1000]
+//                         [--duration 2] [--io-threads 1] [--port 60001] [--out results.json]
+//       echo throughput and round trip latency, one run per size/clients/rate combination.
+//       A rate is messages per second per client, 0 sends as fast as the in flight window
+//       allows. Results are written as JSON, to stdout unless --out is given.
+//
+//       [--latency 0] [--jitter 0] [--bandwidth 0] [--loss 0]
+//           simulate a network on both directions: one way latency and jitter in ms, a cap
+//           in Mbit/s (0 is none) and the percentage of the stream's writes that pay a retransmit.
+//       [--nodelay]
+//           TCP_NODELAY, and on Linux quick acks, on both ends. Without it a message that does
+//           not fill a segment can wait on the ack of the one before.
+//       [--policy none|block|drop_oldest|drop_newest|coalesce] [--high-bytes 262144]
+//           backpressure on the clients' outbound queues, low watermark at half the high one.
+//       Each result then also reports messages per write, send queue latency and what the
+//       policy dropped or coalesced.
+//
+//   NetBenchmark copies [--port 60001]
+//       pooled bytes allocated per message on the send and receive paths.
+//
+//   NetBenchmark bulk [--entities 10000]
+//       encode and decode rate of a world snapshot (position, rotation, velocity per
+//       entity), pushed one float at a time, as one vector, and quantized at each simd level.
+//
+// On Linux: g++ -std=c++17 -O2 -pthread -I../NetCommon -I<asio>/include NetBenchmark.cpp
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <olc_net.h>
+
+enum class BenchMsgTypes : uint32_t
+{
+	Echo
+};
+
+// echoes every message straight back, moving it so the server adds no copies of its own
+class EchoServer : public olc::net::server_interface<BenchMsgTypes>
+{
+public:
+	EchoServer(uint16_t port, size_t nIOThreads = 1, const olc::net::socket_options& options = olc::net::socket_options())
+		: olc::net::server_interface<BenchMsgTypes>(port, nIOThreads, options)
+	{
+	}
+
+	// releases an Update blocked waiting for messages, so the caller can shut it down
+	void Wake()
+	{
+		m_qMessagesIn.push_back({});
+	}
+
+protected:
+	virtual bool OnClientConnect(std::shared_ptr<olc::net::connection<BenchMsgTypes>> /*client*/)
+	{
+		return true;
+	}
+
+	virtual void OnMessageBatch(std::vector<olc::net::owned_message<BenchMsgTypes>>& vMessages)
+	{
+		for (auto& msg : vMessages)
+			if (msg.remote)
+				msg.remote->Send(std::move(msg.msg));
+	}
+};
+
+class BenchClient : public olc::net::client_interface<BenchMsgTypes>
+{
+public:
+	BenchClient(const olc::net::socket_options& options = olc::net::socket_options()) : olc::net::client_interface<BenchMsgTypes>(options)
+	{
+	}
+};
+
+// body bytes requested from every thread's buffer pool so far, each copy of a body is one request
+uint64_t BodyBytesAllocated()
+{
+	uint64_t nBytes = 0;
+	for (auto& stats : olc::net::buffer_pool::all_stats())
+		nBytes += stats.nBytesAllocated;
+	return nBytes;
+}
+
+olc::net::message<BenchMsgTypes> MakeMessage(size_t nBodyBytes)
+{
+	olc::net::message<BenchMsgTypes> msg;
+	msg.header.id = BenchMsgTypes::Echo;
+	msg.body.resize(nBodyBytes);
+	msg.header.size = uint32_t(msg.size());
+	return msg;
+}
+
+// sends every message around a loopback echo and waits for them all to come back
+bool RunEcho(BenchClient& client, size_t nMessages, size_t nBodyBytes, bool bMove)
+{
+	for (size_t i = 0; i < nMessages; i++)
+	{
+		auto msg = MakeMessage(nBodyBytes);
+		if (bMove)
+			client.Send(std::move(msg));
+		else
+			client.Send(msg);
+	}
+
+	size_t nReceived = 0;
+	auto tStart = std::chrono::steady_clock::now();
+	while (nReceived < nMessages)
+	{
+		if (std::chrono::steady_clock::now() - tStart > std::chrono::seconds(30))
+			return false;
+
+		if (client.Incoming().empty())
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		client.Incoming().pop_front();
+		nReceived++;
+	}
+
+	return true;
+}
+
+// Counts pooled bytes allocated per message over a full round trip, once with messages sent
+// by const reference and once moved. A round trip has three unavoidable bodies: the one
+// the client builds and one per receiving side. Anything above that is either a copy of
+// the body or the small shared message block each sending side queues.
+int BenchCopies(uint16_t port)
+{
+	EchoServer server(port);
+	server.Start();
+
+	std::atomic<bool> bRunning = true;
+	std::thread threadUpdate([&]() { while (bRunning) { server.Update(); std::this_thread::yield(); } });
+
+	BenchClient client;
+	client.Connect("127.0.0.1", port);
+
+	// let the handshake finish before anything is written to the socket
+	std::this_thread::sleep_for(std::chrono::milliseconds(250));
+	if (!RunEcho(client, 1, 0, true))
+	{
+		std::cerr << "no echo from server" << std::endl;
+		bRunning = false;
+		threadUpdate.join();
+		return 1;
+	}
+
+	const size_t nMessages = 20000;
+	std::cout << "body bytes   path    bytes allocated/msg   bytes beyond 3 bodies/msg" << std::endl;
+
+	for (size_t nBodyBytes : { 64, 1024, 16384 })
+	{
+		for (bool bMove : { false, true })
+		{
+			uint64_t nBefore = BodyBytesAllocated();
+			if (!RunEcho(client, nMessages, nBodyBytes, bMove))
+			{
+				std::cerr << "echo timed out" << std::endl;
+				bRunning = false;
+				threadUpdate.join();
+				return 1;
+			}
+			uint64_t nBytes = BodyBytesAllocated() - nBefore;
+
+			double dPerMessage = double(nBytes) / double(nMessages);
+			std::cout << nBodyBytes << "\t     " << (bMove ? "move" : "copy") << "    " << dPerMessage
+				<< "\t\t\t  " << (dPerMessage - 3.0 * double(nBodyBytes)) << std::endl;
+		}
+	}
+
+	bRunning = false;
+	threadUpdate.join();
+	client.Disconnect();
+	server.Stop();
+	return 0;
+}
+
+struct loopback_config
+{
+	size_t nClients = 1;
+	size_t nBodyBytes = 16;
+	size_t nRate = 0;
+};
+
+// applied to every client of every run, the link to the server as well
+struct loopback_conditions
+{
+	std::optional<olc::net::link_conditions> link;
+	olc::net::backpressure_limits limits;
+	olc::net::socket_options options;
+};
+
+struct loopback_result
+{
+	loopback_config config;
+	size_t nMessages = 0;
+	double dSeconds = 0.0;
+	double dP50 = 0.0, dP99 = 0.0, dP999 = 0.0; // microseconds
+
+	// summed over the clients' connections
+	olc::net::connection_stats clients;
+};
+
+double Percentile(std::vector<double>& vSorted, double dFraction)
+{
+	if (vSorted.empty())
+		return 0.0;
+	size_t nIndex = std::min(vSorted.size() - 1, size_t(dFraction * double(vSorted.size())));
+	return vSorted[nIndex];
+}
+
+// Every message carries the steady clock time it was sent at in its first 8 bytes and the
+// server echoes it back untouched, so each arrival yields one round trip time.
+bool RunLoopback(uint16_t port, const loopback_config& config, const loopback_conditions& conditions, double dDuration, loopback_result& result)
+{
+	using clock = std::chrono::steady_clock;
+
+	// a closed loop window when sending flat out, a generous cap otherwise so a stalled
+	// server cannot make the clients queue without bound
+	const size_t nMaxInFlight = config.nRate == 0 ? 32 : 1024;
+
+	std::vector<std::unique_ptr<BenchClient>> vClients;
+	for (size_t i = 0; i < config.nClients; i++)
+	{
+		vClients.push_back(std::make_unique<BenchClient>(conditions.options));
+		vClients.back()->SetBackpressure(conditions.limits);
+		if (conditions.link)
+			vClients.back()->SetLinkConditions(*conditions.link);
+		if (!vClients.back()->Connect("127.0.0.1", port))
+			return false;
+	}
+
+	// let every handshake finish before anything is written to the sockets
+	std::this_thread::sleep_for(std::chrono::milliseconds(250));
+	for (auto& client : vClients)
+		if (!RunEcho(*client, 1, 8, true))
+			return false;
+
+	std::vector<size_t> vInFlight(config.nClients, 0);
+	std::vector<uint64_t> vDiscarded(config.nClients, 0);
+	std::vector<clock::time_point> vNextSend(config.nClients, clock::now());
+	clock::duration tInterval = config.nRate > 0
+		? std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / double(config.nRate)))
+		: clock::duration::zero();
+
+	std::vector<double> vLatencies;
+	size_t nReceived = 0;
+
+	auto tStart = clock::now();
+	auto tEnd = tStart + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(dDuration));
+	bool bSending = true;
+
+	while (true)
+	{
+		auto tNow = clock::now();
+		if (bSending && tNow >= tEnd)
+			bSending = false;
+
+		size_t nOutstanding = 0;
+		bool bIdle = true;
+		for (size_t i = 0; i < vClients.size(); i++)
+		{
+			BenchClient& client = *vClients[i];
+
+			while (bSending && vInFlight[i] < nMaxInFlight && tNow >= vNextSend[i])
+			{
+				auto msg = MakeMessage(std::max<size_t>(config.nBodyBytes, sizeof(int64_t)));
+				int64_t nSentAt = clock::now().time_since_epoch().count();
+				std::memcpy(msg.body.data(), &nSentAt, sizeof(int64_t));
+				client.Send(std::move(msg));
+
+				vInFlight[i]++;
+				vNextSend[i] = config.nRate > 0 ? vNextSend[i] + tInterval : tNow;
+				bIdle = false;
+			}
+
+			while (!client.Incoming().empty())
+			{
+				auto msg = client.Incoming().pop_front().msg;
+				int64_t nSentAt = 0;
+				std::memcpy(&nSentAt, msg.body.data(), sizeof(int64_t));
+				vLatencies.push_back(double(clock::now().time_since_epoch().count() - nSentAt) / 1000.0);
+
+				vInFlight[i]--;
+				nReceived++;
+				bIdle = false;
+			}
+
+			// messages the policy discarded will never come back, they no longer hold the window
+			if (conditions.limits.policy != olc::net::backpressure_policy::none)
+			{
+				olc::net::connection_stats stats = client.GetStats();
+				uint64_t nDiscarded = stats.nMessagesDropped + stats.nMessagesCoalesced;
+				vInFlight[i] -= std::min<uint64_t>(vInFlight[i], nDiscarded - vDiscarded[i]);
+				vDiscarded[i] = nDiscarded;
+			}
+
+			nOutstanding += vInFlight[i];
+		}
+
+		// drain whatever is still in flight once sending stops, but do not wait forever
+		if (!bSending && (nOutstanding == 0 || tNow - tEnd > std::chrono::seconds(10)))
+			break;
+
+		if (bIdle)
+			std::this_thread::yield();
+	}
+
+	result.config = config;
+	result.nMessages = nReceived;
+	result.dSeconds = std::chrono::duration<double>(clock::now() - tStart).count();
+
+	// steady clock ticks are nanoseconds on every platform this is built for
+	std::sort(vLatencies.begin(), vLatencies.end());
+	result.dP50 = Percentile(vLatencies, 0.50);
+	result.dP99 = Percentile(vLatencies, 0.99);
+	result.dP999 = Percentile(vLatencies, 0.999);
+
+	for (auto& client : vClients)
+	{
+		result.clients += client->GetStats();
+		client->Disconnect();
+	}
+
+	return true;
+}
+
+std::vector<size_t> ParseList(const std::string& sList)
+{
+	std::vector<size_t> vValues;
+	std::stringstream ss(sList);
+	std::string sValue;
+	while (std::getline(ss, sValue, ','))
+		vValues.push_back(std::stoul(sValue));
+	return vValues;
+}
+
+int BenchLoopback(uint16_t port, int argc, char* argv[])
+{
+	std::vector<size_t> vSizes = { 16, 256, 4096 };
+	std::vector<size_t> vClients = { 1, 8, 32 };
+	std::vector<size_t> vRates = { 0, 1000 };
+	double dDuration = 2.0;
+	size_t nIOThreads = 1;
+	std::string sOut;
+
+	double dLatency = 0.0, dJitter = 0.0, dBandwidth = 0.0, dLoss = 0.0;
+	std::string sPolicy = "none";
+	size_t nHighBytes = 256 * 1024;
+	bool bNoDelay = false;
+
+	for (int i = 2; i < argc; i++)
+	{
+		std::string sArg = argv[i];
+		if (sArg == "--nodelay")
+		{
+			bNoDelay = true;
+			continue;
+		}
+
+		// every other option takes a value
+		if (i + 1 >= argc)
+			break;
+		if (sArg == "--sizes") vSizes = ParseList(argv[i + 1]);
+		else if (sArg == "--clients") vClients = ParseList(argv[i + 1]);
+		else if (sArg == "--rates") vRates = ParseList(argv[i + 1]);
+		else if (sArg == "--duration") dDuration = std::stod(argv[i + 1]);
+		else if (sArg == "--io-threads") nIOThreads = std::stoul(argv[i + 1]);
+		else if (sArg == "--out") sOut = argv[i + 1];
+		else if (sArg == "--latency") dLatency = std::stod(argv[i + 1]);
+		else if (sArg == "--jitter") dJitter = std::stod(argv[i + 1]);
+		else if (sArg == "--bandwidth") dBandwidth = std::stod(argv[i + 1]);
+		else if (sArg == "--loss") dLoss = std::stod(argv[i + 1]);
+		else if (sArg == "--policy") sPolicy = argv[i + 1];
+		else if (sArg == "--high-bytes") nHighBytes = std::stoul(argv[i + 1]);
+		i++;
+	}
+
+	loopback_conditions conditions;
+	if (dLatency > 0.0 || dJitter > 0.0 || dBandwidth > 0.0 || dLoss > 0.0)
+	{
+		olc::net::link_conditions link;
+		link.tLatency = std::chrono::microseconds(int64_t(dLatency * 1000.0));
+		link.tJitter = std::chrono::microseconds(int64_t(dJitter * 1000.0));
+		link.nBytesPerSecond = uint64_t(dBandwidth * 1e6 / 8.0);
+		link.dLoss = dLoss / 100.0;
+		conditions.link = link;
+	}
+
+	const std::pair<const char*, olc::net::backpressure_policy> vPolicies[] = {
+		{ "none", olc::net::backpressure_policy::none }, { "block", olc::net::backpressure_policy::block },
+		{ "drop_oldest", olc::net::backpressure_policy::drop_oldest }, { "drop_newest", olc::net::backpressure_policy::drop_newest },
+		{ "coalesce", olc::net::backpressure_policy::coalesce } };
+	for (auto& policy : vPolicies)
+		if (sPolicy == policy.first)
+			conditions.limits.policy = policy.second;
+
+	if (conditions.limits.policy != olc::net::backpressure_policy::none)
+	{
+		conditions.limits.nHighBytes = nHighBytes;
+		conditions.limits.nLowBytes = nHighBytes / 2;
+		conditions.limits.nLowMessages = SIZE_MAX;
+	}
+
+	conditions.options.bNoDelay = bNoDelay;
+	conditions.options.bQuickAck = bNoDelay;
+
+	EchoServer server(port, nIOThreads, conditions.options);
+	if (conditions.link)
+		server.SetLinkConditions(*conditions.link);
+	server.Start();
+
+	std::atomic<bool> bRunning = true;
+	std::thread threadUpdate([&]() { while (bRunning) server.Update(-1, true); });
+
+	std::vector<loopback_result> vResults;
+	bool bFailed = false;
+	for (size_t nBodyBytes : vSizes)
+		for (size_t nClients : vClients)
+			for (size_t nRate : vRates)
+			{
+				loopback_result result;
+				if (!RunLoopback(port, { nClients, nBodyBytes, nRate }, conditions, dDuration, result))
+				{
+					std::cerr << "loopback run failed: " << nClients << " clients, " << nBodyBytes << " bytes" << std::endl;
+					bFailed = true;
+					continue;
+				}
+				vResults.push_back(result);
+			}
+
+	bRunning = false;
+	server.Wake();
+	threadUpdate.join();
+	server.Stop();
+
+	std::ostringstream json;
+	json << "{\n  \"io_threads\": " << nIOThreads << ",\n  \"nodelay\": " << (bNoDelay ? "true" : "false") << ",\n  \"policy\": \"" << sPolicy << "\",";
+	json << "\n  \"link\": { \"latency_ms\": " << dLatency << ", \"jitter_ms\": " << dJitter
+		<< ", \"bandwidth_mbit\": " << dBandwidth << ", \"loss_pct\": " << dLoss << " },\n  \"results\": [";
+	for (size_t i = 0; i < vResults.size(); i++)
+	{
+		const loopback_result& r = vResults[i];
+		double dMsgsPerSec = double(r.nMessages) / r.dSeconds;
+		double dFrameBytes = double(sizeof(olc::net::message_header<BenchMsgTypes>) + std::max<size_t>(r.config.nBodyBytes, sizeof(int64_t)));
+
+		json << (i == 0 ? "\n" : ",\n") << "    { "
+			<< "\"clients\": " << r.config.nClients << ", "
+			<< "\"body_bytes\": " << r.config.nBodyBytes << ", "
+			<< "\"rate_per_client\": " << r.config.nRate << ", "
+			<< "\"messages\": " << r.nMessages << ", "
+			<< "\"seconds\": " << r.dSeconds << ", "
+			<< "\"msgs_per_s\": " << dMsgsPerSec << ", "
+			<< "\"mb_per_s\": " << dMsgsPerSec * dFrameBytes / 1e6 << ", "
+			<< "\"latency_us\": { \"p50\": " << r.dP50 << ", \"p99\": " << r.dP99 << ", \"p999\": " << r.dP999 << " }, "
+			<< "\"msgs_per_write\": " << (r.clients.nWrites ? double(r.clients.nMessagesOut) / double(r.clients.nWrites) : 0.0) << ", "
+			<< "\"send_queue_us\": { \"p50\": " << r.clients.sendLatency.Percentile(0.50) << ", \"p99\": " << r.clients.sendLatency.Percentile(0.99) << " }, "
+			<< "\"dropped\": " << r.clients.nMessagesDropped << ", "
+			<< "\"coalesced\": " << r.clients.nMessagesCoalesced << " }";
+	}
+	json << "\n  ]\n}\n";
+
+	if (sOut.empty())
+	{
+		std::cout << json.str();
+	}
+	else
+	{
+		std::ofstream file(sOut);
+		file << json.str();
+	}
+
+	return bFailed ? 1 : 0;
+}
+
+// times encoding vIn and decoding it into vOut, false if any round decoded to more than
+// fTolerance away from the input
+template <typename Encode, typename Decode>
+bool TimeBulk(const char* sName, const std::vector<float>& vIn, const std::vector<float>& vOut, float fTolerance, Encode&& encode, Decode&& decode)
+{
+	const int nRounds = 200;
+	double dEncode = 0.0, dDecode = 0.0;
+	size_t nWireBytes = 0;
+	size_t nMismatches = 0;
+
+	for (int i = 0; i < nRounds; i++)
+	{
+		olc::net::message<BenchMsgTypes> msg;
+		auto t0 = std::chrono::steady_clock::now();
+		encode(msg);
+		auto t1 = std::chrono::steady_clock::now();
+		nWireBytes = msg.header.size;
+		decode(msg);
+		auto t2 = std::chrono::steady_clock::now();
+
+		dEncode += std::chrono::duration<double>(t1 - t0).count();
+		dDecode += std::chrono::duration<double>(t2 - t1).count();
+
+		bool bSame = vOut.size() == vIn.size();
+		for (size_t j = 0; bSame && j < vIn.size(); j++)
+			bSame = std::abs(vOut[j] - vIn[j]) <= fTolerance;
+		if (!bSame)
+			nMismatches++;
+	}
+
+	// rates are of the float data represented, not of the bytes on the wire
+	double dBytes = double(nRounds) * double(vIn.size() * sizeof(float));
+	std::cout << sName << "\t" << dBytes / dEncode / 1e6 << "\t\t" << dBytes / dDecode / 1e6 << "\t\t" << nWireBytes;
+	if (nMismatches > 0)
+		std::cout << "\tdecoded wrong in " << nMismatches << " rounds";
+	std::cout << std::endl;
+	return nMismatches == 0;
+}
+
+// a snapshot of 10 floats per entity: position, rotation quaternion and velocity
+int BenchBulk(int argc, char* argv[])
+{
+	size_t nEntities = 10000;
+	for (int i = 2; i + 1 < argc; i++)
+		if (std::string(argv[i]) == "--entities")
+			nEntities = std::stoul(argv[i + 1]);
+
+	std::vector<float> vSnapshot(nEntities * 10);
+	for (size_t i = 0; i < vSnapshot.size(); i++)
+		vSnapshot[i] = float(i % 2000) * 0.25f - 250.0f;
+
+	std::vector<float> vOut(vSnapshot.size());
+	std::cout << "encoding\tencode MB/s\tdecode MB/s\twire bytes" << std::endl;
+
+	// quantizing rounds to the nearest step of the scale
+	const float fScale = 64.0f;
+	const float fStep = 0.5f / fScale;
+	bool bOk = true;
+
+	bOk &= TimeBulk("per float", vSnapshot, vOut, 0.0f,
+		[&](auto& msg) { for (float f : vSnapshot) msg << f; },
+		[&](auto& msg) { for (size_t i = vOut.size(); i-- > 0;) msg >> vOut[i]; });
+
+	bOk &= TimeBulk("vector  ", vSnapshot, vOut, 0.0f,
+		[&](auto& msg) { msg << vSnapshot; },
+		[&](auto& msg) { msg >> vOut; });
+
+	const char* vLevels[] = { "int16 scalar", "int16 sse2", "int16 avx2" };
+	for (int nLevel = 0; nLevel <= int(olc::net::simd::detect()); nLevel++)
+	{
+		olc::net::simd::active() = olc::net::simd::level(nLevel);
+
+		bOk &= TimeBulk(vLevels[nLevel], vSnapshot, vOut, fStep,
+			[&](auto& msg) { olc::net::push_quantized(msg, vSnapshot.data(), vSnapshot.size(), fScale); },
+			[&](auto& msg) { olc::net::pop_quantized(msg, vOut, fScale); });
+
+		std::vector<int16_t> vSent, vReceived;
+		bOk &= TimeBulk("  + delta", vSnapshot, vOut, fStep,
+			[&](auto& msg) { olc::net::push_quantized_delta(msg, vSnapshot.data(), vSnapshot.size(), fScale, vSent); },
+			[&](auto& msg) { olc::net::pop_quantized_delta(msg, vOut, fScale, vReceived); });
+	}
+
+	olc::net::simd::active() = olc::net::simd::detect();
+	return bOk ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string sMode = argc > 1 ? argv[1] : "loopback";
+
+	uint16_t port = 60001;
+	for (int i = 2; i + 1 < argc; i++)
+		if (std::string(argv[i]) == "--port")
+			port = uint16_t(std::stoul(argv[i + 1]));
+
+	if (sMode == "copies")
+		return BenchCopies(port);
+
+	if (sMode == "loopback")
+		return BenchLoopback(port, argc, argv);
+
+	if (sMode == "bulk")
+		return BenchBulk(argc, argv);
+
+	std::cerr << "usage: NetBenchmark [loopback|copies|bulk] [options], see the top of NetBenchmark.cpp" << std::endl;
+	return 1;
+}
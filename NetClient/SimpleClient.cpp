@@ -13,6 +13,20 @@ enum class CustomMsgTypes : uint32_t
 class CustomClient : public olc::net::client_interface<CustomMsgTypes>
 {
 public:
+	CustomClient() : olc::net::client_interface<CustomMsgTypes>(PingOptions())
+	{
+	}
+
+	// pings are small and answered one at a time, so neither side should hold them back
+	// waiting on an ack, quick acks only take effect on Linux
+	static olc::net::socket_options PingOptions()
+	{
+		olc::net::socket_options options;
+		options.bNoDelay = true;
+		options.bQuickAck = true;
+		return options;
+	}
+
 	void PingServer()
 	{
 		olc::net::message<CustomMsgTypes> msg;
@@ -21,7 +35,7 @@ public:
 		std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
 
 		msg << timeNow;
-		Send(msg);
+		Send(std::move(msg));
 	}
 };
 
@@ -51,7 +65,8 @@ int main()
 
 		if (c.IsConnected())
 		{
-			if (!c.Incoming().empty())
+			// sleeps until a message arrives, the timeout keeps the keys polled
+			if (c.Incoming().wait_for(std::chrono::milliseconds(10)))
 			{
 				auto msg = c.Incoming().pop_front().msg;
 				switch (msg.header.id)
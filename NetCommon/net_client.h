@@ -10,7 +10,9 @@ namespace olc
 		class client_interface
 		{
 		public:
-			client_interface()
+			// options apply to the connection once it is made, see socket_options
+			client_interface(const socket_options& options = socket_options())
+				: m_sockopts(options)
 			{
 				// initialize the socket with the io context so it can do stuff...
 			}
@@ -36,13 +38,28 @@ namespace olc
 						m_messagesIn
 						);
 
+					m_connection->SetSocketOptions(m_sockopts);
+					m_connection->SetBackpressure(m_backpressure);
+					m_connection->SetCompression(m_nCompressThreshold);
+					m_connection->SetMaxBodySize(m_nMaxBodyBytes);
+					if (m_link)
+						m_connection->SetLinkConditions(*m_link);
+					if (m_udpOptions)
+						m_connection->EnableUdp(nullptr, *m_udpOptions);
+#ifdef ASIO_HAS_CO_AWAIT
+					m_bClosed.store(false);
+					m_connection->SetIncomingHandlers(
+						[this](message<T>& msg) { return TakeResponse(msg); },
+						[this]() { WakeReceive(); },
+						[this]() { WakeClosed(); });
+#endif
 					m_connection->ConnectToServer(endPoints);
 
 					thrContext = std::thread([this]() { m_context.run(); });
 				}
 				catch (std::exception& e)
 				{
-					std::cerr << "Client Exception: " << e.what() << std::endl;
+					OLC_NET_LOG(error, "Client Exception: {}", e.what());
 					return false;
 				}
 
@@ -61,7 +78,12 @@ namespace olc
 				if (thrContext.joinable())
 					thrContext.join();
 
-				m_connection.release();
+				m_connection.reset();
+
+#ifdef ASIO_HAS_CO_AWAIT
+				// the context may have stopped before the close it was posted could run
+				WakeClosed();
+#endif
 			}
 
 			bool IsConnected()
@@ -78,11 +100,183 @@ namespace olc
 					m_connection->Send(msg);
 			}
 
-			tsqueue<owned_message<T>>& Incoming()
+			void Send(message<T>&& msg)
+			{
+				if (IsConnected())
+					m_connection->Send(std::move(msg));
+			}
+
+			mpscqueue<owned_message<T>>& Incoming()
 			{
 				return m_messagesIn;
 			}
 
+			// snapshot of the connection's counters, empty when not connected
+			connection_stats GetStats() const
+			{
+				return m_connection ? m_connection->GetStats() : connection_stats{};
+			}
+
+			// outbound queue limits, takes effect on the next Connect
+			void SetBackpressure(const backpressure_limits& limits)
+			{
+				m_backpressure = limits;
+			}
+
+			// simulates a network on everything sent to the server, takes effect on the next Connect
+			void SetLinkConditions(const link_conditions& conditions)
+			{
+				m_link = conditions;
+			}
+
+			// the largest body accepted from the server, takes effect on the next Connect
+			void SetMaxBodySize(uint32_t nBytes)
+			{
+				m_nMaxBodyBytes = nBytes;
+			}
+
+			// offers compression of bodies of at least nThreshold bytes, takes effect on the next Connect
+			void SetCompression(uint32_t nThreshold)
+			{
+				m_nCompressThreshold = nThreshold;
+			}
+
+			// offers udp to the server for the ids in options.channels, takes effect on the next
+			// Connect. Those ids go over tcp until udp is up, and for good if the server declines
+			void EnableUdp(const udp_options<T>& options)
+			{
+				m_udpOptions = options;
+			}
+
+			// must match the server's EnableSnapshots, nHistory at least as large
+			void EnableSnapshots(T idAck, size_t nHistory = 32)
+			{
+				m_idSnapshotAck = idAck;
+				m_snapshots = snapshot_decoder<T>(nHistory);
+			}
+
+			// turns a snapshot sent with MessageAllClientsSnapshot back into the full state and
+			// acknowledges it, false if it could not be decoded. The server resends the full
+			// state once it notices the client has fallen behind
+			bool ReadSnapshot(message<T>& msg)
+			{
+				uint32_t nSequence = m_snapshots.Decode(msg);
+				if (nSequence == 0)
+					return false;
+
+				if (m_idSnapshotAck)
+				{
+					message<T> msgAck;
+					msgAck.header.id = *m_idSnapshotAck;
+					msgAck << nSequence;
+					Send(std::move(msgAck));
+				}
+				return true;
+			}
+
+#ifdef ASIO_HAS_CO_AWAIT
+			// Awaits the next message for Incoming(), std::nullopt once disconnected and every message
+			// that arrived before has been taken. Nothing spins
+			// or polls while waiting, an arrival or the connection closing resumes the coroutine. Run
+			// it on a single threaded context or a strand, and have one receive at a time as it
+			// consumes Incoming()
+			asio::awaitable<std::optional<owned_message<T>>> receive()
+			{
+				auto pTimer = std::make_shared<asio::steady_timer>(co_await asio::this_coro::executor);
+				{
+					std::scoped_lock lock(m_muxAwaiting);
+					m_pReceiveTimer = pTimer;
+				}
+				m_bReceiving.store(true, std::memory_order_release);
+
+				std::optional<owned_message<T>> msg;
+				while (true)
+				{
+					// cleared before looking so an arrival from here on cancels the wait below
+					{
+						std::scoped_lock lock(m_muxAwaiting);
+						m_bReceiveWoken = false;
+					}
+
+					// read before looking at the queue, every message pushed before the close is
+					// then seen by the look
+					bool bClosed = m_bClosed.load();
+					if (!m_messagesIn.empty())
+					{
+						msg = m_messagesIn.pop_front();
+						break;
+					}
+					if (bClosed)
+						break;
+
+					// no deadline, an arrival or the close cancels the wait. Either is posted to this
+					// coroutine's executor, so it cannot run before the wait has started
+					asio::error_code ec;
+					pTimer->expires_at(asio::steady_timer::time_point::max());
+					co_await pTimer->async_wait(asio::redirect_error(asio::use_awaitable, ec));
+				}
+
+				m_bReceiving.store(false, std::memory_order_release);
+				{
+					std::scoped_lock lock(m_muxAwaiting);
+					m_pReceiveTimer.reset();
+				}
+				co_return msg;
+			}
+
+			// Sends msg numbered in its header and awaits the reply carrying that number back, which
+			// skips Incoming(). The server has to answer with a message passed through reply_to, a
+			// plain echo of the request is not a reply. std::nullopt on timeout or disconnect, at once
+			// if not connected, a reply arriving after that is queued as usual. Any number of requests
+			// may be awaited at once
+			asio::awaitable<std::optional<message<T>>> request(message<T> msg, std::chrono::steady_clock::duration tTimeout)
+			{
+				// Send would drop it, nothing could ever answer
+				if (!IsConnected())
+					co_return std::nullopt;
+
+				auto tDeadline = std::chrono::steady_clock::now() + tTimeout;
+				auto pPending = std::make_shared<pending_request>(co_await asio::this_coro::executor);
+
+				uint32_t nSequence = m_nNextSequence.fetch_add(1, std::memory_order_relaxed) & ~nSequenceReplyBit;
+				if (nSequence == 0)
+					nSequence = m_nNextSequence.fetch_add(1, std::memory_order_relaxed) & ~nSequenceReplyBit;
+				msg.header.sequence = nSequence;
+				{
+					std::scoped_lock lock(m_muxAwaiting);
+					m_mapRequests[nSequence] = pPending;
+				}
+				Send(std::move(msg));
+
+				std::optional<message<T>> reply;
+				while (true)
+				{
+					{
+						std::scoped_lock lock(m_muxAwaiting);
+						if (pPending->reply)
+						{
+							reply = std::move(pPending->reply);
+							break;
+						}
+					}
+
+					if (m_bClosed.load() || std::chrono::steady_clock::now() >= tDeadline)
+						break;
+
+					// the reply or the close cancels the wait early
+					asio::error_code ec;
+					pPending->timer.expires_at(tDeadline);
+					co_await pPending->timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+				}
+
+				{
+					std::scoped_lock lock(m_muxAwaiting);
+					m_mapRequests.erase(nSequence);
+				}
+				co_return reply;
+			}
+#endif
+
 		protected:
 			// asio context handles the data transfer...
 			asio::io_context m_context;
@@ -93,7 +287,79 @@ namespace olc
 
 		private:
 			// this is the thread safe queue of incoming messages from server
-			tsqueue<owned_message<T>> m_messagesIn;
+			mpscqueue<owned_message<T>> m_messagesIn;
+
+			// snapshots decoded so far, the baselines for the next ones
+			snapshot_decoder<T> m_snapshots;
+			std::optional<T> m_idSnapshotAck;
+
+			socket_options m_sockopts;
+			backpressure_limits m_backpressure;
+			uint32_t m_nCompressThreshold = 0;
+			uint32_t m_nMaxBodyBytes = nDefaultMaxBodyBytes;
+			std::optional<udp_options<T>> m_udpOptions;
+			std::optional<link_conditions> m_link;
+
+#ifdef ASIO_HAS_CO_AWAIT
+			struct pending_request
+			{
+				pending_request(const asio::any_io_executor& executor) : timer(executor) {}
+
+				asio::steady_timer timer;
+				std::optional<message<T>> reply;
+			};
+
+			// io thread - a reply is handed over and its coroutine's wait cancelled, on the
+			// coroutine's own executor as timers are not thread safe
+			bool TakeResponse(message<T>& msg)
+			{
+				std::scoped_lock lock(m_muxAwaiting);
+				auto it = m_mapRequests.find(msg.header.sequence & ~nSequenceReplyBit);
+				if (it == m_mapRequests.end())
+					return false;
+
+				std::shared_ptr<pending_request> pPending = it->second;
+				pPending->reply = std::move(msg);
+				asio::post(pPending->timer.get_executor(), [pPending]() { pPending->timer.cancel(); });
+				return true;
+			}
+
+			// io thread - once per wait however many messages arrive
+			void WakeReceive()
+			{
+				if (!m_bReceiving.load(std::memory_order_acquire))
+					return;
+
+				std::scoped_lock lock(m_muxAwaiting);
+				if (m_pReceiveTimer && !m_bReceiveWoken)
+				{
+					m_bReceiveWoken = true;
+					asio::post(m_pReceiveTimer->get_executor(), [pTimer = m_pReceiveTimer]() { pTimer->cancel(); });
+				}
+			}
+
+			// io thread or Disconnect - every awaiting coroutine wakes to find the connection gone
+			void WakeClosed()
+			{
+				m_bClosed.store(true);
+
+				std::scoped_lock lock(m_muxAwaiting);
+				if (m_pReceiveTimer)
+					asio::post(m_pReceiveTimer->get_executor(), [pTimer = m_pReceiveTimer]() { pTimer->cancel(); });
+				for (auto& request : m_mapRequests)
+					asio::post(request.second->timer.get_executor(), [pPending = request.second]() { pPending->timer.cancel(); });
+			}
+
+			std::mutex m_muxAwaiting;
+			std::unordered_map<uint32_t, std::shared_ptr<pending_request>> m_mapRequests;
+			std::atomic<uint32_t> m_nNextSequence{ 1 };
+			std::shared_ptr<asio::steady_timer> m_pReceiveTimer;
+			std::atomic<bool> m_bReceiving{ false };
+			bool m_bReceiveWoken = false;
+
+			// false from Connect until the connection closes
+			std::atomic<bool> m_bClosed{ true };
+#endif
 		};
 	}
 }
\ No newline at end of file
@@ -1,20 +1,57 @@
 #pragma once
 
 #include <memory>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <cstdio>
 #include <vector>
 #include <mutex>
 #include <deque>
+#include <queue>
 #include <optional>
 #include <thread>
 #include <iostream>
 #include <algorithm>
 #include <chrono>
+#include <ctime>
 #include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <condition_variable>
+#include <new>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <functional>
+#include <random>
 
 #ifdef _WIN32
 #define _WIN32_WINNT 0x0A00
 #endif
 
+// SSE2 is part of x64 so it is always there, AVX2 is checked for at runtime
+#if defined(__x86_64__) || defined(_M_X64)
+#define OLC_NET_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define OLC_NET_TARGET_AVX2
+#else
+#define OLC_NET_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include <asio.hpp>
 #include <asio/ts/buffer.hpp>
 #include <asio/ts/internet.hpp>
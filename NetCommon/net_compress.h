@@ -0,0 +1,218 @@
+#pragma once
+// net compress, small in-tree LZ77 codec in the LZ4 block format for message bodies
+#include "net_common.h"
+
+namespace olc
+{
+	namespace net
+	{
+		// A block is a series of sequences: a token byte (literal count in the high nibble, match
+		// length minus 4 in the low one, 15 meaning more length bytes follow), the literals, then
+		// a 2 byte little endian offset back into what has been written so far and any extra
+		// match length bytes. The last sequence carries literals only. Greedy, single probe
+		// matching - much faster than it is thorough, which suits compressing on the io thread.
+		static constexpr size_t nLZMinMatch = 4;
+		static constexpr size_t nLZLastLiterals = 5;	// a block always ends on at least this many literals
+		static constexpr size_t nLZMatchFence = 12;		// no match may start within this many bytes of the end
+		static constexpr size_t nLZMaxOffset = 65535;
+
+		// largest block nCount bytes can compress to
+		inline size_t lz_bound(size_t nCount)
+		{
+			return nCount + nCount / 255 + 16;
+		}
+
+		// Match finder state, reused between blocks so compressing allocates nothing. Positions are
+		// stored offset by a base that moves past each block, which makes entries from earlier
+		// blocks stale without clearing the table every time
+		class lz_context
+		{
+		public:
+			static constexpr size_t nHashBits = 12;
+
+			lz_context()
+			{
+				m_vTable.fill(0);
+			}
+
+			// compresses into pOut, which must hold lz_bound(nCount) bytes. Returns the block size
+			size_t Compress(const uint8_t* pIn, size_t nCount, uint8_t* pOut)
+			{
+				if (uint64_t(m_nBase) + nCount + nLZMaxOffset + 1 >= UINT32_MAX)
+				{
+					m_vTable.fill(0);
+					m_nBase = 1;
+				}
+
+				uint8_t* pWrite = pOut;
+				size_t nAnchor = 0;
+				size_t i = 0;
+
+				if (nCount > nLZMatchFence)
+				{
+					size_t nMatchLimit = nCount - nLZLastLiterals;
+					size_t nMisses = 0;
+
+					while (i < nCount - nLZMatchFence)
+					{
+						uint32_t nSequence = Read32(pIn + i);
+						uint32_t& nSlot = m_vTable[Hash(nSequence)];
+						uint32_t nCandidate = nSlot;
+						nSlot = uint32_t(m_nBase + i);
+
+						if (nCandidate < m_nBase || i - (nCandidate - m_nBase) > nLZMaxOffset ||
+							Read32(pIn + (nCandidate - m_nBase)) != nSequence)
+						{
+							// skip faster through data that is not compressing
+							i += 1 + (nMisses++ >> 5);
+							continue;
+						}
+						nMisses = 0;
+
+						size_t nMatch = nCandidate - m_nBase;
+						size_t nLength = nLZMinMatch;
+						while (i + nLength < nMatchLimit && pIn[nMatch + nLength] == pIn[i + nLength])
+							nLength++;
+
+						WriteSequence(pWrite, pIn + nAnchor, i - nAnchor, uint16_t(i - nMatch), nLength);
+						i += nLength;
+						nAnchor = i;
+					}
+				}
+
+				// whatever is left goes as literals, with no match after them
+				size_t nLiterals = nCount - nAnchor;
+				WriteLength(pWrite, nLiterals, 4);
+				if (nLiterals > 0)
+					std::memcpy(pWrite, pIn + nAnchor, nLiterals);
+				pWrite += nLiterals;
+
+				m_nBase += uint32_t(nCount + nLZMaxOffset + 1);
+				return size_t(pWrite - pOut);
+			}
+
+		private:
+			static uint32_t Read32(const uint8_t* p)
+			{
+				uint32_t n;
+				std::memcpy(&n, p, sizeof(n));
+				return n;
+			}
+
+			static size_t Hash(uint32_t nSequence)
+			{
+				return size_t((nSequence * 2654435761u) >> (32 - nHashBits));
+			}
+
+			// the token nibble at nShift, plus 255s and a remainder once it overflows
+			static void WriteLength(uint8_t*& pWrite, size_t nLength, int nShift, uint8_t* pToken = nullptr)
+			{
+				if (pToken == nullptr)
+				{
+					pToken = pWrite++;
+					*pToken = 0;
+				}
+
+				if (nLength < 15)
+				{
+					*pToken |= uint8_t(nLength << nShift);
+					return;
+				}
+
+				*pToken |= uint8_t(15 << nShift);
+				nLength -= 15;
+				while (nLength >= 255)
+				{
+					*pWrite++ = 255;
+					nLength -= 255;
+				}
+				*pWrite++ = uint8_t(nLength);
+			}
+
+			static void WriteSequence(uint8_t*& pWrite, const uint8_t* pLiterals, size_t nLiterals, uint16_t nOffset, size_t nMatch)
+			{
+				uint8_t* pToken = pWrite;
+				WriteLength(pWrite, nLiterals, 4);
+				std::memcpy(pWrite, pLiterals, nLiterals);
+				pWrite += nLiterals;
+
+				*pWrite++ = uint8_t(nOffset);
+				*pWrite++ = uint8_t(nOffset >> 8);
+				WriteLength(pWrite, nMatch - nLZMinMatch, 0, pToken);
+			}
+
+		private:
+			std::array<uint32_t, size_t(1) << nHashBits> m_vTable;
+			uint32_t m_nBase = 1;
+		};
+
+		// expands a block into exactly nOut bytes, false if the block is malformed or does not
+		// produce exactly that many. Never reads or writes outside the two buffers
+		inline bool lz_decompress(const uint8_t* pIn, size_t nIn, uint8_t* pOut, size_t nOut)
+		{
+			const uint8_t* pRead = pIn;
+			const uint8_t* pEnd = pIn + nIn;
+			size_t nWritten = 0;
+
+			auto read_length = [&](size_t nLength, size_t& nResult) -> bool
+			{
+				if (nLength == 15)
+				{
+					uint8_t b;
+					do
+					{
+						if (pRead == pEnd)
+							return false;
+						b = *pRead++;
+						nLength += b;
+					} while (b == 255);
+				}
+				nResult = nLength;
+				return true;
+			};
+
+			while (pRead < pEnd)
+			{
+				uint8_t nToken = *pRead++;
+
+				size_t nLiterals;
+				if (!read_length(nToken >> 4, nLiterals) || nLiterals > size_t(pEnd - pRead) || nLiterals > nOut - nWritten)
+					return false;
+
+				if (nLiterals > 0)
+					std::memcpy(pOut + nWritten, pRead, nLiterals);
+				pRead += nLiterals;
+				nWritten += nLiterals;
+
+				// the last sequence stops after its literals
+				if (pRead == pEnd)
+					break;
+
+				if (pEnd - pRead < 2)
+					return false;
+				size_t nOffset = size_t(pRead[0]) | (size_t(pRead[1]) << 8);
+				pRead += 2;
+
+				size_t nMatch;
+				if (!read_length(nToken & 15, nMatch))
+					return false;
+				nMatch += nLZMinMatch;
+
+				if (nOffset == 0 || nOffset > nWritten || nMatch > nOut - nWritten)
+					return false;
+
+				// matches may overlap what they are copying, a byte at a time handles that
+				uint8_t* pCopy = pOut + nWritten;
+				const uint8_t* pFrom = pCopy - nOffset;
+				if (nOffset >= nMatch)
+					std::memcpy(pCopy, pFrom, nMatch);
+				else
+					for (size_t i = 0; i < nMatch; i++)
+						pCopy[i] = pFrom[i];
+				nWritten += nMatch;
+			}
+
+			return nWritten == nOut;
+		}
+	}
+}
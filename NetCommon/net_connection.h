@@ -2,7 +2,14 @@
 
 #include "net_common.h"
 #include "net_message.h"
+#include "net_log.h"
 #include "net_tsqueue.h"
+#include "net_mpscqueue.h"
+#include "net_metrics.h"
+#include "net_compress.h"
+#include "net_udp.h"
+#include "net_linksim.h"
+#include "net_sockopt.h"
 
 namespace olc
 {
@@ -11,6 +18,35 @@ namespace olc
 		template <typename T>
 		class server_interface;
 
+		// what a connection does with new messages once its outbound queue reaches the high watermark
+		enum class backpressure_policy
+		{
+			none,			// keep queueing, only OnBackpressure is told
+			block,			// Send waits until the queue has drained to the low watermark, or drops as drop_newest after tBlockTimeout.
+							// Only for a thread that sends to this one remote, see tBlockTimeout
+			drop_oldest,	// the oldest unsent messages are discarded to make room
+			drop_newest,	// the new message is discarded
+			coalesce		// a queued message with the same id is replaced by the new one
+		};
+
+		// A watermark is reached when either its byte or its message count is. Backpressure starts
+		// at the high watermark and ends once both counts are back at or under the low one.
+		// By default there is no limit at all
+		struct backpressure_limits
+		{
+			backpressure_policy policy = backpressure_policy::none;
+			size_t nHighBytes = SIZE_MAX;
+			size_t nHighMessages = SIZE_MAX;
+			size_t nLowBytes = 0;
+			size_t nLowMessages = 0;
+
+			// longest a blocked Send waits. A server's Update or shard thread serves every client,
+			// blocking it on one slow client stalls all the others, so block belongs on a client or
+			// on a thread dedicated to sending to one remote. The thread a sender blocks is often
+			// the one the remote's replies wait on, so waiting for ever could stall both ends
+			std::chrono::milliseconds tBlockTimeout{ 100 };
+		};
+
 		template <typename T>
 		class connection : public std::enable_shared_from_this<connection<T>>
 		{
@@ -21,10 +57,11 @@ namespace olc
 				client
 			};
 
-			connection(owner parent, asio::io_context& asioContext, asio::ip::tcp::socket socket, tsqueue<owned_message<T>>& qIn )
-				: m_asioContext(asioContext), m_socket(std::move(socket)), m_qMessagesIn(qIn)
+			connection(owner parent, asio::io_context& asioContext, asio::ip::tcp::socket socket, mpscqueue<owned_message<T>>& qIn )
+				: m_asioContext(asioContext), m_socket(std::move(socket)), m_pMessagesIn(&qIn), m_overflowTimer(asioContext), m_udpTimer(asioContext)
 			{
 				m_nOwnerType = parent;
+				m_metrics.nRecvBufferBytes.store(m_vRecvBuffer.size(), std::memory_order_relaxed);
 
 				if (m_nOwnerType == owner::server)
 				{
@@ -53,8 +90,17 @@ namespace olc
 					if (m_socket.is_open())
 					{
 						id = uid;
-						WriteValidation();
-						ReadValidation(server);
+						m_pServer = server;
+
+						// the connection may live on a different context to the acceptor, so the
+						// handshake is started from its own thread and it never needs a lock
+						asio::post(m_asioContext,
+							[this, server, self = this->shared_from_this()]()
+							{
+								WriteValidation();
+								ReadValidation(server);
+							}
+						);
 					}
 				}
 			}
@@ -68,8 +114,15 @@ namespace olc
 						{
 							if (!ec)
 							{
+								// datagrams go to the same address and port number as the stream
+								m_udpRemote = asio::ip::udp::endpoint(endpoint.address(), endpoint.port());
+								apply_socket_options(m_socket, m_sockopts);
 								ReadValidation();
 							}
+							else
+							{
+								CloseSocket();
+							}
 						}
 					);
 				}
@@ -78,7 +131,7 @@ namespace olc
 			void Disconnect()
 			{
 				if (IsConnected())
-					asio::post(m_asioContext, [this]() { m_socket.close(); });
+					asio::post(m_asioContext, [this]() { CloseSocket(); });
 			}
 
 			bool IsConnected() const
@@ -86,134 +139,743 @@ namespace olc
 				return m_socket.is_open();
 			}
 
+			// snapshot of this connection's counters, callable from any thread
+			connection_stats GetStats() const
+			{
+				return m_metrics.Snapshot(id);
+			}
+
+			// set before the connection starts sending, e.g. from the server's OnClientConnect
+			void SetBackpressure(const backpressure_limits& limits)
+			{
+				m_limits = limits;
+			}
+
+			const backpressure_limits& GetBackpressure() const
+			{
+				return m_limits;
+			}
+
+			// a frame claiming a bigger body, or a compressed one expanding past it, closes the
+			// connection before any room is made for it
+			void SetMaxBodySize(uint32_t nBytes)
+			{
+				m_nMaxBodyBytes = nBytes;
+			}
+
+			// offers to compress bodies of at least nThreshold bytes, 0 declines. Set before the
+			// handshake, compression is used only if both sides offer it, from the larger threshold
+			void SetCompression(uint32_t nThreshold)
+			{
+				m_nOptionsOut = (m_nOptionsOut & ~uint64_t(UINT32_MAX)) | (nThreshold & ~nHeaderCompressedBit);
+			}
+
+			// offers udp for the ids in options.channels. A server passes the socket its clients
+			// share, a client passes none and opens its own. Set before the handshake, udp is used
+			// only if both sides offer it
+			void EnableUdp(std::shared_ptr<udp_socket> pSocket, const udp_options<T>& options)
+			{
+				m_pUdpSocket = std::move(pSocket);
+				m_udpOptions = options;
+				m_nOptionsOut |= nOptionUdp;
+			}
+
+			// what the remote's datagrams carry to say they are from it, known once validated
+			uint64_t GetUdpKey() const
+			{
+				return m_nOwnerType == owner::server ? m_nHandshakeCheck : m_nHandshakeOut;
+			}
+
+			// any thread - hands a datagram from the server's shared socket to this connection
+			void PostDatagram(const uint8_t* pData, size_t nBytes, const asio::ip::udp::endpoint& remote)
+			{
+				asio::post(m_asioContext,
+					[this, self = this->weak_from_this(), vData = std::vector<uint8_t, pool_allocator<uint8_t>>(pData, pData + nBytes), remote]()
+					{
+						if (auto pin = self.lock())
+							ReceiveDatagram(vData.data(), vData.size(), remote);
+					}
+				);
+			}
+
+			// a server's connection applies them at once, a client's once connected
+			void SetSocketOptions(const socket_options& options)
+			{
+				m_sockopts = options;
+				if (options.bAutoTune)
+					m_pTuner = std::make_unique<socket_tuner>(options);
+				if (m_nOwnerType == owner::server && m_socket.is_open())
+					apply_socket_options(m_socket, options);
+			}
+
+			// puts a simulated network between this end and its sockets, see link_conditions.
+			// Set before the connection starts sending
+			void SetLinkConditions(const link_conditions& conditions)
+			{
+				m_pLink = std::make_unique<link_simulator>(m_socket, conditions, this->weak_from_this());
+			}
+
+			// server - where this connection's messages go from now on. The switch is made on the io
+			// thread. With bRelease the old queue then gets an entry marked bReleased, behind every
+			// message that went there, so its consumer can tell when it has taken the last of them
+			void SetIncomingQueue(mpscqueue<owned_message<T>>& qIn, bool bRelease = false)
+			{
+				asio::post(m_asioContext,
+					[this, self = this->shared_from_this(), pQueue = &qIn, bRelease]()
+					{
+						mpscqueue<owned_message<T>>* pOld = m_pMessagesIn;
+						m_pMessagesIn = pQueue;
+						if (bRelease)
+							QueueIncoming(*pOld, { self, {}, true });
+					}
+				);
+			}
+
+			// client - io thread calls, set before connecting. fnResponse is offered each message marked
+			// as a reply and returns true if it took it, fnArrival is called after the rest are queued
+			// and fnClosed once the socket closes, or the connect fails
+			void SetIncomingHandlers(std::function<bool(message<T>&)> fnResponse, std::function<void()> fnArrival, std::function<void()> fnClosed)
+			{
+				m_fnResponse = std::move(fnResponse);
+				m_fnArrival = std::move(fnArrival);
+				m_fnClosed = std::move(fnClosed);
+			}
+
+			// latest snapshot this remote has acknowledged, only touched by the server's logic thread
+			uint32_t GetSnapshotAcked() const
+			{
+				return m_nSnapshotAcked;
+			}
+
+			void SetSnapshotAcked(uint32_t nSequence)
+			{
+				m_nSnapshotAcked = std::max(m_nSnapshotAcked, nSequence);
+			}
+
+			// the message is copied exactly once, prefer the rvalue overload when done with it
 			void Send(const message<T>& msg)
 			{
+				Send(message<T>(msg));
+			}
+
+			void Send(message<T>&& msg)
+			{
+				Send(make_shared_message(std::move(msg)));
+			}
+
+			// queues a reference to the message, its body is shared rather than copied. Ids given a
+			// udp channel go as datagrams once udp is up, until then and when too big they stream
+			void Send(shared_message<T> pMsg)
+			{
+				auto itChannel = m_udpOptions.channels.find(pMsg->header.id);
+				if (itChannel != m_udpOptions.channels.end() && udp_session<T>::Fits(*pMsg))
+				{
+					asio::post(m_asioContext,
+						[this, pMsg = std::move(pMsg), channel = itChannel->second]() mutable
+						{
+							if (m_pUdp && m_pUdp->Established())
+								m_pUdp->Send(pMsg, channel, std::chrono::steady_clock::now());
+							else
+								SendStream(std::move(pMsg));
+						}
+					);
+					return;
+				}
+
+				SendStream(std::move(pMsg));
+			}
+
+		private:
+			// the tcp half of Send
+			void SendStream(shared_message<T> pMsg)
+			{
+				size_t nFrameBytes = FrameBytes(*pMsg);
+
+				if (m_limits.policy == backpressure_policy::drop_newest &&
+					(m_bBackpressure.load(std::memory_order_acquire) || OverHighWatermark()))
+				{
+					m_metrics.nMessagesDropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+
+				if (m_limits.policy == backpressure_policy::block && !WaitForLowWatermark())
+				{
+					m_metrics.nMessagesDropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+
+				// counted here rather than on the io thread, so messages still waiting in the
+				// context's handler queue are held against the watermarks too
+				m_nQueuedBytes.fetch_add(nFrameBytes);
+				m_nQueuedMessages.fetch_add(1);
+
 				asio::post(m_asioContext,
-					[this, msg]()
+					[this, pMsg = std::move(pMsg), tQueued = std::chrono::steady_clock::now()]() mutable
 					{
 						bool bWritingMessage = !m_qMessagesOut.empty();
-						m_qMessagesOut.push_back(msg);
+
+						if (!(m_limits.policy == backpressure_policy::coalesce && m_bBackpressure.load(std::memory_order_relaxed) && Coalesce(pMsg, tQueued)))
+							m_qMessagesOut.push_back({ std::move(pMsg), tQueued });
+
+						if (m_limits.policy == backpressure_policy::drop_oldest)
+							DropOldest();
+
+						UpdateBackpressure();
 						if (!bWritingMessage)
 						{
-							WriteHeader();
+							WriteMessages();
 						}
 					}
 				);
 			}
 
-		private:
-			// async - prime context ready to read the message header
-			void ReadHeader()
+			// a message's header as it goes on the wire, and where its compressed body sits in
+			// m_vCompressed if it has one
+			static constexpr size_t nNotCompressed = SIZE_MAX;
+			struct write_frame
+			{
+				message_header<T> header;
+				size_t nCompressedAt;
+			};
+
+			// io thread - every close goes through here, so a simulated link drops what it still holds
+			void CloseSocket()
+			{
+				m_socket.close();
+				if (m_pLink)
+					m_pLink->Close();
+
+				// a sender blocked on the watermark gives up on a closed connection at once
+				m_bClosed.store(true);
+				if (m_nBlockedSenders.load() > 0)
+				{
+					std::scoped_lock lock(m_muxBackpressure);
+					m_cvBackpressure.notify_all();
+				}
+
+				if (m_fnClosed)
+					m_fnClosed();
+			}
+
+			// async - prime context ready to read whatever the socket has into the receive buffer
+			void ReadData()
 			{
-				asio::async_read(m_socket, asio::buffer(&m_msgTemporaryIn.header, sizeof(message_header<T>)),
+				// shuffle any partial frame left over from the last read down to the front
+				if (m_nRecvHead > 0)
+				{
+					std::memmove(m_vRecvBuffer.data(), m_vRecvBuffer.data() + m_nRecvHead, m_nRecvTail - m_nRecvHead);
+					m_nRecvTail -= m_nRecvHead;
+					m_nRecvHead = 0;
+				}
+
+				// room for the whole of a frame that does not fit, or more room for a stream that
+				// filled the last read. Once neither holds the buffer goes back to its first size
+				size_t nWant = std::max(m_nRecvNeeded, m_bRecvFilled ? std::min(m_vRecvBuffer.size() * 2, nRecvStreamBytes) : 0);
+				if (nWant > m_vRecvBuffer.size())
+					ResizeRecvBuffer(nWant);
+				else if (!m_bRecvFilled && m_vRecvBuffer.size() > nRecvInitialBytes && m_nRecvTail <= nRecvInitialBytes && m_nRecvNeeded <= nRecvInitialBytes)
+					ResizeRecvBuffer(nRecvInitialBytes);
+
+				m_socket.async_read_some(asio::buffer(m_vRecvBuffer.data() + m_nRecvTail, m_vRecvBuffer.size() - m_nRecvTail),
 					[this](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
 						{
-							if (m_msgTemporaryIn.header.size > 0)
+							bump(m_metrics.nBytesIn, length);
+							m_nRecvTail += length;
+							m_bRecvFilled = m_nRecvTail == m_vRecvBuffer.size() && m_vRecvBuffer.size() <= nRecvStreamBytes;
+
+							if (m_sockopts.bQuickAck)
+								set_quick_ack(m_socket);
+							if (m_pTuner)
+								m_pTuner->OnRead(m_socket, length);
+
+							if (ReadMessages())
 							{
-								m_msgTemporaryIn.body.resize(m_msgTemporaryIn.header.size);
-								ReadBody();
+								// with messages waiting for room the socket is left unread, see RetryOverflow
+								if (m_qIncomingOverflow.empty())
+									ReadData();
+								else
+									m_bReadPaused = true;
 							}
 							else
 							{
-								AddToIncomingQueue();
+								OLC_NET_LOG(warn, "[{}] Bad Frame", id);
+								CloseSocket();
 							}
 						}
 						else
 						{
-							std::cout << "[" << id << "] Read Header Fail" << std::endl;
-							m_socket.close();
+							OLC_NET_LOG(info, "[{}] Read Fail", id);
+							CloseSocket();
 						}
 					}
 				);
 			}
 
-			// async - prime context ready to read the body
-			void ReadBody()
+			// a fresh buffer of nBytes holding whatever is pending, which ReadData has already moved
+			// to the front. A plain resize would never give memory back
+			void ResizeRecvBuffer(size_t nBytes)
 			{
-				asio::async_read(m_socket, asio::buffer(m_msgTemporaryIn.body.data(), m_msgTemporaryIn.body.size()),
-					[this](std::error_code ec, std::size_t length)
+				std::vector<uint8_t> vResized(nBytes);
+				std::memcpy(vResized.data(), m_vRecvBuffer.data(), m_nRecvTail);
+				m_vRecvBuffer.swap(vResized);
+				m_metrics.nRecvBufferBytes.store(nBytes, std::memory_order_relaxed);
+			}
+
+			// pull every complete frame out of the receive buffer, a partial one is left for next time.
+			// False if a frame cannot be understood or is too big, nothing after it can be trusted either
+			bool ReadMessages()
+			{
+				m_nRecvNeeded = 0;
+				while (m_nRecvTail - m_nRecvHead >= sizeof(message_header<T>))
+				{
+					const uint8_t* pFrame = m_vRecvBuffer.data() + m_nRecvHead;
+					std::memcpy(&m_msgTemporaryIn.header, pFrame, sizeof(message_header<T>));
+
+					bool bCompressed = (m_msgTemporaryIn.header.size & nHeaderCompressedBit) != 0;
+					size_t nBodyBytes = m_msgTemporaryIn.header.size & ~nHeaderCompressedBit;
+					if (nBodyBytes > m_nMaxBodyBytes)
+						return false;
+
+					size_t nFrameBytes = sizeof(message_header<T>) + nBodyBytes;
+					if (m_nRecvTail - m_nRecvHead < nFrameBytes)
 					{
-						if (!ec)
-						{
-							AddToIncomingQueue();
-						}
-						else
-						{
-							std::cout << "[" << id << "] Read Body Fail" << std::endl;
-							m_socket.close();
-						}
+						m_nRecvNeeded = nFrameBytes;
+						break;
 					}
-				);
+
+					const uint8_t* pBody = pFrame + sizeof(message_header<T>);
+					if (bCompressed)
+					{
+						if (!ExpandBody(pBody, nBodyBytes))
+							return false;
+					}
+					else
+					{
+						m_msgTemporaryIn.body.assign(pBody, pBody + nBodyBytes);
+					}
+
+					m_nRecvHead += nFrameBytes;
+					bump(m_metrics.nMessagesIn);
+
+					AddToIncomingQueue();
+				}
+				return true;
 			}
 
-			// async - prime context ready to write the message header
-			void WriteHeader()
+			// a compressed body is its expanded size followed by the compressed block
+			bool ExpandBody(const uint8_t* pBody, size_t nBodyBytes)
 			{
-				asio::async_write(m_socket, asio::buffer(&m_qMessagesOut.front().header, sizeof(message_header<T>)),
+				if (m_nCompressThreshold == 0 || nBodyBytes < sizeof(uint32_t))
+					return false;
+
+				uint32_t nExpanded;
+				std::memcpy(&nExpanded, pBody, sizeof(uint32_t));
+
+				// no block expands by more than about 255 times, a claim beyond that is not allocated
+				size_t nBlockBytes = nBodyBytes - sizeof(uint32_t);
+				if (nExpanded > nBlockBytes * 255 + 16 || nExpanded > m_nMaxBodyBytes || nExpanded >= nHeaderCompressedBit)
+					return false;
+
+				m_msgTemporaryIn.body.resize(nExpanded);
+				if (!lz_decompress(pBody + sizeof(uint32_t), nBlockBytes, m_msgTemporaryIn.body.data(), nExpanded))
+					return false;
+
+				m_msgTemporaryIn.header.size = nExpanded;
+				return true;
+			}
+
+			// async - prime context ready to write the queued messages. Header and body of as many
+			// messages as fit the budget go out together in a single gather write
+			void WriteMessages()
+			{
+				m_vWriteBuffers.clear();
+				m_vWriteFrames.clear();
+				m_nCompressedBytes = 0;
+				m_nMessagesWriting = 0;
+				m_nBytesWriting = 0;
+
+				// first decide what goes and compress what should be, the compressed bodies all
+				// land in one reused buffer which may move while it fills
+				size_t nBytes = 0;
+				for (const auto& out : m_qMessagesOut)
+				{
+					const message<T>& msg = *out.pMsg;
+					size_t nFrameBytes = sizeof(message_header<T>) + msg.body.size();
+
+					// the first message always goes, however big it is
+					if (m_nMessagesWriting > 0 &&
+						(nBytes + nFrameBytes > nWriteBudgetBytes || 2 * (m_nMessagesWriting + 1) > nWriteBudgetBuffers))
+						break;
+
+					write_frame frame{ msg.header, nNotCompressed };
+					if (m_nCompressThreshold > 0 && msg.body.size() >= m_nCompressThreshold)
+						CompressBody(msg, frame);
+
+					m_vWriteFrames.push_back(frame);
+					nBytes += nFrameBytes;
+					m_nMessagesWriting++;
+				}
+				m_nBytesWriting = nBytes;
+
+				for (size_t i = 0; i < m_nMessagesWriting; i++)
+				{
+					const write_frame& frame = m_vWriteFrames[i];
+					const message<T>& msg = *m_qMessagesOut[i].pMsg;
+
+					m_vWriteBuffers.push_back(asio::buffer(&frame.header, sizeof(message_header<T>)));
+					if (frame.nCompressedAt != nNotCompressed)
+						m_vWriteBuffers.push_back(asio::buffer(m_vCompressed.data() + frame.nCompressedAt, frame.header.size & ~nHeaderCompressedBit));
+					else if (!msg.body.empty())
+						m_vWriteBuffers.push_back(asio::buffer(msg.body.data(), msg.body.size()));
+				}
+
+				auto onWritten =
 					[this](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
 						{
-							if (m_qMessagesOut.front().body.size() > 0)
+							auto tNow = std::chrono::steady_clock::now();
+							for (size_t i = 0; i < m_nMessagesWriting; i++)
+								m_metrics.sendLatency.Record(tNow - m_qMessagesOut[i].tQueued);
+
+							m_qMessagesOut.erase(m_qMessagesOut.begin(), m_qMessagesOut.begin() + m_nMessagesWriting);
+
+							bump(m_metrics.nBytesOut, length);
+							bump(m_metrics.nMessagesOut, m_nMessagesWriting);
+							bump(m_metrics.nWrites);
+
+							if (m_pTuner)
+								m_pTuner->OnWrite(m_socket, length, !m_qMessagesOut.empty());
+
+							// the queue counts frames as they were sent to it, not as compressed
+							Release(m_nBytesWriting, m_nMessagesWriting);
+							m_nMessagesWriting = 0;
+							UpdateBackpressure();
+
+							if (!m_qMessagesOut.empty())
 							{
-								WriteBody();
-							}
-							else
-							{
-								m_qMessagesOut.pop_front();
-								if (!m_qMessagesOut.empty())
-								{
-									WriteHeader();
-								}
+								WriteMessages();
 							}
 						}
 						else
 						{
-							std::cout << "[" << id << "] Write Header Fail" << std::endl;
-							m_socket.close();
+							OLC_NET_LOG(warn, "[{}] Write Fail", id);
+							CloseSocket();
 						}
+					};
+
+				if (m_pLink)
+					m_pLink->Write(m_vWriteBuffers, std::move(onWritten));
+				else
+					asio::async_write(m_socket, m_vWriteBuffers, std::move(onWritten));
+			}
+
+			static size_t FrameBytes(const message<T>& msg)
+			{
+				return sizeof(message_header<T>) + msg.body.size();
+			}
+
+			bool OverHighWatermark() const
+			{
+				return m_nQueuedBytes.load() >= m_limits.nHighBytes || m_nQueuedMessages.load() >= m_limits.nHighMessages;
+			}
+
+			bool UnderLowWatermark() const
+			{
+				return m_nQueuedBytes.load() <= m_limits.nLowBytes && m_nQueuedMessages.load() <= m_limits.nLowMessages;
+			}
+
+			void Release(size_t nBytes, size_t nMessages)
+			{
+				m_nQueuedBytes.fetch_sub(nBytes);
+				m_nQueuedMessages.fetch_sub(nMessages);
+			}
+
+			// any thread but the io thread - the io thread is the one draining the queue, so it
+			// only ever gets past the watermark, never stuck behind it. False if the queue was
+			// still over the low watermark after tBlockTimeout
+			bool WaitForLowWatermark()
+			{
+				if (m_asioContext.get_executor().running_in_this_thread())
+					return true;
+
+				if (!m_bBackpressure.load(std::memory_order_acquire) && !OverHighWatermark())
+					return true;
+
+				// announced before the counts are looked at, so a release or a close either sees the
+				// waiter or the waiter sees it. The socket itself belongs to the io thread, m_bClosed
+				// stands in for it here
+				auto tGiveUp = std::chrono::steady_clock::now() + m_limits.tBlockTimeout;
+				m_nBlockedSenders.fetch_add(1);
+				std::unique_lock<std::mutex> lock(m_muxBackpressure);
+				bool bReady = m_cvBackpressure.wait_until(lock, tGiveUp, [this]() { return UnderLowWatermark() || m_bClosed.load(); });
+				m_nBlockedSenders.fetch_sub(1);
+				return bReady;
+			}
+
+			// io thread - swaps the newest message in for an unsent one of the same id. Entries
+			// covered by the write in flight are left alone, asio still reads from them
+			bool Coalesce(shared_message<T>& pMsg, std::chrono::steady_clock::time_point tQueued)
+			{
+				for (size_t i = m_qMessagesOut.size(); i-- > m_nMessagesWriting;)
+				{
+					outgoing& out = m_qMessagesOut[i];
+					if (out.pMsg->header.id == pMsg->header.id)
+					{
+						Release(FrameBytes(*out.pMsg), 1);
+						out.pMsg = std::move(pMsg);
+						out.tQueued = tQueued;
+						m_metrics.nMessagesCoalesced.fetch_add(1, std::memory_order_relaxed);
+						return true;
 					}
-				);
+				}
+				return false;
 			}
 
-			// async - prime context ready to write the message body
-			void WriteBody()
+			// io thread - discards unsent messages from the front until under the high watermark,
+			// always keeping the one just queued
+			void DropOldest()
 			{
-				asio::async_write(m_socket, asio::buffer(m_qMessagesOut.front().body.data(), m_qMessagesOut.front().body.size()),
+				while (OverHighWatermark() && m_qMessagesOut.size() > m_nMessagesWriting + 1)
+				{
+					auto it = m_qMessagesOut.begin() + m_nMessagesWriting;
+					Release(FrameBytes(*it->pMsg), 1);
+					m_qMessagesOut.erase(it);
+					m_metrics.nMessagesDropped.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+
+			// io thread - moves in and out of backpressure as the watermarks are crossed
+			void UpdateBackpressure()
+			{
+				m_metrics.nOutQueueDepth.store(m_qMessagesOut.size(), std::memory_order_relaxed);
+				m_metrics.nOutQueueBytes.store(m_nQueuedBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+				bool bBackpressure = m_bBackpressure.load(std::memory_order_relaxed);
+				if (!bBackpressure && OverHighWatermark())
+				{
+					m_bBackpressure.store(true, std::memory_order_release);
+					if (m_pServer)
+						m_pServer->OnBackpressure(this->shared_from_this(), true);
+				}
+				else if (bBackpressure && UnderLowWatermark())
+				{
+					m_bBackpressure.store(false, std::memory_order_release);
+					if (m_pServer)
+						m_pServer->OnBackpressure(this->shared_from_this(), false);
+				}
+
+				if (m_nBlockedSenders.load() > 0 && UnderLowWatermark())
+				{
+					std::scoped_lock lock(m_muxBackpressure);
+					m_cvBackpressure.notify_all();
+				}
+			}
+
+			// compresses a body into the shared buffer, leaving the frame as it was if that saves nothing
+			void CompressBody(const message<T>& msg, write_frame& frame)
+			{
+				size_t nAt = m_nCompressedBytes;
+				size_t nNeeded = nAt + sizeof(uint32_t) + lz_bound(msg.body.size());
+				if (m_vCompressed.size() < nNeeded)
+					m_vCompressed.resize(nNeeded);
+
+				uint32_t nExpanded = uint32_t(msg.body.size());
+				std::memcpy(m_vCompressed.data() + nAt, &nExpanded, sizeof(uint32_t));
+				size_t nBlock = m_pCompressor->Compress(msg.body.data(), msg.body.size(), m_vCompressed.data() + nAt + sizeof(uint32_t));
+
+				if (sizeof(uint32_t) + nBlock >= msg.body.size())
+					return;
+
+				frame.header.size = uint32_t(sizeof(uint32_t) + nBlock) | nHeaderCompressedBit;
+				frame.nCompressedAt = nAt;
+				m_nCompressedBytes = nAt + sizeof(uint32_t) + nBlock;
+			}
+
+			// both sides have seen each other's options once the handshake words have crossed
+			void NegotiateOptions()
+			{
+				uint32_t nOurs = uint32_t(m_nOptionsOut);
+				uint32_t nTheirs = uint32_t(m_nOptionsIn) & ~nHeaderCompressedBit;
+				m_nCompressThreshold = (nOurs > 0 && nTheirs > 0) ? std::max(nOurs, nTheirs) : 0;
+
+				if (m_nCompressThreshold > 0 && !m_pCompressor)
+					m_pCompressor = std::make_unique<lz_context>();
+
+				if ((m_nOptionsOut & nOptionUdp) && (m_nOptionsIn & nOptionUdp))
+					StartUdp();
+			}
+
+			// the client opens its socket towards the server, the server has its clients find
+			// this connection by key. Either way the session says hello until it hears back
+			void StartUdp()
+			{
+				try
+				{
+					if (m_nOwnerType == owner::server)
+					{
+						m_pServer->AddUdpSession(GetUdpKey(), this->shared_from_this());
+					}
+					else
+					{
+						m_pUdpSocket = std::make_shared<udp_socket>(m_asioContext, asio::ip::udp::endpoint(m_udpRemote.protocol(), 0));
+						apply_socket_options(m_pUdpSocket->Socket(), m_sockopts);
+						ReadDatagram();
+					}
+				}
+				catch (std::exception& e)
+				{
+					OLC_NET_LOG(error, "[{}] UDP Exception: {}", id, e.what());
+					return;
+				}
+
+				m_pUdp = std::make_unique<udp_session<T>>(GetUdpKey(), m_metrics,
+					[this](const uint8_t* pData, size_t nBytes)
+					{
+						// a server only knows where to send once its client has been heard from
+						if (m_udpRemote.port() == 0)
+							return;
+
+						if (m_pLink)
+							m_pLink->SendTo(m_pUdpSocket, pData, nBytes, m_udpRemote);
+						else
+							m_pUdpSocket->SendTo(pData, nBytes, m_udpRemote);
+					});
+				TickUdp();
+			}
+
+			// async - a client reads its own socket, a server's connections are handed datagrams
+			void ReadDatagram()
+			{
+				m_pUdpSocket->Socket().async_receive_from(asio::buffer(m_vDatagramIn), m_udpSender,
 					[this](std::error_code ec, std::size_t length)
 					{
+						if (ec == asio::error::operation_aborted || !m_socket.is_open())
+							return;
+
+						// a failed receive is only ever about one datagram, the next may be fine
 						if (!ec)
-						{
-							m_qMessagesOut.pop_front();
+							ReceiveDatagram(m_vDatagramIn.data(), length, m_udpSender);
+						ReadDatagram();
+					}
+				);
+			}
 
-							if (!m_qMessagesOut.empty())
-							{
-								WriteHeader();
-							}
-						}
-						else
-						{
-							std::cout << "[" << id << "] Write Body Fail" << std::endl;
-							m_socket.close();
-						}
+			void ReceiveDatagram(const uint8_t* pData, size_t nBytes, const asio::ip::udp::endpoint& remote)
+			{
+				if (!m_pUdp)
+					return;
+
+				bool bValid = m_pUdp->Receive(pData, nBytes, std::chrono::steady_clock::now(),
+					[this](message<T>&& msg)
+					{
+						m_msgTemporaryIn = std::move(msg);
+						AddToIncomingQueue();
+					});
+
+				// the server learns where its client is from its datagrams and follows it if it moves
+				if (bValid && m_nOwnerType == owner::server)
+					m_udpRemote = remote;
+			}
+
+			// async - drives resends and acks until the stream closes. Holds the connection weakly,
+			// a server may drop it at any time and a client's outlives its context anyway
+			void TickUdp()
+			{
+				m_udpTimer.expires_after(nUdpTick);
+				m_udpTimer.async_wait(
+					[this, self = this->weak_from_this(), bServer = m_nOwnerType == owner::server](std::error_code ec)
+					{
+						if (ec)
+							return;
+
+						auto pin = self.lock();
+						if ((bServer && !pin) || !m_socket.is_open())
+							return;
+
+						m_pUdp->Tick(std::chrono::steady_clock::now());
+						TickUdp();
 					}
 				);
 			}
 
 			void AddToIncomingQueue()
 			{
-				if (m_nOwnerType == owner::server)
-				{
-					m_qMessagesIn.push_back({ this->shared_from_this(), m_msgTemporaryIn });
-				}
-				else
+				// a reply goes straight to the request awaiting it, if there still is one
+				if (m_nOwnerType == owner::client && (m_msgTemporaryIn.header.sequence & nSequenceReplyBit) && m_fnResponse && m_fnResponse(m_msgTemporaryIn))
+					return;
+
+				// the body is moved into the queue, the next frame parsed allocates a fresh one.
+				// client have unique_ptr, cannot use shared_from_this
+				owned_message<T> msg{ m_nOwnerType == owner::server ? this->shared_from_this() : nullptr, std::move(m_msgTemporaryIn) };
+				QueueIncoming(*m_pMessagesIn, std::move(msg));
+			}
+
+			// the io thread never waits on a full queue, the message joins the overflow and keeps
+			// its place in line
+			void QueueIncoming(mpscqueue<owned_message<T>>& qIn, owned_message<T>&& msg)
+			{
+				if (!m_qIncomingOverflow.empty() || !PushIncoming(qIn, std::move(msg)))
 				{
-					m_qMessagesIn.push_back({ nullptr, m_msgTemporaryIn }); // client have unique_ptr, cannot use shared_from_this
+					if (m_qIncomingOverflow.empty())
+					{
+						bump(m_metrics.nIncomingStalls);
+						RetryOverflow();
+					}
+					m_qIncomingOverflow.push_back({ &qIn, std::move(msg) });
 				}
+			}
 
-				ReadHeader();
+			// false, with msg untouched, if the queue is full
+			bool PushIncoming(mpscqueue<owned_message<T>>& qIn, owned_message<T>&& msg)
+			{
+				if (!qIn.try_push_back(std::move(msg)))
+					return false;
+
+				if (m_fnArrival)
+					m_fnArrival();
+				return true;
+			}
+
+			// async - moves the overflow into the queue as the consumer makes room, then reads the
+			// socket again. Meanwhile tcp flow control holds the remote back
+			void RetryOverflow()
+			{
+				m_overflowTimer.expires_after(std::chrono::milliseconds(1));
+				m_overflowTimer.async_wait(
+					[this, self = this->weak_from_this(), bServer = m_nOwnerType == owner::server](std::error_code ec)
+					{
+						if (ec)
+							return;
+
+						auto pin = self.lock();
+						if (bServer && !pin)
+							return;
+
+						// a server's entries own the connection, closed they have to go for it to be
+						// freed. Release markers are still delivered, a shard waits on them
+						if (!m_socket.is_open())
+						{
+							m_qIncomingOverflow.erase(std::remove_if(m_qIncomingOverflow.begin(), m_qIncomingOverflow.end(),
+								[](const incoming& pending) { return !pending.msg.bReleased; }), m_qIncomingOverflow.end());
+						}
+
+						while (!m_qIncomingOverflow.empty() && PushIncoming(*m_qIncomingOverflow.front().pQueue, std::move(m_qIncomingOverflow.front().msg)))
+							m_qIncomingOverflow.pop_front();
+
+						if (!m_qIncomingOverflow.empty())
+						{
+							RetryOverflow();
+						}
+						else if (m_bReadPaused && m_socket.is_open())
+						{
+							m_bReadPaused = false;
+							ReadData();
+						}
+					}
+				);
 			}
 
 			// encrypt data
@@ -226,19 +888,20 @@ namespace olc
 
 			void WriteValidation()
 			{
-				asio::async_write(m_socket, asio::buffer(&m_nHandshakeOut, sizeof(uint64_t)),
+				std::array<asio::const_buffer, 2> vHandshake = { asio::buffer(&m_nHandshakeOut, sizeof(uint64_t)), asio::buffer(&m_nOptionsOut, sizeof(uint64_t)) };
+				asio::async_write(m_socket, vHandshake,
 					[this](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
 						{
 							if (m_nOwnerType == owner::client)
 							{
-								ReadHeader();
+								ReadData();
 							}
 						}
 						else
 						{
-							m_socket.close();
+							CloseSocket();
 						}
 					}
 				);
@@ -246,7 +909,8 @@ namespace olc
 
 			void ReadValidation(server_interface<T>* server = nullptr)
 			{
-				asio::async_read(m_socket, asio::buffer(&m_nHandshakeIn, sizeof(uint64_t)),
+				std::array<asio::mutable_buffer, 2> vHandshake = { asio::buffer(&m_nHandshakeIn, sizeof(uint64_t)), asio::buffer(&m_nOptionsIn, sizeof(uint64_t)) };
+				asio::async_read(m_socket, vHandshake,
 					[this, server](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
@@ -255,26 +919,31 @@ namespace olc
 							{
 								if (m_nHandshakeIn == m_nHandshakeCheck)
 								{
-									std::cout << "Client validated" << std::endl;
+									NegotiateOptions();
+									OLC_NET_LOG(info, "Client validated");
 									server->OnClientValidated(this->shared_from_this());
 
-									ReadHeader();
+									ReadData();
 								}
 								else
 								{
-									m_socket.close();
+									server->Metrics().nHandshakeFailures++;
+									CloseSocket();
 								}
 							}
 							else
 							{
 								m_nHandshakeOut = scramble(m_nHandshakeIn);
+								NegotiateOptions();
 
 								WriteValidation();
 							}
 						}
 						else
 						{
-							m_socket.close();
+							if (server)
+								server->Metrics().nHandshakeFailures++;
+							CloseSocket();
 						}
 					}
 				);
@@ -286,23 +955,120 @@ namespace olc
 			// this context is shared with the whole asio instance
 			asio::io_context& m_asioContext;
 
-			// this queue holds all messages to be sent to the remote side of the connection
-			tsqueue<message<T>> m_qMessagesOut;
+			// a queued message and when Send was called for it
+			struct outgoing
+			{
+				shared_message<T> pMsg;
+				std::chrono::steady_clock::time_point tQueued;
+			};
+
+			// this queue holds all messages to be sent to the remote side of the connection.
+			// Only ever touched from this connection's context, so it needs no lock. Messages
+			// are immutable and may be shared with the queues of other connections
+			std::deque<outgoing> m_qMessagesOut;
+
+			// gather list for the write in flight and how many messages from the front it covers
+			std::vector<asio::const_buffer> m_vWriteBuffers;
+			size_t m_nMessagesWriting = 0;
+			size_t m_nBytesWriting = 0;
+
+			// the header as it goes on the wire for each message in the write
+			std::vector<write_frame> m_vWriteFrames;
+
+			// compression, agreed during the handshake. The buffer and match finder are kept for
+			// the life of the connection so compressing does not allocate once warmed up
+			uint32_t m_nCompressThreshold = 0;
+			std::unique_ptr<lz_context> m_pCompressor;
+			std::vector<uint8_t> m_vCompressed;
+			size_t m_nCompressedBytes = 0;
+
+			// upper bounds on a single gather write, asio hands at most 64 buffers to one syscall
+			static constexpr size_t nWriteBudgetBytes = 64 * 1024;
+			static constexpr size_t nWriteBudgetBuffers = 64;
 
 			// this queue holds all messages that have been received from the remote
-			// side of this connection. Note it is a reference as the owner of this 
-			// connection is expected to provide a queue
-			tsqueue<owned_message<T>>& m_qMessagesIn;
+			// side of this connection. The owner of this connection is expected to provide
+			// it, and a sharded server may point it elsewhere, only ever on the io thread
+			mpscqueue<owned_message<T>>* m_pMessagesIn = nullptr;
 			message<T> m_msgTemporaryIn;
 
+			// messages the incoming queue had no room for, oldest first, each with the queue it
+			// is for. While there are any the socket is not read, only datagrams can still add to them
+			struct incoming
+			{
+				mpscqueue<owned_message<T>>* pQueue;
+				owned_message<T> msg;
+			};
+			std::deque<incoming> m_qIncomingOverflow;
+			asio::steady_timer m_overflowTimer;
+			bool m_bReadPaused = false;
+			std::function<bool(message<T>&)> m_fnResponse;
+			std::function<void()> m_fnArrival;
+			std::function<void()> m_fnClosed;
+
+			// socket options from the owner, and the buffer tuner if it asked for one
+			socket_options m_sockopts;
+			std::unique_ptr<socket_tuner> m_pTuner;
+
+			// bytes read from the socket but not yet parsed into messages, everything between
+			// head and tail is pending. Starts small, as most connections are idle most of the time.
+			// Grows to fit a frame no bigger than the body limit allows, or up to the stream size
+			// while reads keep filling it, and shrinks back once those have been consumed
+			static constexpr size_t nRecvInitialBytes = 8 * 1024;
+			static constexpr size_t nRecvStreamBytes = 64 * 1024;
+			std::vector<uint8_t> m_vRecvBuffer = std::vector<uint8_t>(nRecvInitialBytes);
+			size_t m_nRecvHead = 0;
+			size_t m_nRecvTail = 0;
+			size_t m_nRecvNeeded = 0;	// the size of the partial frame at the front, 0 if it fits
+			bool m_bRecvFilled = false;	// the last read filled a buffer of at most the stream size, more is likely waiting
+			uint32_t m_nMaxBodyBytes = nDefaultMaxBodyBytes;
+
 			// the owner decides how some of the connection behaves
 			owner m_nOwnerType = owner::server;
 			uint32_t id = 0;
 
+			// written by this connection's io thread only, readable from anywhere
+			connection_metrics m_metrics;
+
+			// outbound queue limits. The counts are raised by Send on any thread and lowered on
+			// the io thread as messages are written, dropped or coalesced
+			backpressure_limits m_limits;
+			server_interface<T>* m_pServer = nullptr;
+			std::atomic<size_t> m_nQueuedBytes{ 0 };
+			std::atomic<size_t> m_nQueuedMessages{ 0 };
+			std::atomic<bool> m_bBackpressure{ false };
+			std::atomic<uint32_t> m_nBlockedSenders{ 0 };
+			std::atomic<bool> m_bClosed{ false };
+			std::mutex m_muxBackpressure;
+			std::condition_variable m_cvBackpressure;
+
+			// delta snapshots sent to this remote are encoded against this one
+			uint32_t m_nSnapshotAcked = 0;
+
 			// handshake validation
 			uint64_t m_nHandshakeOut = 0;
 			uint64_t m_nHandshakeIn = 0;
 			uint64_t m_nHandshakeCheck = 0;
+
+			// sent along with the handshake words, the low 32 bits are the compression threshold
+			// offered, bit 32 offers udp and the rest are reserved as zero
+			static constexpr uint64_t nOptionUdp = uint64_t(1) << 32;
+			uint64_t m_nOptionsOut = 0;
+			uint64_t m_nOptionsIn = 0;
+
+			// udp channels, the session exists once both sides have agreed to use them
+			udp_options<T> m_udpOptions;
+			std::shared_ptr<udp_socket> m_pUdpSocket;
+			std::unique_ptr<udp_session<T>> m_pUdp;
+			asio::ip::udp::endpoint m_udpRemote;
+			asio::steady_timer m_udpTimer;
+
+			// a client's receive buffer, a server reads all datagrams on one socket of its own
+			std::array<uint8_t, nUdpMaxDatagram> m_vDatagramIn;
+			asio::ip::udp::endpoint m_udpSender;
+
+			// writes and datagrams go through this instead when a simulated network is wanted
+			std::unique_ptr<link_simulator> m_pLink;
 		};
 	}
 }
\ No newline at end of file
@@ -0,0 +1,265 @@
+#pragma once
+// net executor, runs message handlers on a pool of threads, one message per connection at a time
+#include "net_common.h"
+#include "net_message.h"
+
+namespace olc
+{
+	namespace net
+	{
+		// Each connection with messages waiting has a strand, which is on exactly one worker's
+		// deque or being run by exactly one worker, so its messages are handled in order and
+		// never two at once. Workers take strands from the front of their own deque and steal
+		// from the back of the others' when it is empty. A strand goes back on the deque after
+		// a few messages so one busy connection cannot hold a worker to itself.
+		// At most nMaxHeld messages are held between Dispatch and their handler finishing. The
+		// caller asks for Room before taking more, so the rest wait in the bounded incoming
+		// queue and a client the handlers cannot keep up with is slowed by its own socket
+		template <typename T>
+		class message_executor
+		{
+		public:
+			using handler = std::function<void(std::shared_ptr<connection<T>>, message<T>&)>;
+
+			message_executor(size_t nThreads, handler fnHandler, size_t nMaxHeld = 4096)
+				: m_fnHandler(std::move(fnHandler)), m_nMaxHeld(std::max(size_t(1), nMaxHeld))
+			{
+				nThreads = std::max(size_t(1), nThreads);
+				for (size_t i = 0; i < nThreads; i++)
+					m_vWorkers.push_back(std::make_unique<worker>());
+
+				for (size_t i = 0; i < nThreads; i++)
+					m_vWorkers[i]->thread = std::thread([this, i]() { Run(i); });
+			}
+
+			~message_executor()
+			{
+				Stop();
+			}
+
+			// takes every message from vMessages, ownership of the handling passes to the workers.
+			// Once stopped there are none, the messages are handled in order on the calling thread
+			void Dispatch(std::vector<owned_message<T>>& vMessages)
+			{
+				std::scoped_lock lockDispatch(m_muxDispatch);
+				if (m_bStop)
+				{
+					for (auto& msg : vMessages)
+						m_fnHandler(msg.remote, msg.msg);
+					vMessages.clear();
+					return;
+				}
+
+				m_nHeld.fetch_add(vMessages.size(), std::memory_order_relaxed);
+				{
+					std::scoped_lock lock(m_muxStrands);
+					for (auto& msg : vMessages)
+					{
+						std::shared_ptr<strand>& pStrand = m_mapStrands[msg.remote.get()];
+						if (!pStrand)
+						{
+							pStrand = std::make_shared<strand>();
+							pStrand->pKey = msg.remote.get();
+							m_vReady.push_back(pStrand);
+						}
+						pStrand->qMessages.push_back(std::move(msg));
+					}
+				}
+				vMessages.clear();
+
+				// new strands are spread round the workers, stealing evens out the rest
+				for (auto& pStrand : m_vReady)
+					Schedule(m_nNextWorker++ % m_vWorkers.size(), std::move(pStrand));
+				m_vReady.clear();
+			}
+
+			// any thread - how many more messages may be dispatched now, unbounded once stopped
+			size_t Room() const
+			{
+				size_t nHeld = m_nHeld.load(std::memory_order_relaxed);
+				return m_bStopped.load(std::memory_order_relaxed) ? SIZE_MAX : (nHeld < m_nMaxHeld ? m_nMaxHeld - nHeld : 0);
+			}
+
+			// sleeps until there is Room, or until tDeadline if sooner. False if there is none yet
+			bool WaitForRoom(std::chrono::steady_clock::time_point tDeadline = std::chrono::steady_clock::time_point::max())
+			{
+				std::unique_lock<std::mutex> lock(m_muxIdle);
+				auto fnRoom = [this]() { return Room() > 0; };
+				if (tDeadline == std::chrono::steady_clock::time_point::max())
+				{
+					m_cvRoom.wait(lock, fnRoom);
+					return true;
+				}
+				return m_cvRoom.wait_until(lock, tDeadline, fnRoom);
+			}
+
+			// runs whatever has been dispatched to completion, then joins the workers. A Dispatch
+			// on another thread either finishes first or waits for this and runs its messages itself
+			void Stop()
+			{
+				std::scoped_lock lockDispatch(m_muxDispatch);
+				{
+					std::scoped_lock lock(m_muxIdle);
+					if (m_bStop)
+						return;
+					m_bStop = true;
+					m_bStopped.store(true, std::memory_order_relaxed);
+				}
+				m_cvIdle.notify_all();
+				m_cvRoom.notify_all();
+
+				for (auto& pWorker : m_vWorkers)
+					if (pWorker->thread.joinable())
+						pWorker->thread.join();
+			}
+
+		private:
+			// messages handled before a strand lets others have the worker
+			static constexpr size_t nStrandBudget = 16;
+
+			struct strand
+			{
+				connection<T>* pKey = nullptr;
+				std::deque<owned_message<T>> qMessages;
+			};
+
+			struct worker
+			{
+				std::mutex mux;
+				std::deque<std::shared_ptr<strand>> qStrands;
+				std::vector<owned_message<T>> vBatch;
+				std::thread thread;
+			};
+
+			void Schedule(size_t nWorker, std::shared_ptr<strand> pStrand)
+			{
+				// counted under the deque's lock, as Take uncounts it, so a thief can never take it
+				// before it is counted. And before the notify, so a worker about to sleep sees it
+				{
+					std::scoped_lock lock(m_vWorkers[nWorker]->mux);
+					m_nQueued.fetch_add(1, std::memory_order_release);
+					m_vWorkers[nWorker]->qStrands.push_back(std::move(pStrand));
+				}
+
+				{
+					std::scoped_lock lock(m_muxIdle);
+				}
+				m_cvIdle.notify_one();
+			}
+
+			// own deque from the front, everyone else's from the back
+			std::shared_ptr<strand> Take(size_t nWorker)
+			{
+				for (size_t i = 0; i < m_vWorkers.size(); i++)
+				{
+					worker& w = *m_vWorkers[(nWorker + i) % m_vWorkers.size()];
+					std::scoped_lock lock(w.mux);
+					if (w.qStrands.empty())
+						continue;
+
+					std::shared_ptr<strand> pStrand;
+					if (i == 0)
+					{
+						pStrand = std::move(w.qStrands.front());
+						w.qStrands.pop_front();
+					}
+					else
+					{
+						pStrand = std::move(w.qStrands.back());
+						w.qStrands.pop_back();
+					}
+					m_nQueued.fetch_sub(1, std::memory_order_relaxed);
+					return pStrand;
+				}
+				return nullptr;
+			}
+
+			void Run(size_t nWorker)
+			{
+				while (true)
+				{
+					std::shared_ptr<strand> pStrand = Take(nWorker);
+					if (pStrand)
+					{
+						RunStrand(nWorker, std::move(pStrand));
+						continue;
+					}
+
+					std::unique_lock<std::mutex> lock(m_muxIdle);
+					m_cvIdle.wait(lock, [this]() { return m_bStop || m_nQueued.load(std::memory_order_acquire) > 0; });
+					if (m_bStop && m_nQueued.load(std::memory_order_acquire) == 0)
+						return;
+				}
+			}
+
+			void RunStrand(size_t nWorker, std::shared_ptr<strand> pStrand)
+			{
+				std::vector<owned_message<T>>& vBatch = m_vWorkers[nWorker]->vBatch;
+				{
+					std::scoped_lock lock(m_muxStrands);
+					size_t nTake = std::min(nStrandBudget, pStrand->qMessages.size());
+					for (size_t i = 0; i < nTake; i++)
+					{
+						vBatch.push_back(std::move(pStrand->qMessages.front()));
+						pStrand->qMessages.pop_front();
+					}
+				}
+
+				for (auto& msg : vBatch)
+					m_fnHandler(msg.remote, msg.msg);
+				Release(vBatch.size());
+				vBatch.clear();
+
+				// a strand with nothing left is forgotten, the next message starts a new one
+				{
+					std::scoped_lock lock(m_muxStrands);
+					if (pStrand->qMessages.empty())
+					{
+						m_mapStrands.erase(pStrand->pKey);
+						return;
+					}
+				}
+				Schedule(nWorker, std::move(pStrand));
+			}
+
+			// wakes a WaitForRoom only when these handled messages make room where there was none
+			void Release(size_t nHandled)
+			{
+				size_t nHeld = m_nHeld.fetch_sub(nHandled, std::memory_order_relaxed);
+				if (nHeld >= m_nMaxHeld && nHeld - nHandled < m_nMaxHeld)
+				{
+					{
+						std::scoped_lock lock(m_muxIdle);
+					}
+					m_cvRoom.notify_all();
+				}
+			}
+
+		private:
+			handler m_fnHandler;
+			std::vector<std::unique_ptr<worker>> m_vWorkers;
+
+			// strands by connection, present while the strand is queued or running. Held only to
+			// move messages in and out, never while a handler runs
+			std::mutex m_muxStrands;
+			std::unordered_map<connection<T>*, std::shared_ptr<strand>> m_mapStrands;
+			std::vector<std::shared_ptr<strand>> m_vReady;
+			std::atomic<size_t> m_nNextWorker{ 0 };
+
+			// strands waiting on a deque, workers sleep while there are none
+			std::atomic<size_t> m_nQueued{ 0 };
+			std::mutex m_muxIdle;
+			std::condition_variable m_cvIdle;
+
+			// messages dispatched and not yet handled, the caller sleeps while the limit is reached
+			const size_t m_nMaxHeld;
+			std::atomic<size_t> m_nHeld{ 0 };
+			std::condition_variable m_cvRoom;
+
+			// set under both locks, so Dispatch and the workers each read it under their own
+			std::mutex m_muxDispatch;
+			bool m_bStop = false;
+			std::atomic<bool> m_bStopped{ false }; // the same, for Room on any thread
+		};
+	}
+}
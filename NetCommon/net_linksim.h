@@ -0,0 +1,268 @@
+#pragma once
+// net link simulator, latency, jitter, a bandwidth cap, loss and reordering between a connection and its sockets
+#include "net_common.h"
+#include "net_udp.h"
+
+namespace olc
+{
+	namespace net
+	{
+		// What the link does to everything one end sends, so give both ends conditions for a
+		// two way link. Applies to messages and datagrams, not the handshake
+		struct link_conditions
+		{
+			std::chrono::microseconds tLatency{ 0 };			// one way, added to everything sent
+			std::chrono::microseconds tJitter{ 0 };				// up to this much more, picked uniformly
+			uint64_t nBytesPerSecond = 0;						// 0 leaves the link uncapped
+			double dLoss = 0.0;									// fraction of datagrams lost, a stream write pays a retransmit instead
+			double dReorder = 0.0;								// fraction of datagrams held back so later ones overtake them
+			double dDuplicate = 0.0;							// fraction of datagrams that arrive twice
+			std::chrono::microseconds tRetransmit{ 200000 };	// what losing part of the stream costs, around tcp's minimum rto
+			size_t nQueueBytes = 256 * 1024;					// bottleneck buffer, datagrams that would wait behind more are dropped
+		};
+
+		// A connection hands its writes and datagrams to this rather than the sockets. Each is
+		// serialised onto the capped link, delayed, and only then written for real. A stream
+		// write completes as soon as its last byte has left the link, so a slow link holds the
+		// sender back and its queue, batching and backpressure behave as they would for real.
+		// The stream always arrives in order, a loss stalls everything behind it. Anything
+		// still on the link when the socket closes is lost, see Close.
+		class link_simulator
+		{
+		public:
+			using clock = std::chrono::steady_clock;
+
+			// pOwner keeps the connection alive while a timer handler runs, a client passes none
+			link_simulator(asio::ip::tcp::socket& socket, const link_conditions& conditions, std::weak_ptr<const void> pOwner)
+				: m_socket(socket), m_conditions(conditions), m_timer(socket.get_executor()), m_pOwner(std::move(pOwner))
+			{
+				m_bOwned = !m_pOwner.expired();
+			}
+
+			// io thread - takes a copy of the gather list, handler is called once it has been sent
+			void Write(const std::vector<asio::const_buffer>& vBuffers, std::function<void(std::error_code, std::size_t)> handler)
+			{
+				if (m_bClosed)
+				{
+					Abort(std::move(handler));
+					return;
+				}
+
+				size_t nBytes = asio::buffer_size(vBuffers);
+				std::vector<uint8_t> vData(nBytes);
+				asio::buffer_copy(asio::buffer(vData), vBuffers);
+
+				auto tSent = Serialise(clock::now(), nBytes);
+				auto tArrive = tSent + Delay();
+				if (Chance(m_conditions.dLoss))
+					tArrive += m_conditions.tRetransmit;
+
+				tArrive = std::max(tArrive, m_tStreamLast);
+				m_tStreamLast = tArrive;
+
+				// sends leave the link in the order they were made, so completions are taken from the front
+				m_qWrites.push_back({ std::move(handler), nBytes });
+				Schedule(tSent,
+					[this]()
+					{
+						pending_write write = std::move(m_qWrites.front());
+						m_qWrites.pop_front();
+						write.handler(std::error_code(), write.nBytes);
+					});
+				Schedule(tArrive,
+					[this, vData = std::move(vData)]() mutable
+					{
+						m_qStream.push_back(std::move(vData));
+						if (m_qStream.size() == 1)
+							WriteStream();
+					});
+			}
+
+			// io thread - a datagram is either lost on the way or sent once it has crossed the link.
+			// A duplicate takes its own way across, so it may overtake the original
+			void SendTo(std::shared_ptr<udp_socket> pSocket, const uint8_t* pData, size_t nBytes, const asio::ip::udp::endpoint& remote)
+			{
+				auto tNow = clock::now();
+				if (m_bClosed || Chance(m_conditions.dLoss) || Backlog(tNow) + nBytes > m_conditions.nQueueBytes)
+					return;
+
+				auto pDatagram = std::make_shared<std::vector<uint8_t>>(pData, pData + nBytes);
+				size_t nCopies = Chance(m_conditions.dDuplicate) ? 2 : 1;
+				for (size_t i = 0; i < nCopies; i++)
+				{
+					auto tArrive = Serialise(tNow, nBytes) + Delay();
+					if (Chance(m_conditions.dReorder))
+						tArrive += m_conditions.tLatency + std::chrono::milliseconds(1);
+
+					Schedule(tArrive,
+						[pSocket, pDatagram, remote]()
+						{
+							pSocket->SendTo(pDatagram->data(), pDatagram->size(), remote);
+						});
+				}
+			}
+
+			// io thread - once the socket has closed. What is on the link is dropped and writes
+			// not yet completed fail with operation_aborted, as they would on the socket itself
+			void Close()
+			{
+				if (m_bClosed)
+					return;
+
+				m_bClosed = true;
+				m_timer.cancel();
+				m_qEvents = {};
+
+				// the front chunk may be in the middle of its real write, it goes once that is aborted
+				if (m_qStream.size() > 1)
+					m_qStream.erase(m_qStream.begin() + 1, m_qStream.end());
+
+				std::deque<pending_write> qWrites;
+				qWrites.swap(m_qWrites);
+				for (auto& write : qWrites)
+					Abort(std::move(write.handler));
+			}
+
+		private:
+			struct pending_write
+			{
+				std::function<void(std::error_code, std::size_t)> handler;
+				size_t nBytes;
+			};
+
+			// handlers are never called from inside Write or Close, as asio would not either
+			void Abort(std::function<void(std::error_code, std::size_t)> handler)
+			{
+				asio::post(m_timer.get_executor(),
+					[handler = std::move(handler), pin = m_pOwner.lock()]()
+					{
+						handler(asio::error::operation_aborted, 0);
+					});
+			}
+
+			struct link_event
+			{
+				clock::time_point tDue;
+				uint64_t nOrder;
+				std::function<void()> fn;
+
+				// earliest first, and in the order scheduled when due together
+				bool operator > (const link_event& other) const
+				{
+					return tDue != other.tDue ? tDue > other.tDue : nOrder > other.nOrder;
+				}
+			};
+
+			// when the last of nBytes leaves the link, queued behind whatever is already on it
+			clock::time_point Serialise(clock::time_point tNow, size_t nBytes)
+			{
+				m_tLinkFree = std::max(m_tLinkFree, tNow);
+				if (m_conditions.nBytesPerSecond > 0)
+					m_tLinkFree += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(double(nBytes) / double(m_conditions.nBytesPerSecond)));
+				return m_tLinkFree;
+			}
+
+			// bytes still waiting to get onto the link
+			size_t Backlog(clock::time_point tNow) const
+			{
+				if (m_conditions.nBytesPerSecond == 0 || m_tLinkFree <= tNow)
+					return 0;
+				return size_t(std::chrono::duration<double>(m_tLinkFree - tNow).count() * double(m_conditions.nBytesPerSecond));
+			}
+
+			clock::duration Delay()
+			{
+				clock::duration tDelay = m_conditions.tLatency;
+				if (m_conditions.tJitter.count() > 0)
+					tDelay += std::chrono::microseconds(std::uniform_int_distribution<int64_t>(0, m_conditions.tJitter.count())(m_rng));
+				return tDelay;
+			}
+
+			bool Chance(double dFraction)
+			{
+				return dFraction > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(m_rng) < dFraction;
+			}
+
+			void Schedule(clock::time_point tDue, std::function<void()> fn)
+			{
+				bool bEarliest = m_qEvents.empty() || tDue < m_qEvents.top().tDue;
+				m_qEvents.push({ tDue, m_nOrder++, std::move(fn) });
+				if (bEarliest)
+					Arm();
+			}
+
+			// async - one timer for the earliest event, everything due is run when it fires
+			void Arm()
+			{
+				m_timer.expires_at(m_qEvents.top().tDue);
+				m_timer.async_wait(
+					[this, pOwner = m_pOwner, bOwned = m_bOwned](std::error_code ec)
+					{
+						if (ec)
+							return;
+
+						auto pin = pOwner.lock();
+						if (bOwned && !pin)
+							return;
+
+						auto tNow = clock::now();
+						while (!m_qEvents.empty() && m_qEvents.top().tDue <= tNow)
+						{
+							auto fn = std::move(const_cast<link_event&>(m_qEvents.top()).fn);
+							m_qEvents.pop();
+							fn();
+						}
+
+						if (!m_qEvents.empty())
+							Arm();
+					});
+			}
+
+			// async - the stream's arrived chunks are written for real, one at a time and in order
+			void WriteStream()
+			{
+				asio::async_write(m_socket, asio::buffer(m_qStream.front()),
+					[this, pOwner = m_pOwner, bOwned = m_bOwned](std::error_code ec, std::size_t /*length*/)
+					{
+						auto pin = pOwner.lock();
+						if (ec == asio::error::operation_aborted || (bOwned && !pin))
+							return;
+
+						if (ec)
+						{
+							m_socket.close();
+							Close();
+							return;
+						}
+
+						m_qStream.pop_front();
+						if (!m_qStream.empty())
+							WriteStream();
+					});
+			}
+
+		private:
+			asio::ip::tcp::socket& m_socket;
+			link_conditions m_conditions;
+
+			asio::steady_timer m_timer;
+			std::priority_queue<link_event, std::vector<link_event>, std::greater<link_event>> m_qEvents;
+			uint64_t m_nOrder = 0;
+
+			// when the link is next idle, and when the stream's latest chunk arrives
+			clock::time_point m_tLinkFree;
+			clock::time_point m_tStreamLast;
+
+			// chunks that have crossed the link, the front one is being written
+			std::deque<std::vector<uint8_t>> m_qStream;
+
+			// stream writes still on their way onto the link, oldest first
+			std::deque<pending_write> m_qWrites;
+			bool m_bClosed = false;
+
+			std::weak_ptr<const void> m_pOwner;
+			bool m_bOwned = false;
+			std::minstd_rand m_rng{ std::random_device{}() };
+		};
+	}
+}
@@ -0,0 +1,523 @@
+#pragma once
+// net log, leveled logging that is formatted and written on a background thread
+#include "net_common.h"
+
+// lowest level compiled in: 0 trace, 1 debug, 2 info, 3 warn, 4 error, 5 nothing at all
+#ifndef OLC_NET_LOG_LEVEL
+#define OLC_NET_LOG_LEVEL 2
+#endif
+
+// OLC_NET_LOG(warn, "[{}] Write Fail", id) - the format must be a string literal and each {}
+// takes the next argument. Below OLC_NET_LOG_LEVEL the arguments are not even evaluated
+#define OLC_NET_LOG(level, ...) \
+	do { if constexpr (int(olc::net::log_level::level) >= OLC_NET_LOG_LEVEL) olc::net::logger::write(olc::net::log_level::level, __VA_ARGS__); } while (0)
+
+namespace olc
+{
+	namespace net
+	{
+		enum class log_level : uint8_t
+		{
+			trace,
+			debug,
+			info,
+			warn,
+			error
+		};
+
+		// Records are kept in binary until the writer gets to them: a header with the time, the
+		// level and the format's address, then each argument as a type tag and its raw value.
+		// Nothing is formatted or allocated on the logging thread
+		enum class log_arg_type : uint8_t
+		{
+			integer,
+			unsigned_integer,
+			real,
+			text,
+			endpoint,
+			error
+		};
+
+		struct log_record_header
+		{
+			int64_t nTime;			// system clock, nanoseconds since the epoch
+			const char* sFormat;	// a string literal, so it is still there when the writer is
+			log_level level;
+		};
+
+		template <typename A>
+		struct is_log_endpoint : std::false_type {};
+
+		template <typename Protocol>
+		struct is_log_endpoint<asio::ip::basic_endpoint<Protocol>> : std::true_type {};
+
+		template <typename A>
+		static constexpr bool dependent_false = false;
+
+		// an endpoint goes as an ipv6 flag, 16 address bytes and the port
+		static constexpr size_t nLogEndpointBytes = 1 + 16 + sizeof(uint16_t);
+
+		template <typename A>
+		size_t log_arg_size(const A& arg)
+		{
+			if constexpr (std::is_arithmetic_v<A>)
+				return 1 + sizeof(uint64_t);
+			else if constexpr (std::is_convertible_v<const A&, std::string_view>)
+				return 1 + sizeof(uint32_t) + std::string_view(arg).size();
+			else if constexpr (is_log_endpoint<A>::value)
+				return 1 + nLogEndpointBytes;
+			else if constexpr (std::is_same_v<A, std::error_code>)
+				return 1 + sizeof(int) + sizeof(const std::error_category*);
+			else
+				static_assert(dependent_false<A>, "type cannot be logged");
+		}
+
+		template <typename A>
+		void log_arg_write(uint8_t*& p, const A& arg)
+		{
+			auto put = [&p](const void* pData, size_t nBytes)
+			{
+				if (nBytes > 0)
+					std::memcpy(p, pData, nBytes);
+				p += nBytes;
+			};
+
+			if constexpr (std::is_floating_point_v<A>)
+			{
+				*p++ = uint8_t(log_arg_type::real);
+				double d = double(arg);
+				put(&d, sizeof(d));
+			}
+			else if constexpr (std::is_integral_v<A> && std::is_signed_v<A>)
+			{
+				*p++ = uint8_t(log_arg_type::integer);
+				int64_t n = int64_t(arg);
+				put(&n, sizeof(n));
+			}
+			else if constexpr (std::is_arithmetic_v<A>)
+			{
+				*p++ = uint8_t(log_arg_type::unsigned_integer);
+				uint64_t n = uint64_t(arg);
+				put(&n, sizeof(n));
+			}
+			else if constexpr (std::is_convertible_v<const A&, std::string_view>)
+			{
+				*p++ = uint8_t(log_arg_type::text);
+				std::string_view s(arg);
+				uint32_t nLength = uint32_t(s.size());
+				put(&nLength, sizeof(nLength));
+				put(s.data(), s.size());
+			}
+			else if constexpr (is_log_endpoint<A>::value)
+			{
+				*p++ = uint8_t(log_arg_type::endpoint);
+				std::array<uint8_t, 16> vAddress = {};
+				uint8_t bV6 = arg.address().is_v6();
+				if (bV6)
+				{
+					auto v6 = arg.address().to_v6().to_bytes();
+					std::memcpy(vAddress.data(), v6.data(), v6.size());
+				}
+				else
+				{
+					auto v4 = arg.address().to_v4().to_bytes();
+					std::memcpy(vAddress.data(), v4.data(), v4.size());
+				}
+				uint16_t nPort = arg.port();
+				put(&bV6, 1);
+				put(vAddress.data(), vAddress.size());
+				put(&nPort, sizeof(nPort));
+			}
+			else if constexpr (std::is_same_v<A, std::error_code>)
+			{
+				*p++ = uint8_t(log_arg_type::error);
+				int nValue = arg.value();
+				const std::error_category* pCategory = &arg.category();
+				put(&nValue, sizeof(nValue));
+				put(&pCategory, sizeof(pCategory));
+			}
+		}
+
+		// Single producer single consumer byte ring, one per logging thread. Each record is its
+		// size then its bytes, padded to 8. A size of 0 means the rest of the ring was skipped
+		class log_ring
+		{
+		public:
+			static constexpr size_t nCapacity = 64 * 1024;
+
+			// logging thread - nullptr if the record does not fit, the writer has fallen behind
+			uint8_t* Reserve(size_t nBytes)
+			{
+				size_t nTotal = Padded(nBytes);
+				size_t nHead = m_nHead.load(std::memory_order_relaxed);
+				size_t nFree = nCapacity - (nHead - m_nTail.load(std::memory_order_acquire));
+				size_t nAt = nHead % nCapacity;
+
+				// a record is never split, the end of the ring is skipped instead
+				size_t nSkip = nAt + nTotal > nCapacity ? nCapacity - nAt : 0;
+				if (nSkip + nTotal > nFree)
+					return nullptr;
+
+				if (nSkip > 0)
+				{
+					uint32_t nZero = 0;
+					std::memcpy(m_vData.get() + nAt, &nZero, sizeof(nZero));
+					m_nHead.store(nHead + nSkip, std::memory_order_release);
+					nAt = 0;
+				}
+
+				uint32_t nSize = uint32_t(nBytes);
+				std::memcpy(m_vData.get() + nAt, &nSize, sizeof(nSize));
+				return m_vData.get() + nAt + sizeof(uint64_t);
+			}
+
+			// logging thread - publishes the record last reserved
+			void Commit(size_t nBytes)
+			{
+				m_nHead.store(m_nHead.load(std::memory_order_relaxed) + Padded(nBytes), std::memory_order_release);
+			}
+
+			// writer thread - hands every published record to fn, oldest first
+			template <typename Fn>
+			void Drain(Fn&& fn)
+			{
+				size_t nTail = m_nTail.load(std::memory_order_relaxed);
+				size_t nHead = m_nHead.load(std::memory_order_acquire);
+				while (nTail != nHead)
+				{
+					size_t nAt = nTail % nCapacity;
+					uint32_t nSize;
+					std::memcpy(&nSize, m_vData.get() + nAt, sizeof(nSize));
+
+					if (nSize == 0)
+					{
+						nTail += nCapacity - nAt;
+						continue;
+					}
+
+					fn(m_vData.get() + nAt + sizeof(uint64_t), size_t(nSize));
+					nTail += Padded(nSize);
+				}
+				m_nTail.store(nTail, std::memory_order_release);
+			}
+
+			bool Empty() const
+			{
+				return m_nTail.load(std::memory_order_acquire) == m_nHead.load(std::memory_order_acquire);
+			}
+
+			std::atomic<uint64_t> nDropped{ 0 };
+			std::atomic<bool> bRetired{ false };
+
+		private:
+			// the size word is padded out to 8 so every record starts aligned
+			static size_t Padded(size_t nBytes)
+			{
+				return (sizeof(uint64_t) + nBytes + 7) & ~size_t(7);
+			}
+
+			std::unique_ptr<uint8_t[]> m_vData = std::make_unique<uint8_t[]>(nCapacity);
+
+			// producer and consumer positions on lines of their own, they never wrap
+			alignas(64) std::atomic<size_t> m_nHead{ 0 };
+			alignas(64) std::atomic<size_t> m_nTail{ 0 };
+		};
+
+		// Logging never waits on the output: a record that does not fit its thread's ring is
+		// dropped and counted, and the writer says how many went missing
+		class logger
+		{
+		public:
+			template <size_t N, typename... Args>
+			static void write(log_level level, const char (&sFormat)[N], const Args&... args)
+			{
+				if (level < registry().level.load(std::memory_order_relaxed))
+					return;
+
+				log_ring* pRing = local();
+				if (pRing == nullptr)
+					return;
+
+				size_t nBytes = sizeof(log_record_header) + (size_t(0) + ... + log_arg_size(args));
+				uint8_t* p = pRing->Reserve(nBytes);
+				if (p == nullptr)
+				{
+					pRing->nDropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+
+				log_record_header header;
+				header.nTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+				header.sFormat = sFormat;
+				header.level = level;
+				std::memcpy(p, &header, sizeof(header));
+				p += sizeof(header);
+
+				(log_arg_write(p, args), ...);
+				pRing->Commit(nBytes);
+			}
+
+			// levels below this are dropped at runtime as well, on top of OLC_NET_LOG_LEVEL
+			static void SetLevel(log_level level)
+			{
+				registry().level.store(level, std::memory_order_relaxed);
+			}
+
+			// where the writer puts lines, std::cerr until told otherwise so a program's own output
+			// on stdout stays clean. The stream must outlive the logger or be replaced before it goes
+			static void SetOutput(std::ostream& os)
+			{
+				std::scoped_lock lock(registry().muxOutput);
+				registry().pOutput = &os;
+			}
+
+			// waits until everything logged before the call has been written
+			static void Flush()
+			{
+				writer().Flush();
+			}
+
+		private:
+			// rings outlive their threads until the writer has emptied them
+			struct log_registry
+			{
+				std::mutex mux;
+				std::vector<std::shared_ptr<log_ring>> vRings;
+				std::atomic<log_level> level{ log_level::trace };
+
+				std::mutex muxOutput;
+				std::ostream* pOutput = &std::cerr;
+			};
+
+			struct holder
+			{
+				std::shared_ptr<log_ring> pRing = std::make_shared<log_ring>();
+				log_ring*& pLocal;
+
+				holder(log_ring*& pThreadRing) : pLocal(pThreadRing)
+				{
+					writer();
+					std::scoped_lock lock(registry().mux);
+					registry().vRings.push_back(pRing);
+					pLocal = pRing.get();
+				}
+
+				~holder()
+				{
+					pLocal = nullptr;
+					pRing->bRetired.store(true, std::memory_order_release);
+				}
+			};
+
+			// Wakes every few milliseconds, takes what every ring holds, puts it in time order and
+			// writes it out. Joined at exit once the rings are empty
+			class log_writer
+			{
+			public:
+				log_writer()
+				{
+					m_thread = std::thread([this]() { Run(); });
+				}
+
+				~log_writer()
+				{
+					{
+						std::scoped_lock lock(m_mux);
+						m_bStop = true;
+					}
+					m_cv.notify_all();
+					m_thread.join();
+				}
+
+				void Flush()
+				{
+					std::unique_lock<std::mutex> lock(m_mux);
+					uint64_t nTarget = m_nPasses + 2;
+					m_bFlush = true;
+					m_cv.notify_all();
+					m_cvDone.wait(lock, [&]() { return m_nPasses >= nTarget || m_bStop; });
+				}
+
+			private:
+				void Run()
+				{
+					std::unique_lock<std::mutex> lock(m_mux);
+					while (true)
+					{
+						m_cv.wait_for(lock, std::chrono::milliseconds(5), [this]() { return m_bStop || m_bFlush; });
+						bool bStop = m_bStop;
+						m_bFlush = false;
+
+						lock.unlock();
+						Pass();
+						lock.lock();
+
+						m_nPasses++;
+						m_cvDone.notify_all();
+						if (bStop)
+							return;
+					}
+				}
+
+				void Pass()
+				{
+					std::vector<std::shared_ptr<log_ring>> vRings;
+					{
+						std::scoped_lock lock(registry().mux);
+						vRings = registry().vRings;
+					}
+
+					m_vLines.clear();
+					uint64_t nDropped = 0;
+					for (auto& pRing : vRings)
+					{
+						pRing->Drain([this](const uint8_t* p, size_t nBytes) { Format(p, nBytes); });
+						nDropped += pRing->nDropped.load(std::memory_order_relaxed);
+					}
+
+					std::stable_sort(m_vLines.begin(), m_vLines.end(),
+						[](const auto& a, const auto& b) { return a.first < b.first; });
+
+					{
+						std::scoped_lock lock(registry().muxOutput);
+						std::ostream& os = *registry().pOutput;
+						for (auto& line : m_vLines)
+							os << line.second << '\n';
+						if (nDropped > m_nDroppedReported)
+							os << "[LOG] " << (nDropped - m_nDroppedReported) << " records dropped\n";
+						if (!m_vLines.empty() || nDropped > m_nDroppedReported)
+							os.flush();
+					}
+					m_nDroppedReported = nDropped;
+
+					// a ring whose thread has gone is forgotten once it is empty
+					std::scoped_lock lock(registry().mux);
+					auto& vAll = registry().vRings;
+					vAll.erase(std::remove_if(vAll.begin(), vAll.end(),
+						[](const std::shared_ptr<log_ring>& pRing) { return pRing->bRetired.load(std::memory_order_acquire) && pRing->Empty(); }),
+						vAll.end());
+				}
+
+				void Format(const uint8_t* p, size_t nBytes)
+				{
+					const uint8_t* pEnd = p + nBytes;
+					log_record_header header;
+					std::memcpy(&header, p, sizeof(header));
+					p += sizeof(header);
+
+					std::ostringstream os;
+					std::time_t tSeconds = std::time_t(header.nTime / 1000000000);
+					std::tm tm = *std::gmtime(&tSeconds);
+					char sTime[32];
+					std::snprintf(sTime, sizeof(sTime), "%02d:%02d:%02d.%06d", tm.tm_hour, tm.tm_min, tm.tm_sec, int(header.nTime % 1000000000 / 1000));
+
+					static const char* vLevels[] = { "TRACE", "DEBUG", "INFO ", "WARN ", "ERROR" };
+					os << sTime << ' ' << vLevels[size_t(header.level)] << ' ';
+
+					for (const char* s = header.sFormat; *s; s++)
+					{
+						if (s[0] == '{' && s[1] == '}' && p < pEnd)
+						{
+							p = FormatArg(os, p);
+							s++;
+						}
+						else
+						{
+							os << *s;
+						}
+					}
+
+					m_vLines.emplace_back(header.nTime, os.str());
+				}
+
+				static const uint8_t* FormatArg(std::ostream& os, const uint8_t* p)
+				{
+					auto get = [&p](void* pData, size_t nBytes)
+					{
+						if (nBytes > 0)
+							std::memcpy(pData, p, nBytes);
+						p += nBytes;
+					};
+
+					switch (log_arg_type(*p++))
+					{
+					case log_arg_type::integer: { int64_t n; get(&n, sizeof(n)); os << n; break; }
+					case log_arg_type::unsigned_integer: { uint64_t n; get(&n, sizeof(n)); os << n; break; }
+					case log_arg_type::real: { double d; get(&d, sizeof(d)); os << d; break; }
+					case log_arg_type::text:
+					{
+						uint32_t nLength;
+						get(&nLength, sizeof(nLength));
+						os.write(reinterpret_cast<const char*>(p), nLength);
+						p += nLength;
+						break;
+					}
+					case log_arg_type::endpoint:
+					{
+						uint8_t bV6;
+						std::array<uint8_t, 16> vAddress;
+						uint16_t nPort;
+						get(&bV6, 1);
+						get(vAddress.data(), vAddress.size());
+						get(&nPort, sizeof(nPort));
+						if (bV6)
+							os << '[' << asio::ip::address_v6(vAddress).to_string() << "]:" << nPort;
+						else
+							os << asio::ip::address_v4({ vAddress[0], vAddress[1], vAddress[2], vAddress[3] }).to_string() << ':' << nPort;
+						break;
+					}
+					case log_arg_type::error:
+					{
+						int nValue;
+						const std::error_category* pCategory;
+						get(&nValue, sizeof(nValue));
+						get(&pCategory, sizeof(pCategory));
+						os << pCategory->message(nValue);
+						break;
+					}
+					}
+					return p;
+				}
+
+			private:
+				std::thread m_thread;
+				std::mutex m_mux;
+				std::condition_variable m_cv;
+				std::condition_variable m_cvDone;
+				bool m_bStop = false;
+				bool m_bFlush = false;
+				uint64_t m_nPasses = 0;
+				uint64_t m_nDroppedReported = 0;
+				std::vector<std::pair<int64_t, std::string>> m_vLines;
+			};
+
+			// the calling thread's ring, nullptr once the thread has started shutting down
+			static log_ring* local()
+			{
+				static thread_local log_ring* pRing = nullptr;
+				static thread_local bool bAttached = false;
+
+				if (!bAttached)
+				{
+					bAttached = true;
+					static thread_local holder h(pRing);
+				}
+				return pRing;
+			}
+
+			// deliberately never destroyed, threads may still log while statics are torn down
+			static log_registry& registry()
+			{
+				static log_registry* r = new log_registry();
+				return *r;
+			}
+
+			// started by the first thread to log and joined at exit, after a last pass
+			static log_writer& writer()
+			{
+				static log_writer w;
+				return w;
+			}
+		};
+	}
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "net_common.h"
+#include "net_pool.h"
 
 namespace olc
 {
@@ -11,13 +12,28 @@ namespace olc
 		{
 			T id{};
 			uint32_t size = 0;
+
+			// 0 unless the message is a request or a reply. A request is numbered below
+			// nSequenceReplyBit, its reply carries the number back with that bit set, see reply_to
+			uint32_t sequence = 0;
 		};
 
+		// only ever set by reply_to, so a request that is copied or relayed is never taken for
+		// the reply to one, see client_interface::request
+		static constexpr uint32_t nSequenceReplyBit = 0x80000000u;
+
+		// on the wire only, the top bit of size marks a compressed body. It is cleared again as
+		// the body is expanded, so a message as seen by the application never has it set
+		static constexpr uint32_t nHeaderCompressedBit = 0x80000000u;
+
+		// the largest body a connection accepts unless told otherwise, see connection::SetMaxBodySize
+		static constexpr uint32_t nDefaultMaxBodyBytes = 16 * 1024 * 1024;
+
 		template <typename T>
 		struct message
 		{
 			message_header<T> header{};
-			std::vector<uint8_t> body; // always working with bytes
+			std::vector<uint8_t, pool_allocator<uint8_t>> body; // always working with bytes, drawn from the thread's buffer pool
 
 			size_t size() const
 			{
@@ -74,8 +90,198 @@ namespace olc
 				// allows chaining
 				return msg;
 			}
+
+			// pushes a whole vector of trivially copyable elements with a single copy, then its
+			// count so the matching >> knows how much to take back
+			template <typename ElementType, typename Allocator>
+			friend message<T>& operator << (message<T>& msg, const std::vector<ElementType, Allocator>& data)
+			{
+				static_assert(std::is_trivially_copyable<ElementType>::value, "Elements are too complex to be pushed into vector");
+
+				size_t i = msg.body.size();
+				size_t nBytes = data.size() * sizeof(ElementType);
+				msg.body.resize(i + nBytes);
+				if (nBytes > 0)
+					std::memcpy(msg.body.data() + i, data.data(), nBytes);
+
+				return msg << uint32_t(data.size());
+			}
+
+			// leaves data empty and the body untouched past the count if the count does not fit
+			template <typename ElementType, typename Allocator>
+			friend message<T>& operator >> (message<T>& msg, std::vector<ElementType, Allocator>& data)
+			{
+				static_assert(std::is_trivially_copyable<ElementType>::value, "Elements are too complex to be pulled from vector");
+
+				uint32_t nCount = 0;
+				if (msg.body.size() < sizeof(nCount))
+				{
+					data.clear();
+					return msg;
+				}
+				msg >> nCount;
+
+				size_t nBytes = size_t(nCount) * sizeof(ElementType);
+				if (nBytes > msg.body.size())
+				{
+					data.clear();
+					return msg;
+				}
+
+				size_t i = msg.body.size() - nBytes;
+				data.resize(nCount);
+				if (nBytes > 0)
+					std::memcpy(data.data(), msg.body.data() + i, nBytes);
+
+				msg.body.resize(i);
+				msg.header.size = msg.size();
+				return msg;
+			}
+		};
+
+		// makes msg the reply to request, does nothing if request was not numbered
+		template <typename T>
+		void reply_to(message<T>& msg, const message<T>& request)
+		{
+			if (request.header.sequence != 0)
+				msg.header.sequence = request.header.sequence | nSequenceReplyBit;
+		}
+
+		// Appends fields to a message front to back. Unlike operator <<, which grows the body one
+		// field at a time, pack reserves room for all of its fields first, so a message built with
+		// a single call costs at most one allocation. Fields come out in the order they went in
+		// when read with message_reader
+		template <typename T>
+		class message_writer
+		{
+		public:
+			explicit message_writer(message<T>& msg, size_t nReserve = 0) : m_msg(msg)
+			{
+				reserve(nReserve);
+			}
+
+			// makes room for nBytes more without changing the body
+			void reserve(size_t nBytes)
+			{
+				m_msg.body.reserve(m_msg.body.size() + nBytes);
+			}
+
+			message_writer& write(const void* pData, size_t nBytes)
+			{
+				const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+				m_msg.body.insert(m_msg.body.end(), pBytes, pBytes + nBytes);
+				m_msg.header.size = uint32_t(m_msg.body.size());
+				return *this;
+			}
+
+			template <typename DataType>
+			message_writer& operator << (const DataType& data)
+			{
+				static_assert(std::is_trivially_copyable<DataType>::value, "Data is too complex to be pushed into vector");
+				return write(&data, sizeof(DataType));
+			}
+
+			template <typename... DataTypes>
+			message_writer& pack(const DataTypes&... data)
+			{
+				reserve((sizeof(DataTypes) + ... + 0));
+				(*this << ... << data);
+				return *this;
+			}
+
+		private:
+			message<T>& m_msg;
+		};
+
+		// Reads fields front to back from bytes it does not own, the body is never modified or
+		// reallocated. Reading past the end leaves the destination untouched and marks the reader
+		// as failed, every read after that fails as well, check with ok() once done
+		class message_reader
+		{
+		public:
+			message_reader(const uint8_t* pData, size_t nSize) : m_pData(pData), m_nSize(nSize)
+			{}
+
+			template <typename T>
+			explicit message_reader(const message<T>& msg) : m_pData(msg.body.data()), m_nSize(msg.body.size())
+			{}
+
+			bool read(void* pData, size_t nBytes)
+			{
+				if (m_bFailed || nBytes > remaining())
+				{
+					m_bFailed = true;
+					return false;
+				}
+
+				if (nBytes > 0)
+					std::memcpy(pData, m_pData + m_nCursor, nBytes);
+				m_nCursor += nBytes;
+				return true;
+			}
+
+			template <typename DataType>
+			message_reader& operator >> (DataType& data)
+			{
+				static_assert(std::is_trivially_copyable<DataType>::value, "Data is too complex to be pulled from vector");
+				read(&data, sizeof(DataType));
+				return *this;
+			}
+
+			template <typename... DataTypes>
+			bool unpack(DataTypes&... data)
+			{
+				(*this >> ... >> data);
+				return ok();
+			}
+
+			// the next nBytes in place, nullptr if there are not that many left. The cursor moves past them
+			const uint8_t* take(size_t nBytes)
+			{
+				if (m_bFailed || nBytes > remaining())
+				{
+					m_bFailed = true;
+					return nullptr;
+				}
+
+				const uint8_t* p = m_pData + m_nCursor;
+				m_nCursor += nBytes;
+				return p;
+			}
+
+			bool skip(size_t nBytes)
+			{
+				return take(nBytes) != nullptr;
+			}
+
+			bool ok() const { return !m_bFailed; }
+			size_t position() const { return m_nCursor; }
+			size_t remaining() const { return m_nSize - m_nCursor; }
+
+		private:
+			const uint8_t* m_pData = nullptr;
+			size_t m_nSize = 0;
+			size_t m_nCursor = 0;
+			bool m_bFailed = false;
 		};
 
+		// An immutable, reference counted message. Any number of connections can queue the same
+		// one, so a broadcast serializes its body once however many clients it goes to.
+		template <typename T>
+		using shared_message = std::shared_ptr<const message<T>>;
+
+		template <typename T>
+		shared_message<T> make_shared_message(message<T>&& msg)
+		{
+			return std::allocate_shared<message<T>>(pool_allocator<message<T>>(), std::move(msg));
+		}
+
+		template <typename T>
+		shared_message<T> make_shared_message(const message<T>& msg)
+		{
+			return std::allocate_shared<message<T>>(pool_allocator<message<T>>(), msg);
+		}
+
 		// An "owned" message is identical to a regular message, but it is associated with
 		// a connection. On a server, the owner would be the client that sent the message, 
 		// on a client the owner would be the server.
@@ -89,6 +295,10 @@ namespace olc
 			std::shared_ptr<connection<T>> remote = nullptr;
 			message<T> msg;
 
+			// set on an entry with no message that marks the last of remote's in this queue,
+			// see connection::SetIncomingQueue
+			bool bReleased = false;
+
 			friend std::ostream& operator << (std::ostream& os, const owned_message<T>& msg)
 			{
 				os << msg.msg;
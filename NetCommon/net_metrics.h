@@ -0,0 +1,257 @@
+#pragma once
+// net metrics, lock free counters kept by connections and the server plus snapshots of them
+#include "net_common.h"
+
+namespace olc
+{
+	namespace net
+	{
+		// adds to a counter that only one thread ever writes, a plain load and store is enough
+		// and avoids a locked instruction on the io thread's hot path
+		inline void bump(std::atomic<uint64_t>& n, uint64_t nBy = 1)
+		{
+			n.store(n.load(std::memory_order_relaxed) + nBy, std::memory_order_relaxed);
+		}
+
+		// log2 buckets of microseconds: bucket 0 is under 1us, bucket i is [2^(i-1), 2^i) us,
+		// the last bucket takes everything from ~4 seconds up
+		static constexpr size_t nLatencyBuckets = 24;
+
+		struct histogram_snapshot
+		{
+			std::array<uint64_t, nLatencyBuckets> vCounts = {};
+			uint64_t nCount = 0;
+			uint64_t nSumMicros = 0;
+
+			// upper bound of the bucket holding the given fraction of samples, in microseconds
+			double Percentile(double dFraction) const
+			{
+				uint64_t nTarget = uint64_t(dFraction * double(nCount));
+				uint64_t nSeen = 0;
+				for (size_t i = 0; i < nLatencyBuckets; i++)
+				{
+					nSeen += vCounts[i];
+					if (nSeen > nTarget)
+						return double(uint64_t(1) << i);
+				}
+				return double(uint64_t(1) << (nLatencyBuckets - 1));
+			}
+
+			histogram_snapshot& operator += (const histogram_snapshot& other)
+			{
+				for (size_t i = 0; i < nLatencyBuckets; i++)
+					vCounts[i] += other.vCounts[i];
+				nCount += other.nCount;
+				nSumMicros += other.nSumMicros;
+				return *this;
+			}
+		};
+
+		// single writer histogram, recorded on the connection's io thread
+		class latency_histogram
+		{
+		public:
+			void Record(std::chrono::nanoseconds tElapsed)
+			{
+				uint64_t nMicros = uint64_t(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(tElapsed).count()));
+
+				size_t nBucket = 0;
+				while (nBucket < nLatencyBuckets - 1 && (uint64_t(1) << nBucket) <= nMicros)
+					nBucket++;
+
+				bump(m_vCounts[nBucket]);
+				bump(m_nCount);
+				bump(m_nSumMicros, nMicros);
+			}
+
+			histogram_snapshot Snapshot() const
+			{
+				histogram_snapshot s;
+				for (size_t i = 0; i < nLatencyBuckets; i++)
+					s.vCounts[i] = m_vCounts[i].load(std::memory_order_relaxed);
+				s.nCount = m_nCount.load(std::memory_order_relaxed);
+				s.nSumMicros = m_nSumMicros.load(std::memory_order_relaxed);
+				return s;
+			}
+
+		private:
+			std::array<std::atomic<uint64_t>, nLatencyBuckets> m_vCounts = {};
+			std::atomic<uint64_t> m_nCount{ 0 };
+			std::atomic<uint64_t> m_nSumMicros{ 0 };
+		};
+
+		// plain copy of a connection's counters, safe to keep and pass around
+		struct connection_stats
+		{
+			uint32_t nID = 0;
+			uint64_t nBytesIn = 0;
+			uint64_t nBytesOut = 0;
+			uint64_t nMessagesIn = 0;
+			uint64_t nMessagesOut = 0;
+			uint64_t nWrites = 0;				// gather writes completed, messages out over this is the batching
+			uint64_t nOutQueueDepth = 0;
+			uint64_t nOutQueueBytes = 0;
+			uint64_t nRecvBufferBytes = 0;		// held for bytes read but not yet parsed, grows to fit the largest frame
+			uint64_t nMessagesDropped = 0;		// discarded by a drop_oldest or drop_newest policy
+			uint64_t nMessagesCoalesced = 0;	// replaced in the queue by a newer message of the same id
+			uint64_t nDatagramsIn = 0;
+			uint64_t nDatagramsOut = 0;
+			uint64_t nDatagramsResent = 0;		// reliable udp fragments sent again for want of an ack
+			uint64_t nIncomingStalls = 0;		// times the incoming queue was full and reading paused
+			histogram_snapshot sendLatency; // from Send() until the write carrying it completes
+
+			connection_stats& operator += (const connection_stats& other)
+			{
+				nBytesIn += other.nBytesIn;
+				nBytesOut += other.nBytesOut;
+				nMessagesIn += other.nMessagesIn;
+				nMessagesOut += other.nMessagesOut;
+				nWrites += other.nWrites;
+				nOutQueueDepth += other.nOutQueueDepth;
+				nOutQueueBytes += other.nOutQueueBytes;
+				nRecvBufferBytes += other.nRecvBufferBytes;
+				nMessagesDropped += other.nMessagesDropped;
+				nMessagesCoalesced += other.nMessagesCoalesced;
+				nDatagramsIn += other.nDatagramsIn;
+				nDatagramsOut += other.nDatagramsOut;
+				nDatagramsResent += other.nDatagramsResent;
+				nIncomingStalls += other.nIncomingStalls;
+				sendLatency += other.sendLatency;
+				return *this;
+			}
+		};
+
+		// live counters of a connection, written by its io thread and readable from anywhere
+		struct connection_metrics
+		{
+			std::atomic<uint64_t> nBytesIn{ 0 };
+			std::atomic<uint64_t> nBytesOut{ 0 };
+			std::atomic<uint64_t> nMessagesIn{ 0 };
+			std::atomic<uint64_t> nMessagesOut{ 0 };
+			std::atomic<uint64_t> nWrites{ 0 };
+			std::atomic<uint64_t> nOutQueueDepth{ 0 };
+			std::atomic<uint64_t> nOutQueueBytes{ 0 };
+			std::atomic<uint64_t> nRecvBufferBytes{ 0 };
+			latency_histogram sendLatency;
+
+			// a drop_newest policy discards on the sending thread, so these take true atomic adds
+			std::atomic<uint64_t> nMessagesDropped{ 0 };
+			std::atomic<uint64_t> nMessagesCoalesced{ 0 };
+
+			std::atomic<uint64_t> nDatagramsIn{ 0 };
+			std::atomic<uint64_t> nDatagramsOut{ 0 };
+			std::atomic<uint64_t> nDatagramsResent{ 0 };
+			std::atomic<uint64_t> nIncomingStalls{ 0 };
+
+			connection_stats Snapshot(uint32_t nID) const
+			{
+				connection_stats s;
+				s.nID = nID;
+				s.nBytesIn = nBytesIn.load(std::memory_order_relaxed);
+				s.nBytesOut = nBytesOut.load(std::memory_order_relaxed);
+				s.nMessagesIn = nMessagesIn.load(std::memory_order_relaxed);
+				s.nMessagesOut = nMessagesOut.load(std::memory_order_relaxed);
+				s.nWrites = nWrites.load(std::memory_order_relaxed);
+				s.nOutQueueDepth = nOutQueueDepth.load(std::memory_order_relaxed);
+				s.nOutQueueBytes = nOutQueueBytes.load(std::memory_order_relaxed);
+				s.nRecvBufferBytes = nRecvBufferBytes.load(std::memory_order_relaxed);
+				s.nMessagesDropped = nMessagesDropped.load(std::memory_order_relaxed);
+				s.nMessagesCoalesced = nMessagesCoalesced.load(std::memory_order_relaxed);
+				s.nDatagramsIn = nDatagramsIn.load(std::memory_order_relaxed);
+				s.nDatagramsOut = nDatagramsOut.load(std::memory_order_relaxed);
+				s.nDatagramsResent = nDatagramsResent.load(std::memory_order_relaxed);
+				s.nIncomingStalls = nIncomingStalls.load(std::memory_order_relaxed);
+				s.sendLatency = sendLatency.Snapshot();
+				return s;
+			}
+		};
+
+		// server wide snapshot, traffic totals include connections that have since gone away
+		struct server_stats
+		{
+			connection_stats traffic;
+			uint64_t nConnections = 0;
+			uint64_t nIncomingQueueDepth = 0;
+			uint64_t nAccepted = 0;
+			uint64_t nDenied = 0;
+			uint64_t nAcceptErrors = 0;
+			uint64_t nHandshakeFailures = 0;
+			double dAcceptRate = 0.0; // accepts per second since the previous snapshot
+		};
+
+		// server wide counters, written from every io thread so these are true atomic adds
+		struct server_metrics
+		{
+			std::atomic<uint64_t> nAccepted{ 0 };
+			std::atomic<uint64_t> nDenied{ 0 };
+			std::atomic<uint64_t> nAcceptErrors{ 0 };
+			std::atomic<uint64_t> nHandshakeFailures{ 0 };
+		};
+
+		// Prometheus text exposition format
+		inline void WritePrometheus(std::ostream& os, const server_stats& server, const std::vector<connection_stats>& vConnections)
+		{
+			auto counter = [&os](const char* sName, const char* sHelp, uint64_t nValue)
+			{
+				os << "# HELP " << sName << " " << sHelp << "\n# TYPE " << sName << " counter\n" << sName << " " << nValue << "\n";
+			};
+
+			auto gauge = [&os](const char* sName, const char* sHelp, double dValue)
+			{
+				os << "# HELP " << sName << " " << sHelp << "\n# TYPE " << sName << " gauge\n" << sName << " " << dValue << "\n";
+			};
+
+			counter("olc_net_bytes_in_total", "Bytes read from all sockets.", server.traffic.nBytesIn);
+			counter("olc_net_bytes_out_total", "Bytes written to all sockets.", server.traffic.nBytesOut);
+			counter("olc_net_messages_in_total", "Messages received from all clients.", server.traffic.nMessagesIn);
+			counter("olc_net_messages_out_total", "Messages written to all clients.", server.traffic.nMessagesOut);
+			counter("olc_net_writes_total", "Gather writes completed, each carrying one or more messages.", server.traffic.nWrites);
+			counter("olc_net_messages_dropped_total", "Outgoing messages discarded under backpressure.", server.traffic.nMessagesDropped);
+			counter("olc_net_messages_coalesced_total", "Outgoing messages replaced by a newer one of the same id.", server.traffic.nMessagesCoalesced);
+			counter("olc_net_datagrams_in_total", "UDP datagrams received from all clients.", server.traffic.nDatagramsIn);
+			counter("olc_net_datagrams_out_total", "UDP datagrams sent to all clients.", server.traffic.nDatagramsOut);
+			counter("olc_net_datagrams_resent_total", "Reliable UDP fragments sent again for want of an ack.", server.traffic.nDatagramsResent);
+			counter("olc_net_incoming_stalls_total", "Times a connection stopped reading because the incoming queue was full.", server.traffic.nIncomingStalls);
+			counter("olc_net_accepted_total", "Connections accepted.", server.nAccepted);
+			counter("olc_net_denied_total", "Connections vetoed by OnClientConnect.", server.nDenied);
+			counter("olc_net_accept_errors_total", "Failed accepts.", server.nAcceptErrors);
+			counter("olc_net_handshake_failures_total", "Connections that failed validation.", server.nHandshakeFailures);
+			gauge("olc_net_connections", "Connections currently held by the server.", double(server.nConnections));
+			gauge("olc_net_incoming_queue_depth", "Messages waiting for Update.", double(server.nIncomingQueueDepth));
+			gauge("olc_net_out_queue_depth", "Messages waiting to be written, all connections.", double(server.traffic.nOutQueueDepth));
+			gauge("olc_net_out_queue_bytes", "Bytes waiting to be written, all connections.", double(server.traffic.nOutQueueBytes));
+			gauge("olc_net_recv_buffer_bytes", "Bytes held by receive buffers, all connections.", double(server.traffic.nRecvBufferBytes));
+			gauge("olc_net_accept_rate", "Accepts per second since the previous snapshot.", server.dAcceptRate);
+
+			const char* sHist = "olc_net_send_latency_seconds";
+			os << "# HELP " << sHist << " Time from Send until the write carrying the message completes.\n";
+			os << "# TYPE " << sHist << " histogram\n";
+			uint64_t nCumulative = 0;
+			for (size_t i = 0; i < nLatencyBuckets - 1; i++)
+			{
+				nCumulative += server.traffic.sendLatency.vCounts[i];
+				os << sHist << "_bucket{le=\"" << double(uint64_t(1) << i) / 1e6 << "\"} " << nCumulative << "\n";
+			}
+			os << sHist << "_bucket{le=\"+Inf\"} " << server.traffic.sendLatency.nCount << "\n";
+			os << sHist << "_sum " << double(server.traffic.sendLatency.nSumMicros) / 1e6 << "\n";
+			os << sHist << "_count " << server.traffic.sendLatency.nCount << "\n";
+
+			auto per_connection = [&](const char* sName, const char* sType, uint64_t connection_stats::* pField)
+			{
+				os << "# TYPE " << sName << " " << sType << "\n";
+				for (const auto& c : vConnections)
+					os << sName << "{id=\"" << c.nID << "\"} " << c.*pField << "\n";
+			};
+
+			per_connection("olc_net_connection_bytes_in_total", "counter", &connection_stats::nBytesIn);
+			per_connection("olc_net_connection_bytes_out_total", "counter", &connection_stats::nBytesOut);
+			per_connection("olc_net_connection_messages_in_total", "counter", &connection_stats::nMessagesIn);
+			per_connection("olc_net_connection_messages_out_total", "counter", &connection_stats::nMessagesOut);
+			per_connection("olc_net_connection_out_queue_depth", "gauge", &connection_stats::nOutQueueDepth);
+			per_connection("olc_net_connection_out_queue_bytes", "gauge", &connection_stats::nOutQueueBytes);
+			per_connection("olc_net_connection_recv_buffer_bytes", "gauge", &connection_stats::nRecvBufferBytes);
+			per_connection("olc_net_connection_messages_dropped_total", "counter", &connection_stats::nMessagesDropped);
+			per_connection("olc_net_connection_messages_coalesced_total", "counter", &connection_stats::nMessagesCoalesced);
+		}
+	}
+}
@@ -0,0 +1,343 @@
+#pragma once
+// net bounded lock free queue, many producers (io threads) and a single consumer (logic thread)
+#include "net_common.h"
+#include "net_log.h"
+
+namespace olc
+{
+	namespace net
+	{
+		template<typename T>
+		class mpscqueue
+		{
+		public:
+			// capacity is rounded up to a power of two so slot lookup is a mask rather than a modulo.
+			// Each slot takes at least a cache line, 128 bytes for an owned_message, so the default
+			// is about 128 kB. A connection that finds the queue full holds its messages back and
+			// stops reading until there is room, see connection::RetryOverflow
+			explicit mpscqueue(size_t nCapacity = 1024)
+			{
+				size_t nSize = 2;
+				while (nSize < nCapacity) nSize <<= 1;
+
+				m_nMask = nSize - 1;
+				m_pSlots = std::make_unique<slot[]>(nSize);
+
+				// a slot is writable at position p when its sequence is p, readable when it is p + 1
+				for (size_t i = 0; i < nSize; i++)
+					m_pSlots[i].nSequence.store(i, std::memory_order_relaxed);
+			}
+
+			mpscqueue(const mpscqueue<T>&) = delete; // not copyable because of atomics
+			virtual ~mpscqueue()
+			{
+				clear();
+#ifdef __linux__
+				if (m_nEventFd >= 0)
+					close(m_nEventFd);
+#endif
+			}
+
+		public:
+			// producer - any thread, returns false rather than waiting when the queue is full
+			bool try_push_back(const T& item)
+			{
+				slot* pSlot = claim();
+				if (pSlot == nullptr)
+					return false;
+
+				new (pSlot->storage) T(item);
+				publish(pSlot);
+				return true;
+			}
+
+			// producer - any thread, item is only moved from if this returns true
+			bool try_push_back(T&& item)
+			{
+				slot* pSlot = claim();
+				if (pSlot == nullptr)
+					return false;
+
+				new (pSlot->storage) T(std::move(item));
+				publish(pSlot);
+				return true;
+			}
+
+			// producer - any thread, yields until a slot frees up if the consumer has fallen behind
+			void push_back(const T& item)
+			{
+				while (!try_push_back(item))
+					std::this_thread::yield();
+			}
+
+			void push_back(T&& item)
+			{
+				while (!try_push_back(std::move(item)))
+					std::this_thread::yield();
+			}
+
+			// consumer only
+			bool empty() const
+			{
+				size_t nHead = m_nHead.load(std::memory_order_relaxed);
+				const slot& s = m_pSlots[nHead & m_nMask];
+				return s.nSequence.load(std::memory_order_acquire) != nHead + 1;
+			}
+
+			// consumer only, the queue must not be empty
+			const T& front() const
+			{
+				return *item(m_pSlots[m_nHead.load(std::memory_order_relaxed) & m_nMask]);
+			}
+
+			// consumer only, the queue must not be empty
+			T pop_front()
+			{
+				size_t nHead = m_nHead.load(std::memory_order_relaxed);
+				slot& s = m_pSlots[nHead & m_nMask];
+				T t = std::move(*item(s)); // locally caching object so it is possible to return it
+				item(s)->~T();
+
+				// hand the slot back to producers for the next lap around the ring
+				s.nSequence.store(nHead + m_nMask + 1, std::memory_order_release);
+				m_nHead.store(nHead + 1, std::memory_order_relaxed);
+				return t;
+			}
+
+			// consumer only - moves up to nMax pending items onto the back of vOut, returns how many
+			size_t drain(std::vector<T>& vOut, size_t nMax = -1)
+			{
+				size_t nCount = 0;
+				while (nCount < nMax && !empty())
+				{
+					vOut.emplace_back(pop_front());
+					nCount++;
+				}
+				return nCount;
+			}
+
+			// any thread, approximate while the queue is in use. The head is read first so the
+			// count never goes below zero
+			size_t count() const
+			{
+				size_t nHead = m_nHead.load(std::memory_order_relaxed);
+				return m_nTail.load(std::memory_order_relaxed) - nHead;
+			}
+
+			// consumer only
+			void clear()
+			{
+				while (!empty())
+					pop_front();
+			}
+
+			// consumer only - sleeps in the kernel until a producer publishes something
+			void wait()
+			{
+				while (empty())
+				{
+					// sample the signal before announcing ourselves, any push after this point
+					// changes it and the sleep below returns straight away
+					uint32_t nSignal = m_nSignal.load(std::memory_order_acquire);
+					m_nWaiters.fetch_add(1, std::memory_order_seq_cst);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+
+					if (empty())
+						park(nSignal);
+
+					m_nWaiters.fetch_sub(1, std::memory_order_relaxed);
+				}
+			}
+
+			// consumer only - as wait, but gives up at the deadline. True if there is something to take
+			template <typename Clock, typename Duration>
+			bool wait_until(const std::chrono::time_point<Clock, Duration>& tDeadline)
+			{
+				while (empty())
+				{
+					auto tLeft = std::chrono::duration_cast<std::chrono::nanoseconds>(tDeadline - Clock::now());
+					if (tLeft.count() <= 0)
+						return false;
+
+					uint32_t nSignal = m_nSignal.load(std::memory_order_acquire);
+					m_nWaiters.fetch_add(1, std::memory_order_seq_cst);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+
+					if (empty())
+						park(nSignal, tLeft);
+
+					m_nWaiters.fetch_sub(1, std::memory_order_relaxed);
+				}
+				return true;
+			}
+
+			template <typename Rep, typename Period>
+			bool wait_for(const std::chrono::duration<Rep, Period>& tTimeout)
+			{
+				return wait_until(std::chrono::steady_clock::now() + tTimeout);
+			}
+
+#ifdef __linux__
+			// consumer only - a descriptor for epoll or poll that becomes readable when something is
+			// pushed. Once it polls readable, call reset_event and then take everything there is, as
+			// it is only signalled again for pushes after that. Made on first use, owned by the queue.
+			// -1 if the descriptor could not be made, nothing is armed then
+			int event_fd()
+			{
+				if (m_nEventFd < 0)
+				{
+					int nFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+					if (nFd < 0)
+					{
+						OLC_NET_LOG(error, "[QUEUE] eventfd failed: {}", std::error_code(errno, std::generic_category()));
+						return -1;
+					}
+
+					m_nEventFd = nFd;
+					reset_event();
+				}
+				return m_nEventFd;
+			}
+
+			// consumer only - clears the descriptor and arms it for the next push
+			void reset_event()
+			{
+				uint64_t nCount;
+				ssize_t nRead = read(m_nEventFd, &nCount, sizeof(nCount));
+				(void)nRead;
+
+				m_bEventArmed.store(true, std::memory_order_seq_cst);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+
+				// anything already waiting makes it readable straight away
+				if (!empty() && m_bEventArmed.exchange(false, std::memory_order_relaxed))
+					signal_event();
+			}
+#endif
+
+		private:
+			struct alignas(64) slot
+			{
+				std::atomic<size_t> nSequence{ 0 };
+				alignas(T) unsigned char storage[sizeof(T)];
+			};
+
+			static T* item(slot& s) { return std::launder(reinterpret_cast<T*>(s.storage)); }
+			static const T* item(const slot& s) { return std::launder(reinterpret_cast<const T*>(s.storage)); }
+
+			slot* claim()
+			{
+				size_t nPos = m_nTail.load(std::memory_order_relaxed);
+				for (;;)
+				{
+					slot& s = m_pSlots[nPos & m_nMask];
+					size_t nSequence = s.nSequence.load(std::memory_order_acquire);
+					intptr_t nDiff = intptr_t(nSequence) - intptr_t(nPos);
+
+					if (nDiff == 0)
+					{
+						if (m_nTail.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+							return &s;
+					}
+					else if (nDiff < 0)
+					{
+						// the consumer has not yet released this slot from the previous lap
+						return nullptr;
+					}
+					else
+					{
+						// another producer got here first
+						nPos = m_nTail.load(std::memory_order_relaxed);
+					}
+				}
+			}
+
+			void publish(slot* pSlot)
+			{
+				size_t nPos = pSlot->nSequence.load(std::memory_order_relaxed);
+				pSlot->nSequence.store(nPos + 1, std::memory_order_release);
+
+				// only pay for a wake up when the consumer has actually gone to sleep
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (m_nWaiters.load(std::memory_order_relaxed) > 0)
+				{
+					m_nSignal.fetch_add(1, std::memory_order_release);
+					unpark();
+				}
+
+#ifdef __linux__
+				// one write per reset_event however many pushes follow it
+				if (m_bEventArmed.load(std::memory_order_relaxed) && m_bEventArmed.exchange(false, std::memory_order_acquire))
+					signal_event();
+#endif
+			}
+
+#ifdef __linux__
+			void park(uint32_t nSignal)
+			{
+				syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_nSignal), FUTEX_WAIT_PRIVATE, nSignal, nullptr, nullptr, 0);
+			}
+
+			void park(uint32_t nSignal, std::chrono::nanoseconds tTimeout)
+			{
+				timespec ts;
+				ts.tv_sec = time_t(tTimeout.count() / 1000000000);
+				ts.tv_nsec = long(tTimeout.count() % 1000000000);
+				syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_nSignal), FUTEX_WAIT_PRIVATE, nSignal, &ts, nullptr, 0);
+			}
+
+			void unpark()
+			{
+				syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_nSignal), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+			}
+
+			void signal_event()
+			{
+				uint64_t nOne = 1;
+				ssize_t nWritten = write(m_nEventFd, &nOne, sizeof(nOne));
+				(void)nWritten;
+			}
+#else
+			void park(uint32_t nSignal)
+			{
+				std::unique_lock<std::mutex> ul(muxBlocking);
+				cvBlocking.wait(ul, [&]() { return m_nSignal.load(std::memory_order_acquire) != nSignal; });
+			}
+
+			void park(uint32_t nSignal, std::chrono::nanoseconds tTimeout)
+			{
+				std::unique_lock<std::mutex> ul(muxBlocking);
+				cvBlocking.wait_for(ul, tTimeout, [&]() { return m_nSignal.load(std::memory_order_acquire) != nSignal; });
+			}
+
+			void unpark()
+			{
+				std::unique_lock<std::mutex> ul(muxBlocking);
+				cvBlocking.notify_one();
+			}
+
+			std::condition_variable cvBlocking;
+			std::mutex muxBlocking;
+#endif
+
+		protected:
+			std::unique_ptr<slot[]> m_pSlots;
+			size_t m_nMask = 0;
+
+			// producers and the consumer each get a cache line of their own
+			alignas(64) std::atomic<size_t> m_nTail{ 0 };
+			// only the consumer moves it, atomic so count can read it from anywhere
+			alignas(64) std::atomic<size_t> m_nHead{ 0 };
+
+			// futex word and sleeper count for the blocking wait
+			alignas(64) std::atomic<uint32_t> m_nSignal{ 0 };
+			std::atomic<uint32_t> m_nWaiters{ 0 };
+
+#ifdef __linux__
+			// pollable signal, armed by the consumer and disarmed by the first push after that
+			int m_nEventFd = -1;
+			std::atomic<bool> m_bEventArmed{ false };
+#endif
+		};
+	}
+}
@@ -0,0 +1,318 @@
+#pragma once
+// net size classed buffer pool, message bodies draw their storage from here
+#include "net_common.h"
+
+namespace olc
+{
+	namespace net
+	{
+		// counters for a single thread's pool, written only by that thread
+		struct pool_stats
+		{
+			uint64_t nAllocations = 0;	// every request, served from the pool or not
+			uint64_t nHits = 0;			// requests served from a cached block
+			uint64_t nBytesAllocated = 0;	// bytes asked for across every request
+			uint64_t nFrees = 0;		// blocks handed back, on this thread or from another one
+			uint64_t nReleased = 0;		// blocks given back to the heap because the cache was full
+			size_t nBytesHeld = 0;		// bytes currently cached and ready to be reused
+
+			double HitRate() const
+			{
+				return nAllocations > 0 ? double(nHits) / double(nAllocations) : 0.0;
+			}
+		};
+
+		// Every thread that allocates gets a pool of its own, so the common case takes no lock.
+		// Blocks freed by another thread (typically io thread allocates, logic thread frees)
+		// are pushed onto a lock free list owned by the allocating pool and collected by it
+		// the next time it runs dry, so buffers keep circulating rather than piling up.
+		class buffer_pool
+		{
+		public:
+			static constexpr size_t nMinClassBytes = 64;
+			static constexpr size_t nClasses = 11; // 64 bytes .. 64 KB, anything bigger goes to the heap
+			static constexpr size_t nMaxBytesHeld = 4 * 1024 * 1024;
+
+			static void* allocate(size_t nBytes)
+			{
+				size_t nClass = SizeClass(nBytes);
+				buffer_pool* pPool = local();
+
+				if (pPool == nullptr || nClass >= nClasses)
+				{
+					if (pPool)
+					{
+						pPool->Count(pPool->m_nAllocations);
+						pPool->Count(pPool->m_nBytesAllocated, nBytes);
+					}
+					return Attach(::operator new(sizeof(block_header) + nBytes), nullptr, nClass);
+				}
+
+				pPool->Count(pPool->m_nBytesAllocated, nBytes);
+				return pPool->Take(nClass);
+			}
+
+			static void deallocate(void* p, size_t /*nBytes*/)
+			{
+				if (p == nullptr)
+					return;
+
+				block_header* pHeader = static_cast<block_header*>(p) - 1;
+				buffer_pool* pOwner = pHeader->pOwner;
+
+				if (pOwner == nullptr)
+				{
+					::operator delete(pHeader);
+				}
+				else if (pOwner == local())
+				{
+					pOwner->Give(pHeader);
+				}
+				else
+				{
+					pOwner->GiveRemote(pHeader);
+				}
+			}
+
+			// the calling thread's pool, nullptr once the thread has started shutting down
+			static buffer_pool* local()
+			{
+				// a plain pointer stays readable while the thread's other thread_locals are torn down
+				static thread_local buffer_pool* pPool = nullptr;
+				static thread_local bool bAttached = false;
+
+				if (!bAttached)
+				{
+					bAttached = true;
+					static thread_local holder h(pPool);
+				}
+				return pPool;
+			}
+
+			pool_stats stats() const
+			{
+				pool_stats s;
+				s.nAllocations = m_nAllocations.load(std::memory_order_relaxed);
+				s.nHits = m_nHits.load(std::memory_order_relaxed);
+				s.nBytesAllocated = m_nBytesAllocated.load(std::memory_order_relaxed);
+				s.nFrees = m_nFrees.load(std::memory_order_relaxed);
+				s.nReleased = m_nReleased.load(std::memory_order_relaxed);
+				s.nBytesHeld = m_nBytesHeld.load(std::memory_order_relaxed);
+				return s;
+			}
+
+			// stats of every pool that has ever been created, one entry per thread
+			static std::vector<pool_stats> all_stats()
+			{
+				std::scoped_lock lock(registry().mux);
+				std::vector<pool_stats> vStats;
+				for (auto& pPool : registry().vPools)
+					vStats.push_back(pPool->stats());
+				return vStats;
+			}
+
+		private:
+			struct alignas(16) block_header
+			{
+				buffer_pool* pOwner;
+				size_t nClass;
+			};
+
+			struct free_block
+			{
+				free_block* pNext;
+			};
+
+			// pools outlive their threads, as blocks they handed out may still be in flight. When a
+			// thread exits its pool is parked here and adopted by the next thread to need one
+			struct pool_registry
+			{
+				std::mutex mux;
+				std::vector<std::unique_ptr<buffer_pool>> vPools;
+				std::vector<buffer_pool*> vAbandoned;
+			};
+
+			struct holder
+			{
+				buffer_pool*& pPool;
+
+				holder(buffer_pool*& pThreadPool) : pPool(pThreadPool)
+				{
+					std::scoped_lock lock(registry().mux);
+					if (!registry().vAbandoned.empty())
+					{
+						pPool = registry().vAbandoned.back();
+						registry().vAbandoned.pop_back();
+					}
+					else
+					{
+						registry().vPools.push_back(std::unique_ptr<buffer_pool>(new buffer_pool()));
+						pPool = registry().vPools.back().get();
+					}
+				}
+
+				~holder()
+				{
+					buffer_pool* pAbandoned = pPool;
+					pPool = nullptr;
+					pAbandoned->Trim();
+
+					std::scoped_lock lock(registry().mux);
+					registry().vAbandoned.push_back(pAbandoned);
+				}
+			};
+
+			// deliberately never destroyed, static messages may be freed after it would have been
+			static pool_registry& registry()
+			{
+				static pool_registry* r = new pool_registry();
+				return *r;
+			}
+
+			static size_t SizeClass(size_t nBytes)
+			{
+				size_t nClass = 0;
+				size_t nClassBytes = nMinClassBytes;
+				while (nClassBytes < nBytes)
+				{
+					nClassBytes <<= 1;
+					nClass++;
+				}
+				return nClass;
+			}
+
+			static size_t ClassBytes(size_t nClass)
+			{
+				return nMinClassBytes << nClass;
+			}
+
+			static void* Attach(void* pMemory, buffer_pool* pOwner, size_t nClass)
+			{
+				block_header* pHeader = static_cast<block_header*>(pMemory);
+				pHeader->pOwner = pOwner;
+				pHeader->nClass = nClass;
+				return pHeader + 1;
+			}
+
+			// the owning thread is the only writer, so a plain load and store is enough
+			static void Count(std::atomic<uint64_t>& n, uint64_t nBy = 1)
+			{
+				n.store(n.load(std::memory_order_relaxed) + nBy, std::memory_order_relaxed);
+			}
+
+			void* Take(size_t nClass)
+			{
+				Count(m_nAllocations);
+
+				// out of local blocks, collect whatever other threads have handed back
+				if (m_pFree[nClass] == nullptr)
+					Collect(nClass);
+
+				free_block* pBlock = m_pFree[nClass];
+				if (pBlock == nullptr)
+					return Attach(::operator new(sizeof(block_header) + ClassBytes(nClass)), this, nClass);
+
+				m_pFree[nClass] = pBlock->pNext;
+				m_nBytesHeld.store(m_nBytesHeld.load(std::memory_order_relaxed) - ClassBytes(nClass), std::memory_order_relaxed);
+				Count(m_nHits);
+				return Attach(pBlock, this, nClass);
+			}
+
+			void Give(block_header* pHeader)
+			{
+				Count(m_nFrees);
+
+				size_t nClass = pHeader->nClass;
+				size_t nBytesHeld = m_nBytesHeld.load(std::memory_order_relaxed);
+				if (nBytesHeld + ClassBytes(nClass) > nMaxBytesHeld)
+				{
+					Count(m_nReleased);
+					::operator delete(pHeader);
+					return;
+				}
+
+				free_block* pBlock = reinterpret_cast<free_block*>(pHeader);
+				pBlock->pNext = m_pFree[nClass];
+				m_pFree[nClass] = pBlock;
+				m_nBytesHeld.store(nBytesHeld + ClassBytes(nClass), std::memory_order_relaxed);
+			}
+
+			// any thread - blocks are only ever pushed here and taken all at once by the owner,
+			// so the list cannot suffer from ABA
+			void GiveRemote(block_header* pHeader)
+			{
+				std::atomic<free_block*>& pList = m_pRemoteFree[pHeader->nClass];
+				free_block* pBlock = reinterpret_cast<free_block*>(pHeader);
+				pBlock->pNext = pList.load(std::memory_order_relaxed);
+				while (!pList.compare_exchange_weak(pBlock->pNext, pBlock, std::memory_order_release, std::memory_order_relaxed));
+			}
+
+			void Collect(size_t nClass)
+			{
+				free_block* pBlock = m_pRemoteFree[nClass].exchange(nullptr, std::memory_order_acquire);
+				while (pBlock != nullptr)
+				{
+					free_block* pNext = pBlock->pNext;
+					Give(reinterpret_cast<block_header*>(pBlock));
+					pBlock = pNext;
+				}
+			}
+
+			// hands every cached block back to the heap, blocks still out keep pointing at this pool
+			void Trim()
+			{
+				for (size_t nClass = 0; nClass < nClasses; nClass++)
+				{
+					while (m_pFree[nClass] != nullptr)
+					{
+						free_block* pBlock = m_pFree[nClass];
+						m_pFree[nClass] = pBlock->pNext;
+						::operator delete(pBlock);
+					}
+				}
+				m_nBytesHeld.store(0, std::memory_order_relaxed);
+			}
+
+		private:
+			buffer_pool() = default;
+
+			free_block* m_pFree[nClasses] = {};
+			alignas(64) std::atomic<free_block*> m_pRemoteFree[nClasses] = {};
+
+			alignas(64) std::atomic<uint64_t> m_nAllocations{ 0 };
+			std::atomic<uint64_t> m_nHits{ 0 };
+			std::atomic<uint64_t> m_nBytesAllocated{ 0 };
+			std::atomic<uint64_t> m_nFrees{ 0 };
+			std::atomic<uint64_t> m_nReleased{ 0 };
+			std::atomic<size_t> m_nBytesHeld{ 0 };
+		};
+
+		// stateless allocator so containers can draw from the calling thread's pool
+		template <typename T>
+		struct pool_allocator
+		{
+			using value_type = T;
+
+			pool_allocator() noexcept = default;
+
+			template <typename U>
+			pool_allocator(const pool_allocator<U>&) noexcept {}
+
+			T* allocate(size_t n)
+			{
+				return static_cast<T*>(buffer_pool::allocate(n * sizeof(T)));
+			}
+
+			void deallocate(T* p, size_t n) noexcept
+			{
+				buffer_pool::deallocate(p, n * sizeof(T));
+			}
+
+			template <typename U>
+			friend bool operator == (const pool_allocator<T>&, const pool_allocator<U>&) { return true; }
+
+			template <typename U>
+			friend bool operator != (const pool_allocator<T>&, const pool_allocator<U>&) { return false; }
+		};
+	}
+}
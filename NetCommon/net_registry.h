@@ -0,0 +1,151 @@
+#pragma once
+// net id registry, constant time lookup and removal by id with dense storage for iteration
+#include "net_common.h"
+
+namespace olc
+{
+	namespace net
+	{
+		// Items live packed together in insertion order (until a removal swaps the last one into
+		// the gap), so walking all of them is a plain array walk. An open addressing table maps
+		// ids onto their position in that array. Ids are expected to be unique and never reused,
+		// as the ones handed out by the server's counter are, so no generation tag is needed.
+		template<typename T>
+		class id_registry
+		{
+		public:
+			id_registry()
+			{
+				m_vSlots.assign(nMinSlots, nEmpty);
+			}
+
+			// returns false if the id is already present
+			bool insert(uint32_t nID, T item)
+			{
+				if (find_slot(nID) != nNotFound)
+					return false;
+
+				// keep the table at most half full so probe chains stay short
+				if ((m_vItems.size() + 1) * 2 > m_vSlots.size())
+					rehash(m_vSlots.size() * 2);
+
+				size_t nSlot = home(nID);
+				while (m_vSlots[nSlot] != nEmpty)
+					nSlot = (nSlot + 1) & (m_vSlots.size() - 1);
+
+				m_vSlots[nSlot] = uint32_t(m_vItems.size());
+				m_vIDs.push_back(nID);
+				m_vItems.push_back(std::move(item));
+				return true;
+			}
+
+			// nullptr if the id is not present
+			T* find(uint32_t nID)
+			{
+				size_t nSlot = find_slot(nID);
+				return nSlot == nNotFound ? nullptr : &m_vItems[m_vSlots[nSlot]];
+			}
+
+			// returns false if the id was not present
+			bool erase(uint32_t nID)
+			{
+				size_t nSlot = find_slot(nID);
+				if (nSlot == nNotFound)
+					return false;
+
+				// swap the last item into the hole so storage stays dense
+				uint32_t nIndex = m_vSlots[nSlot];
+				uint32_t nLast = uint32_t(m_vItems.size() - 1);
+				if (nIndex != nLast)
+				{
+					m_vSlots[find_slot(m_vIDs[nLast])] = nIndex;
+					m_vIDs[nIndex] = m_vIDs[nLast];
+					m_vItems[nIndex] = std::move(m_vItems[nLast]);
+				}
+				m_vIDs.pop_back();
+				m_vItems.pop_back();
+
+				remove_slot(nSlot);
+				return true;
+			}
+
+			void clear()
+			{
+				m_vItems.clear();
+				m_vIDs.clear();
+				m_vSlots.assign(nMinSlots, nEmpty);
+			}
+
+			size_t size() const { return m_vItems.size(); }
+			bool empty() const { return m_vItems.empty(); }
+
+			// dense access, an erase moves the last item into the erased position
+			T& at(size_t nIndex) { return m_vItems[nIndex]; }
+			uint32_t id_at(size_t nIndex) const { return m_vIDs[nIndex]; }
+
+			typename std::vector<T>::iterator begin() { return m_vItems.begin(); }
+			typename std::vector<T>::iterator end() { return m_vItems.end(); }
+
+		private:
+			static constexpr uint32_t nEmpty = UINT32_MAX;
+			static constexpr size_t nNotFound = SIZE_MAX;
+			static constexpr size_t nMinSlots = 16;
+
+			// fibonacci hashing, consecutive ids land far apart
+			size_t home(uint32_t nID) const
+			{
+				return size_t(uint32_t(nID * 2654435769u)) & (m_vSlots.size() - 1);
+			}
+
+			size_t find_slot(uint32_t nID) const
+			{
+				size_t nSlot = home(nID);
+				while (m_vSlots[nSlot] != nEmpty)
+				{
+					if (m_vIDs[m_vSlots[nSlot]] == nID)
+						return nSlot;
+					nSlot = (nSlot + 1) & (m_vSlots.size() - 1);
+				}
+				return nNotFound;
+			}
+
+			// backward shift deletion, pulls later members of the probe chain into the gap so
+			// lookups never need tombstones
+			void remove_slot(size_t nHole)
+			{
+				size_t nMask = m_vSlots.size() - 1;
+				size_t nSlot = (nHole + 1) & nMask;
+				while (m_vSlots[nSlot] != nEmpty)
+				{
+					size_t nHome = home(m_vIDs[m_vSlots[nSlot]]);
+
+					// the entry may move into the hole only if the hole lies on its probe path
+					if (((nSlot - nHome) & nMask) >= ((nSlot - nHole) & nMask))
+					{
+						m_vSlots[nHole] = m_vSlots[nSlot];
+						nHole = nSlot;
+					}
+					nSlot = (nSlot + 1) & nMask;
+				}
+				m_vSlots[nHole] = nEmpty;
+			}
+
+			void rehash(size_t nSlots)
+			{
+				m_vSlots.assign(nSlots, nEmpty);
+				for (uint32_t i = 0; i < m_vIDs.size(); i++)
+				{
+					size_t nSlot = home(m_vIDs[i]);
+					while (m_vSlots[nSlot] != nEmpty)
+						nSlot = (nSlot + 1) & (nSlots - 1);
+					m_vSlots[nSlot] = i;
+				}
+			}
+
+		protected:
+			std::vector<T> m_vItems;
+			std::vector<uint32_t> m_vIDs;
+			std::vector<uint32_t> m_vSlots;
+		};
+	}
+}
@@ -0,0 +1,402 @@
+#pragma once
+// net schema, payload structs described as field lists with encoders and decoders generated at compile time
+#include "net_common.h"
+#include "net_message.h"
+
+namespace olc
+{
+	namespace net
+	{
+		// A payload is described by specialising schema for it:
+		//
+		//	struct move_payload { uint32_t nEntity; float fX, fY; std::string sName; };
+		//
+		//	template <> struct schema<move_payload>
+		//	{
+		//		using fields = field_list<
+		//			field<&move_payload::nEntity>,				// integers are varints
+		//			fixed_field<&move_payload::fX, 100>,		// 2 decimal places as a varint
+		//			fixed_field<&move_payload::fY, 100>,
+		//			field<&move_payload::sName>>;				// length prefixed
+		//	};
+		//
+		// and a message id is bound to its payload by specialising payload_of:
+		//
+		//	template <> struct payload_of<GameMsg::Move> { using type = move_payload; };
+		//
+		// encode<GameMsg::Move>(msg, payload) then only compiles for a move_payload, and
+		// decode<GameMsg::Move>(msg, payload) refuses a message carrying any other id.
+		// Fields are written in the order listed, so both ends must agree on the list
+		template <typename Payload>
+		struct schema {};
+
+		template <auto nID>
+		struct payload_of {};
+
+		template <auto nID>
+		using payload_t = typename payload_of<nID>::type;
+
+		template <typename... Fields>
+		struct field_list {};
+
+		template <typename V, typename = void>
+		struct has_schema : std::false_type {};
+
+		template <typename V>
+		struct has_schema<V, std::void_t<typename schema<V>::fields>> : std::true_type {};
+
+		template <typename V>
+		struct is_vector : std::false_type {};
+
+		template <typename E, typename A>
+		struct is_vector<std::vector<E, A>> : std::true_type {};
+
+		template <typename M>
+		struct member_traits;
+
+		template <typename C, typename V>
+		struct member_traits<V C::*>
+		{
+			using class_type = C;
+			using value_type = V;
+		};
+
+		// LEB128, 7 bits per byte with the top bit set on all but the last
+		inline size_t varint_size(uint64_t n)
+		{
+			size_t nBytes = 1;
+			while (n >= 0x80)
+			{
+				n >>= 7;
+				nBytes++;
+			}
+			return nBytes;
+		}
+
+		inline void write_varint(uint8_t*& p, uint64_t n)
+		{
+			while (n >= 0x80)
+			{
+				*p++ = uint8_t(n) | 0x80;
+				n >>= 7;
+			}
+			*p++ = uint8_t(n);
+		}
+
+		inline bool read_varint(message_reader& r, uint64_t& n)
+		{
+			n = 0;
+			for (size_t nShift = 0; nShift < 64; nShift += 7)
+			{
+				uint8_t b;
+				if (!r.read(&b, 1))
+					return false;
+
+				n |= uint64_t(b & 0x7F) << nShift;
+				if ((b & 0x80) == 0)
+					return true;
+			}
+			return false; // more than 10 bytes, not something this side wrote
+		}
+
+		// zigzag folds the sign into the lowest bit so small negative numbers stay short
+		inline uint64_t zigzag(int64_t n)
+		{
+			return (uint64_t(n) << 1) ^ uint64_t(n >> 63);
+		}
+
+		inline int64_t unzigzag(uint64_t n)
+		{
+			return int64_t(n >> 1) ^ -int64_t(n & 1);
+		}
+
+		template <typename V>
+		struct value_codec;
+
+		// integers and enums go as varints, bools as a byte, everything else trivially copyable
+		// as its raw bytes. Strings and vectors are a varint count followed by the elements,
+		// and a struct with a schema of its own is nested in place
+		template <typename V>
+		struct value_codec
+		{
+			static size_t size(const V& v)
+			{
+				if constexpr (has_schema<V>::value)
+					return schema_size(v, typename schema<V>::fields{});
+				else if constexpr (std::is_same<V, bool>::value)
+					return 1;
+				else if constexpr (std::is_enum<V>::value)
+					return value_codec<std::underlying_type_t<V>>::size(std::underlying_type_t<V>(v));
+				else if constexpr (std::is_integral<V>::value && std::is_signed<V>::value)
+					return varint_size(zigzag(int64_t(v)));
+				else if constexpr (std::is_integral<V>::value)
+					return varint_size(uint64_t(v));
+				else if constexpr (std::is_same<V, std::string>::value)
+					return varint_size(v.size()) + v.size();
+				else if constexpr (is_vector<V>::value)
+				{
+					using E = typename V::value_type;
+					size_t nBytes = varint_size(v.size());
+					if constexpr (std::is_trivially_copyable<E>::value && !std::is_integral<E>::value && !std::is_enum<E>::value && !has_schema<E>::value)
+						nBytes += v.size() * sizeof(E);
+					else
+						for (const auto& e : v)
+							nBytes += value_codec<E>::size(e);
+					return nBytes;
+				}
+				else
+				{
+					static_assert(std::is_trivially_copyable<V>::value, "Field type has no codec, give it a schema");
+					return sizeof(V);
+				}
+			}
+
+			// p must have room for size(v) bytes
+			static void write(uint8_t*& p, const V& v)
+			{
+				if constexpr (has_schema<V>::value)
+					schema_write(p, v, typename schema<V>::fields{});
+				else if constexpr (std::is_same<V, bool>::value)
+					*p++ = v ? 1 : 0;
+				else if constexpr (std::is_enum<V>::value)
+					value_codec<std::underlying_type_t<V>>::write(p, std::underlying_type_t<V>(v));
+				else if constexpr (std::is_integral<V>::value && std::is_signed<V>::value)
+					write_varint(p, zigzag(int64_t(v)));
+				else if constexpr (std::is_integral<V>::value)
+					write_varint(p, uint64_t(v));
+				else if constexpr (std::is_same<V, std::string>::value)
+				{
+					write_varint(p, v.size());
+					if (!v.empty())
+						std::memcpy(p, v.data(), v.size());
+					p += v.size();
+				}
+				else if constexpr (is_vector<V>::value)
+				{
+					using E = typename V::value_type;
+					write_varint(p, v.size());
+					if constexpr (std::is_trivially_copyable<E>::value && !std::is_integral<E>::value && !std::is_enum<E>::value && !has_schema<E>::value)
+					{
+						if (!v.empty())
+							std::memcpy(p, v.data(), v.size() * sizeof(E));
+						p += v.size() * sizeof(E);
+					}
+					else
+						for (const auto& e : v)
+							value_codec<E>::write(p, e);
+				}
+				else
+				{
+					std::memcpy(p, &v, sizeof(V));
+					p += sizeof(V);
+				}
+			}
+
+			static bool read(message_reader& r, V& v)
+			{
+				if constexpr (has_schema<V>::value)
+					return schema_read(r, v, typename schema<V>::fields{});
+				else if constexpr (std::is_same<V, bool>::value)
+				{
+					uint8_t b = 0;
+					if (!r.read(&b, 1) || b > 1)
+						return false;
+					v = b != 0;
+					return true;
+				}
+				else if constexpr (std::is_enum<V>::value)
+				{
+					std::underlying_type_t<V> n;
+					if (!value_codec<std::underlying_type_t<V>>::read(r, n))
+						return false;
+					v = V(n);
+					return true;
+				}
+				else if constexpr (std::is_integral<V>::value)
+				{
+					uint64_t n;
+					if (!read_varint(r, n))
+						return false;
+
+					if constexpr (std::is_signed<V>::value)
+					{
+						int64_t s = unzigzag(n);
+						if (s < int64_t(std::numeric_limits<V>::min()) || s > int64_t(std::numeric_limits<V>::max()))
+							return false;
+						v = V(s);
+					}
+					else
+					{
+						if (n > uint64_t(std::numeric_limits<V>::max()))
+							return false;
+						v = V(n);
+					}
+					return true;
+				}
+				else if constexpr (std::is_same<V, std::string>::value)
+				{
+					uint64_t nLength;
+					if (!read_varint(r, nLength) || nLength > r.remaining())
+						return false;
+					const uint8_t* p = r.take(size_t(nLength));
+					v.assign(reinterpret_cast<const char*>(p), size_t(nLength));
+					return true;
+				}
+				else if constexpr (is_vector<V>::value)
+				{
+					using E = typename V::value_type;
+					uint64_t nCount;
+
+					// every element takes at least a byte, which caps what a bad count can allocate
+					if (!read_varint(r, nCount) || nCount > r.remaining())
+						return false;
+
+					if constexpr (std::is_trivially_copyable<E>::value && !std::is_integral<E>::value && !std::is_enum<E>::value && !has_schema<E>::value)
+					{
+						if (nCount > r.remaining() / sizeof(E))
+							return false;
+						v.resize(size_t(nCount));
+						return r.read(v.data(), size_t(nCount) * sizeof(E));
+					}
+					else
+					{
+						v.resize(size_t(nCount));
+						for (auto& e : v)
+							if (!value_codec<E>::read(r, e))
+								return false;
+						return true;
+					}
+				}
+				else
+				{
+					return r.read(&v, sizeof(V));
+				}
+			}
+		};
+
+		// a member encoded with the default codec for its type
+		template <auto pMember>
+		struct field
+		{
+			using payload_type = typename member_traits<decltype(pMember)>::class_type;
+			using value_type = typename member_traits<decltype(pMember)>::value_type;
+
+			static size_t size(const payload_type& p) { return value_codec<value_type>::size(p.*pMember); }
+			static void write(uint8_t*& pOut, const payload_type& p) { value_codec<value_type>::write(pOut, p.*pMember); }
+			static bool read(message_reader& r, payload_type& p) { return value_codec<value_type>::read(r, p.*pMember); }
+		};
+
+		// a floating point member sent as a whole number of 1/nScale steps, so a position that
+		// only needs centimetres costs a byte or two rather than four or eight
+		template <auto pMember, int64_t nScale>
+		struct fixed_field
+		{
+			using payload_type = typename member_traits<decltype(pMember)>::class_type;
+			using value_type = typename member_traits<decltype(pMember)>::value_type;
+			static_assert(std::is_floating_point<value_type>::value, "fixed_field is for float and double members");
+			static_assert(nScale > 0, "fixed_field needs a positive scale");
+
+			static int64_t quantize(const payload_type& p) { return int64_t(std::llround(double(p.*pMember) * double(nScale))); }
+
+			static size_t size(const payload_type& p) { return varint_size(zigzag(quantize(p))); }
+			static void write(uint8_t*& pOut, const payload_type& p) { write_varint(pOut, zigzag(quantize(p))); }
+
+			static bool read(message_reader& r, payload_type& p)
+			{
+				uint64_t n;
+				if (!read_varint(r, n))
+					return false;
+				p.*pMember = value_type(double(unzigzag(n)) / double(nScale));
+				return true;
+			}
+		};
+
+		// a member copied as its raw bytes whatever its type, e.g. an integer that is usually large
+		template <auto pMember>
+		struct raw_field
+		{
+			using payload_type = typename member_traits<decltype(pMember)>::class_type;
+			using value_type = typename member_traits<decltype(pMember)>::value_type;
+			static_assert(std::is_trivially_copyable<value_type>::value, "raw_field needs a trivially copyable member");
+
+			static size_t size(const payload_type&) { return sizeof(value_type); }
+
+			static void write(uint8_t*& pOut, const payload_type& p)
+			{
+				std::memcpy(pOut, &(p.*pMember), sizeof(value_type));
+				pOut += sizeof(value_type);
+			}
+
+			static bool read(message_reader& r, payload_type& p) { return r.read(&(p.*pMember), sizeof(value_type)); }
+		};
+
+		template <typename Payload, typename... Fields>
+		size_t schema_size(const Payload& p, field_list<Fields...>)
+		{
+			static_assert((std::is_same<typename Fields::payload_type, Payload>::value && ...), "Schema lists a field of another struct");
+			return (Fields::size(p) + ... + 0);
+		}
+
+		template <typename Payload, typename... Fields>
+		void schema_write(uint8_t*& pOut, const Payload& p, field_list<Fields...>)
+		{
+			(Fields::write(pOut, p), ...);
+		}
+
+		template <typename Payload, typename... Fields>
+		bool schema_read(message_reader& r, Payload& p, field_list<Fields...>)
+		{
+			return (Fields::read(r, p) && ...);
+		}
+
+		// appends the payload to the body, sized up front so the body grows once
+		template <typename T, typename Payload>
+		void encode_payload(message<T>& msg, const Payload& payload)
+		{
+			static_assert(has_schema<Payload>::value, "Payload has no schema<> specialisation");
+
+			size_t nOffset = msg.body.size();
+			msg.body.resize(nOffset + value_codec<Payload>::size(payload));
+
+			uint8_t* p = msg.body.data() + nOffset;
+			value_codec<Payload>::write(p, payload);
+			msg.header.size = uint32_t(msg.body.size());
+		}
+
+		// false if the body is malformed or has bytes left over once the payload is read
+		template <typename Payload>
+		bool decode_payload(message_reader& r, Payload& payload)
+		{
+			static_assert(has_schema<Payload>::value, "Payload has no schema<> specialisation");
+			return value_codec<Payload>::read(r, payload) && r.remaining() == 0;
+		}
+
+		// replaces the message with the payload bound to nID
+		template <auto nID>
+		void encode(message<decltype(nID)>& msg, const payload_t<nID>& payload)
+		{
+			msg.header.id = nID;
+			msg.body.clear();
+			encode_payload(msg, payload);
+		}
+
+		template <auto nID>
+		message<decltype(nID)> make_message(const payload_t<nID>& payload)
+		{
+			message<decltype(nID)> msg;
+			encode<nID>(msg, payload);
+			return msg;
+		}
+
+		// false if the message carries a different id or its body does not decode
+		template <auto nID>
+		bool decode(const message<decltype(nID)>& msg, payload_t<nID>& payload)
+		{
+			if (msg.header.id != nID)
+				return false;
+
+			message_reader r(msg);
+			return decode_payload(r, payload);
+		}
+	}
+}
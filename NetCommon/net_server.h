@@ -3,7 +3,12 @@
 #include "net_common.h"
 #include "net_connection.h"
 #include "net_tsqueue.h"
+#include "net_mpscqueue.h"
 #include "net_message.h"
+#include "net_registry.h"
+#include "net_snapshot.h"
+#include "net_shard.h"
+#include "net_executor.h"
 
 namespace olc
 {
@@ -12,16 +17,33 @@ namespace olc
 		template <typename T>
 		class server_interface
 		{
+			friend class server_shard<T>;
+
 		public:
-			server_interface(uint16_t port)
-				: m_asioAcceptor(m_asioContext, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
+			// nIOThreads is the size of the io context pool, each context is run by a thread
+			// of its own and every connection is pinned to exactly one of them. options apply
+			// to the listening socket and every connection, see socket_options
+			server_interface(uint16_t port, size_t nIOThreads = 1, const socket_options& options = socket_options())
+				: m_asioContext(1), m_asioAcceptor(m_asioContext), m_sockopts(options)
 			{
+				open_acceptor(m_asioAcceptor, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port), m_sockopts);
 
+				// the main context also carries connections, so only the remainder is created here
+				for (size_t i = 1; i < nIOThreads; i++)
+					m_vIOContexts.push_back(std::make_unique<asio::io_context>(1));
 			}
 
 			virtual ~server_interface()
 			{
 				Stop();
+
+				// connections hold sockets bound to the contexts, so they have to go first
+				m_vShards.clear();
+				m_pExecutor.reset();
+				m_qMessagesIn.clear();
+				m_vMessageBatch.clear();
+				m_connections.clear();
+				m_qNewConnections.clear();
 			}
 
 			bool Start()
@@ -30,16 +52,31 @@ namespace olc
 				{
 					// order is important so the thread doesn't die
 					WaitForClientConnection();
+					if (m_pUdpSocket)
+						ReadDatagram();
 
 					m_threadContext = std::thread([this]() {m_asioContext.run(); });
+
+					// pool contexts have no work until a connection lands on them, so they are
+					// kept alive by a work guard rather than returning from run() straight away
+					for (auto& context : m_vIOContexts)
+					{
+						m_vIOWorkGuards.push_back(asio::make_work_guard(*context));
+						m_vIOThreads.emplace_back([&context]() { context->run(); });
+					}
+
+					// shard i is kept on core i, wrapping round when there are more shards than cores
+					size_t nCores = std::max(size_t(1), size_t(std::thread::hardware_concurrency()));
+					for (auto& shard : m_vShards)
+						shard->Start(m_bPinShards, shard->Index() % nCores);
 				}
 				catch (std::exception& e)
 				{
-					std::cerr << "[SERVER] Exception: " << e.what() << std::endl;
+					OLC_NET_LOG(error, "[SERVER] Exception: {}", e.what());
 					return false;
 				}
 
-				std::cout << "[SERVER] started!" << std::endl;
+				OLC_NET_LOG(info, "[SERVER] started!");
 				return true;
 			}
 
@@ -47,43 +84,86 @@ namespace olc
 			{
 				m_asioContext.stop();
 
+				for (auto& context : m_vIOContexts)
+					context->stop();
+
 				if (m_threadContext.joinable())
 					m_threadContext.join();
 
-				std::cout << "[SERVER] stopped!" << std::endl;
+				for (auto& thread : m_vIOThreads)
+					if (thread.joinable())
+						thread.join();
+
+				m_vIOThreads.clear();
+				m_vIOWorkGuards.clear();
+
+				// nothing new can reach the shards once the io threads are gone
+				for (auto& shard : m_vShards)
+					shard->Stop();
+
+				if (m_pExecutor)
+					m_pExecutor->Stop();
+
+				OLC_NET_LOG(info, "[SERVER] stopped!");
 			}
 
 			// async - instructs asio to wait for connection
 			void WaitForClientConnection()
 			{
-				m_asioAcceptor.async_accept(
-					[this](std::error_code ec, asio::ip::tcp::socket socket) 
+				// the socket is accepted straight onto the context that will own the connection
+				asio::io_context& context = NextIOContext();
+
+				m_asioAcceptor.async_accept(context,
+					[this, &context](std::error_code ec, asio::ip::tcp::socket socket) 
 					{
 						if (!ec)
 						{
-							std::cout << "[SERVER] New connection: " << socket.remote_endpoint() << std::endl;
+							OLC_NET_LOG(info, "[SERVER] New connection: {}", socket.remote_endpoint());
 
 							std::shared_ptr<connection<T>> newconn =
 								std::make_shared<connection<T>>(connection<T>::owner::server, 
-									m_asioContext, std::move(socket), m_qMessagesIn);
+									context, std::move(socket), m_qMessagesIn);
+
+							// server wide limits first, so OnClientConnect can still tailor them
+							newconn->SetSocketOptions(m_sockopts);
+							newconn->SetBackpressure(m_backpressure);
+							newconn->SetCompression(m_nCompressThreshold);
+							newconn->SetMaxBodySize(m_nMaxBodyBytes);
+							if (m_link)
+								newconn->SetLinkConditions(*m_link);
+							if (m_pUdpSocket)
+								newconn->EnableUdp(m_pUdpSocket, m_udpOptions);
 
 							// chance to deny the connection
 							if (OnClientConnect(newconn))
 							{
-								// connection allowed
-								m_deqConnections.push_back(std::move(newconn));
-								m_deqConnections.back()->ConnectToClient(this, nIDCounter++);
-
-								std::cout << "[" << m_deqConnections.back()->GetID() << "] Connection approved" << std::endl;
+								// connection allowed, the logic thread picks it up into the registry
+								newconn->ConnectToClient(this, nIDCounter++);
+								OLC_NET_LOG(info, "[{}] Connection approved", newconn->GetID());
+								m_metrics.nAccepted++;
+
+								if (m_vShards.empty())
+								{
+									m_qNewConnections.push_back(std::move(newconn));
+								}
+								else
+								{
+									// the switch is posted ahead of anything the handshake can deliver
+									server_shard<T>& shard = *m_vShards[OnAssignShard(newconn) % m_vShards.size()];
+									newconn->SetIncomingQueue(shard.Incoming());
+									shard.AddClient(std::move(newconn));
+								}
 							}
 							else
 							{
-								std::cout << "[SERVER] Connection denied." << std::endl;
+								OLC_NET_LOG(info, "[SERVER] Connection denied.");
+								m_metrics.nDenied++;
 							}
 						}
 						else
 						{
-							std::cout << "[SERVER] New connection error: " << ec.message() << std::endl;
+							OLC_NET_LOG(warn, "[SERVER] New connection error: {}", ec);
+							m_metrics.nAcceptErrors++;
 						}
 
 						// prime the asio context with more work - simply wait for another connection
@@ -92,63 +172,431 @@ namespace olc
 				);
 			}
 
+			// outbound queue limits given to every connection accepted from now on, set before Start
+			void SetBackpressure(const backpressure_limits& limits)
+			{
+				m_backpressure = limits;
+			}
+
+			// the largest body accepted from every client accepted from now on, a client sending a
+			// bigger one is disconnected. See connection::SetMaxBodySize
+			void SetMaxBodySize(uint32_t nBytes)
+			{
+				m_nMaxBodyBytes = nBytes;
+			}
+
+			// offers compression of bodies of at least nThreshold bytes to every client accepted from
+			// now on, 0 turns it off. Used with clients that offer it too, see connection::SetCompression
+			void SetCompression(uint32_t nThreshold)
+			{
+				m_nCompressThreshold = nThreshold;
+			}
+
+			// simulates a network on everything sent to clients accepted from now on, for testing
+			void SetLinkConditions(const link_conditions& conditions)
+			{
+				m_link = conditions;
+			}
+
+			// offers udp to clients accepted from now on, on a datagram socket with the same port
+			// number as the listening one. Call before Start, false if the port cannot be bound
+			bool EnableUdp(const udp_options<T>& options)
+			{
+				try
+				{
+					uint16_t nPort = m_asioAcceptor.local_endpoint().port();
+					m_pUdpSocket = std::make_shared<udp_socket>(m_asioContext, asio::ip::udp::endpoint(asio::ip::udp::v4(), nPort));
+					apply_socket_options(m_pUdpSocket->Socket(), m_sockopts);
+				}
+				catch (std::exception& e)
+				{
+					OLC_NET_LOG(error, "[SERVER] UDP Exception: {}", e.what());
+					return false;
+				}
+
+				m_udpOptions = options;
+				return true;
+			}
+
+			// Hands the messages Update takes to OnMessage on a pool of nThreads workers, so a slow
+			// handler only holds up its own client. OnMessageBatch is then never called. A client's
+			// messages are still handled in order and one at a time, but different clients' run in
+			// parallel, so OnMessage should reply with client->Send rather than the registry bound
+			// Message* calls. After Stop, Update passes what is left to OnMessage on its own thread.
+			// Once nMaxHeld messages are waiting on the workers Update takes no more, they stay in
+			// the incoming queue and a flooding client is held back as it would be without
+			void EnableExecutor(size_t nThreads, size_t nMaxHeld = 4096)
+			{
+				m_pExecutor = std::make_unique<message_executor<T>>(nThreads,
+					[this](std::shared_ptr<connection<T>> client, message<T>& msg) { OnMessage(client, msg); }, nMaxHeld);
+			}
+
+			// Splits clients across nShards logic threads, each with its own incoming queue and
+			// registry, optionally kept to a core of its own. OnAssignShard picks a new client's
+			// shard, its messages then go to OnShardMessage on that shard's thread rather than
+			// through Update. Call before Start, the Update registry and snapshots are not used
+			void EnableShards(size_t nShards, bool bPinThreads = false)
+			{
+				m_vShards.clear();
+				for (size_t i = 0; i < nShards; i++)
+					m_vShards.push_back(std::make_unique<server_shard<T>>(*this, i));
+				m_bPinShards = bPinThreads;
+			}
+
+			size_t ShardCount() const
+			{
+				return m_vShards.size();
+			}
+
+			server_shard<T>& Shard(size_t nShard)
+			{
+				return *m_vShards[nShard];
+			}
+
+			// any thread - sends msg to shard nShard's OnShardMail, from nNoShard
+			void PostToShard(size_t nShard, message<T> msg)
+			{
+				m_vShards[nShard]->Mail({ shard_mail<T>::kind::user, nNoShard, nullptr, std::move(msg) });
+			}
+
+			// Turns on delta snapshots. Each client acknowledges the snapshots it decodes with a
+			// message of id idAck, which Update consumes rather than passing on. nHistory is how
+			// many ticks a client may fall behind before it is sent the full state again
+			void EnableSnapshots(T idAck, size_t nHistory = 32)
+			{
+				m_idSnapshotAck = idAck;
+				m_snapshots = snapshot_encoder<T>(nHistory);
+			}
+
+			// sends msgState to every client as a delta against the last snapshot it acknowledged,
+			// see EnableSnapshots. Clients decode it with client_interface::ReadSnapshot
+			void MessageAllClientsSnapshot(const message<T>& msgState, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
+			{
+				m_snapshots.Push(msgState);
+				AdoptNewConnections();
+
+				size_t nClient = 0;
+				while (nClient < m_connections.size())
+				{
+					std::shared_ptr<connection<T>>& client = m_connections.at(nClient);
+					if (client->IsConnected())
+					{
+						if (client != pIgnoreClient)
+							client->Send(m_snapshots.Encode(client->GetSnapshotAcked()));
+						nClient++;
+					}
+					else
+					{
+						RemoveClient(std::shared_ptr<connection<T>>(client));
+					}
+				}
+			}
+
+			// send message to the client with the given id, false if no such client is connected
+			bool MessageClient(uint32_t nClientID, const message<T>& msg)
+			{
+				return MessageClient(nClientID, message<T>(msg));
+			}
+
+			bool MessageClient(uint32_t nClientID, message<T>&& msg)
+			{
+				std::shared_ptr<connection<T>> client = GetClient(nClientID);
+				if (!client)
+					return false;
+
+				MessageClient(std::move(client), std::move(msg));
+				return true;
+			}
+
+			// nullptr if there is no client with the given id
+			std::shared_ptr<connection<T>> GetClient(uint32_t nClientID)
+			{
+				AdoptNewConnections();
+
+				std::shared_ptr<connection<T>>* pClient = m_connections.find(nClientID);
+				return pClient ? *pClient : nullptr;
+			}
+
 			// send message to a specific client 
 			void MessageClient(std::shared_ptr<connection<T>> client, const message<T>& msg)
+			{
+				MessageClient(std::move(client), message<T>(msg));
+			}
+
+			// as above, but the message is moved all the way into the connection's queue
+			void MessageClient(std::shared_ptr<connection<T>> client, message<T>&& msg)
 			{
 				if (client && client->IsConnected())
 				{
-					client->Send(msg);
+					client->Send(std::move(msg));
 				}
-				else
+				else if (client)
 				{
-					OnClientDisconnect(client);
-					client.reset();
-					m_deqConnections.erase(
-						std::remove(m_deqConnections.begin(), m_deqConnections.end(), client), m_deqConnections.end());
+					RemoveClient(client);
 				}
 			}
 
-			// send message to all clients
+			// send message to all clients, the body is copied once and shared by every connection
 			void MessageAllClients(const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
 			{
-				bool bInvalidClientExists = false;
-				for (auto& client : m_deqConnections)
+				MessageAllClients(make_shared_message(msg), std::move(pIgnoreClient));
+			}
+
+			void MessageAllClients(message<T>&& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
+			{
+				MessageAllClients(make_shared_message(std::move(msg)), std::move(pIgnoreClient));
+			}
+
+			void MessageAllClients(shared_message<T> pMsg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
+			{
+				AdoptNewConnections();
+
+				size_t nClient = 0;
+				while (nClient < m_connections.size())
 				{
-					if (client && client->IsConnected())
+					std::shared_ptr<connection<T>>& client = m_connections.at(nClient);
+					if (client->IsConnected())
 					{
 						if (client != pIgnoreClient)
-							client->Send(msg);
+							client->Send(pMsg);
+						nClient++;
 					}
 					else
 					{
-						OnClientDisconnect(client);
-						client.reset();
-						bInvalidClientExists = true;
+						// the last client is swapped into this position, so it is visited next
+						RemoveClient(std::shared_ptr<connection<T>>(client));
 					}
 				}
-
-				if (bInvalidClientExists)
-					m_deqConnections.erase(
-						std::remove(m_deqConnections.begin(), m_deqConnections.end(), nullptr), m_deqConnections.end());
 			}
 
 			// size_t is unsigned therefore -1 is the maximum number
 			// size is able to be specified in order to be able to return from update when many messages are present
 			void Update(size_t nMaxMessages = -1, bool bWait = false)
 			{
+				// a full executor takes nothing until its workers catch up, see EnableExecutor
+				if (m_pExecutor)
+				{
+					if (bWait) m_pExecutor->WaitForRoom();
+					nMaxMessages = std::min(nMaxMessages, m_pExecutor->Room());
+				}
+
 				if (bWait) m_qMessagesIn.wait();
 
-				size_t nMessageCount = 0;
-				while (nMessageCount < nMaxMessages && !m_qMessagesIn.empty())
+				AdoptNewConnections();
+
+				// take everything pending in one pass, then hand it over as a single batch
+				m_vMessageBatch.clear();
+				if (m_qMessagesIn.drain(m_vMessageBatch, nMaxMessages) > 0)
 				{
-					// grab the front message, it gets erased from the queue
-					auto msg = m_qMessagesIn.pop_front();
+					if (m_idSnapshotAck)
+						TakeSnapshotAcks();
+
+					// the executor bypasses OnMessageBatch, see EnableExecutor
+					if (m_pExecutor)
+						m_pExecutor->Dispatch(m_vMessageBatch);
+					else if (!m_vMessageBatch.empty())
+						OnMessageBatch(m_vMessageBatch);
+				}
 
-					// pass the message
-					OnMessage(msg.remote, msg.msg);
+				// release the remote connections now rather than holding them until the next update
+				m_vMessageBatch.clear();
+			}
+
+			// as above, but waits at most tTimeout for a message, e.g. until the next tick is due
+			void Update(size_t nMaxMessages, std::chrono::steady_clock::duration tTimeout)
+			{
+				auto tDeadline = std::chrono::steady_clock::now() + tTimeout;
+				if (!m_pExecutor || m_pExecutor->WaitForRoom(tDeadline))
+					m_qMessagesIn.wait_until(tDeadline);
+				Update(nMaxMessages, false);
+			}
+
+			// server wide counters, connections update the handshake failures themselves
+			server_metrics& Metrics()
+			{
+				return m_metrics;
+			}
+
+			// snapshot of the whole server, call from the thread that calls Update
+			server_stats GetStats()
+			{
+				AdoptNewConnections();
+
+				server_stats stats;
+				{
+					std::scoped_lock lock(m_muxRetired);
+					stats.traffic = m_retiredTraffic;
+				}
+				for (auto& client : m_connections)
+					stats.traffic += client->GetStats();
 
-					nMessageCount++;
+				stats.nConnections = m_connections.size();
+				stats.nIncomingQueueDepth = m_qMessagesIn.count();
+				for (auto& shard : m_vShards)
+				{
+					stats.nConnections += shard->ClientCount();
+					stats.nIncomingQueueDepth += shard->IncomingQueueDepth();
 				}
+				stats.nAccepted = m_metrics.nAccepted.load(std::memory_order_relaxed);
+				stats.nDenied = m_metrics.nDenied.load(std::memory_order_relaxed);
+				stats.nAcceptErrors = m_metrics.nAcceptErrors.load(std::memory_order_relaxed);
+				stats.nHandshakeFailures = m_metrics.nHandshakeFailures.load(std::memory_order_relaxed);
+
+				auto tNow = std::chrono::steady_clock::now();
+				double dElapsed = std::chrono::duration<double>(tNow - m_tLastStats).count();
+				if (dElapsed > 0.0)
+					stats.dAcceptRate = double(stats.nAccepted - m_nLastStatsAccepted) / dElapsed;
+				m_tLastStats = tNow;
+				m_nLastStatsAccepted = stats.nAccepted;
+
+				return stats;
+			}
+
+			// snapshot of every live connection, call from the thread that calls Update
+			std::vector<connection_stats> GetConnectionStats()
+			{
+				AdoptNewConnections();
+
+				std::vector<connection_stats> vStats;
+				for (auto& client : m_connections)
+					vStats.push_back(client->GetStats());
+				return vStats;
+			}
+
+			// Prometheus text format, written to a temporary file and renamed into place so a
+			// scraper reading sPath never sees half a dump
+			bool DumpMetrics(const std::string& sPath)
+			{
+				std::string sTemp = sPath + ".tmp";
+				{
+					std::ofstream file(sTemp, std::ios::trunc);
+					if (!file)
+						return false;
+					WritePrometheus(file, GetStats(), GetConnectionStats());
+				}
+				return std::rename(sTemp.c_str(), sPath.c_str()) == 0;
+			}
+
+			// Prometheus text format, written synchronously to an already connected socket
+			bool DumpMetrics(asio::ip::tcp::socket& socket)
+			{
+				std::ostringstream os;
+				WritePrometheus(os, GetStats(), GetConnectionStats());
+
+				std::error_code ec;
+				std::string sText = os.str();
+				asio::write(socket, asio::buffer(sText), ec);
+				return !ec;
+			}
+
+			// io thread - a validated connection that agreed to udp, its datagrams carry nKey
+			void AddUdpSession(uint64_t nKey, std::shared_ptr<connection<T>> client)
+			{
+				std::scoped_lock lock(m_muxUdpSessions);
+				m_mapUdpSessions[nKey] = client;
+			}
+
+		private:
+			// drops a dead client from the registry, keeping what it sent and received in the totals
+			void RemoveClient(std::shared_ptr<connection<T>> client)
+			{
+				AdoptNewConnections();
+				if (m_connections.erase(client->GetID()))
+					RetireClient(client);
+			}
+
+			// a client gone from the registry of Update or of a shard, whichever thread that is
+			void RetireClient(std::shared_ptr<connection<T>> client)
+			{
+				if (m_pUdpSocket)
+				{
+					std::scoped_lock lock(m_muxUdpSessions);
+					m_mapUdpSessions.erase(client->GetUdpKey());
+				}
+
+				connection_stats stats = client->GetStats();
+				stats.nOutQueueDepth = 0;
+				stats.nOutQueueBytes = 0;
+				stats.nRecvBufferBytes = 0;
+				{
+					std::scoped_lock lock(m_muxRetired);
+					m_retiredTraffic += stats;
+				}
+
+				OnClientDisconnect(client);
+			}
+
+			// move connections accepted by the io thread into the registry, which only this thread touches
+			void AdoptNewConnections()
+			{
+				if (m_qNewConnections.empty())
+					return;
+
+				std::deque<std::shared_ptr<connection<T>>> deqNew;
+				m_qNewConnections.swap_out(deqNew);
+				for (auto& client : deqNew)
+				{
+					uint32_t nID = client->GetID();
+					m_connections.insert(nID, std::move(client));
+				}
+			}
+
+			// records and removes snapshot acknowledgements, the order of everything else is kept
+			void TakeSnapshotAcks()
+			{
+				auto itEnd = std::remove_if(m_vMessageBatch.begin(), m_vMessageBatch.end(),
+					[this](owned_message<T>& msg)
+					{
+						if (msg.msg.header.id != *m_idSnapshotAck || !msg.remote)
+							return false;
+
+						message_reader r(msg.msg);
+						uint32_t nSequence = 0;
+						if (r.read(&nSequence, sizeof(nSequence)))
+							msg.remote->SetSnapshotAcked(nSequence);
+						return true;
+					});
+				m_vMessageBatch.erase(itEnd, m_vMessageBatch.end());
+			}
+
+			// async - every client's datagrams arrive on the one socket, each is passed on to the io
+			// thread of the connection its key belongs to. Anything else is ignored
+			void ReadDatagram()
+			{
+				m_pUdpSocket->Socket().async_receive_from(asio::buffer(m_vDatagramIn), m_udpSender,
+					[this](std::error_code ec, std::size_t length)
+					{
+						if (ec == asio::error::operation_aborted)
+							return;
+
+						uint64_t nKey = 0;
+						if (!ec && length >= sizeof(nKey))
+						{
+							std::memcpy(&nKey, m_vDatagramIn.data(), sizeof(nKey));
+
+							std::shared_ptr<connection<T>> client;
+							{
+								std::scoped_lock lock(m_muxUdpSessions);
+								auto it = m_mapUdpSessions.find(nKey);
+								if (it != m_mapUdpSessions.end())
+									client = it->second.lock();
+							}
+
+							if (client)
+								client->PostDatagram(m_vDatagramIn.data(), length, m_udpSender);
+						}
+
+						ReadDatagram();
+					}
+				);
+			}
+
+			// round robin over the main context and the pool, connections are long lived so an
+			// even spread of them is a good enough proxy for an even spread of load
+			asio::io_context& NextIOContext()
+			{
+				size_t nContext = m_nNextIOContext++ % (m_vIOContexts.size() + 1);
+				return nContext == 0 ? m_asioContext : *m_vIOContexts[nContext - 1];
 			}
 
 		public:
@@ -156,6 +604,12 @@ namespace olc
 			{
 			}
 
+			// called from the client's io thread when its outbound queue reaches the high watermark
+			// (bActive true) and again once it has drained back to the low one
+			virtual void OnBackpressure(std::shared_ptr<connection<T>> /*client*/, bool /*bActive*/)
+			{
+			}
+
 		protected:
 			// called when a client connects, you can veto the connection by returning false
 			virtual bool OnClientConnect(std::shared_ptr<connection<T>> client)
@@ -163,7 +617,26 @@ namespace olc
 				return false;
 			}
 
-			// called when a client appears to have disconnected
+			// io thread - the shard a newly approved client goes to when sharded, taken modulo the
+			// shard count. Return a hash of its room or zone to keep those together
+			virtual size_t OnAssignShard(std::shared_ptr<connection<T>> client)
+			{
+				return client->GetID();
+			}
+
+			// shard's thread - a message from one of its clients, in the order the client sent them.
+			// Shards run in parallel, so by default only OnMessage has to be safe for that
+			virtual void OnShardMessage(server_shard<T>& /*shard*/, std::shared_ptr<connection<T>> client, message<T>& msg)
+			{
+				OnMessage(client, msg);
+			}
+
+			// shard's thread - mail from shard nFrom, or nNoShard for PostToShard
+			virtual void OnShardMail(server_shard<T>& /*shard*/, size_t /*nFrom*/, message<T>& /*msg*/)
+			{
+			}
+
+			// called when a client appears to have disconnected, on the thread of its shard if sharded
 			virtual void OnClientDisconnect(std::shared_ptr<connection<T>> client)
 			{
 			}
@@ -173,22 +646,77 @@ namespace olc
 			{
 			}
 
+			// called once per Update with every message taken from the queue, in arrival order.
+			// override to work on a tick's inputs together, by default each one is passed to OnMessage
+			virtual void OnMessageBatch(std::vector<owned_message<T>>& vMessages)
+			{
+				for (auto& msg : vMessages)
+					OnMessage(msg.remote, msg.msg);
+			}
+
 		protected:
 			// queue for incoming packets
-			tsqueue<owned_message<T>> m_qMessagesIn;
+			mpscqueue<owned_message<T>> m_qMessagesIn;
 
-			// active validated connections
-			std::deque<std::shared_ptr<connection<T>>> m_deqConnections;
+			// messages taken from the queue by the current Update, kept to reuse its storage
+			std::vector<owned_message<T>> m_vMessageBatch;
+
+			// active connections by id, only touched from the thread calling Update and Message*
+			id_registry<std::shared_ptr<connection<T>>> m_connections;
+
+			// connections approved on the io thread, waiting to be moved into the registry
+			tsqueue<std::shared_ptr<connection<T>>> m_qNewConnections;
+
+			// the rest of the io context pool, each with a thread of its own. Declared ahead of the
+			// main context so they outlive it, a pending accept may hold a socket bound to one of them
+			std::vector<std::unique_ptr<asio::io_context>> m_vIOContexts;
 
 			// order of declaration is important - it is also the order of initialisation
 			asio::io_context m_asioContext;
 			std::thread m_threadContext;
 
+			std::vector<asio::executor_work_guard<asio::io_context::executor_type>> m_vIOWorkGuards;
+			std::vector<std::thread> m_vIOThreads;
+			size_t m_nNextIOContext = 0;
+
 			// these things need an asio context
 			asio::ip::tcp::acceptor m_asioAcceptor; // socket of the connected clients
+			socket_options m_sockopts;
 
 			// clients will be identified in the "wider system" via an ID
 			uint32_t nIDCounter = 10000;
+
+			// default outbound queue limits for new connections
+			backpressure_limits m_backpressure;
+			uint32_t m_nCompressThreshold = 0;
+			uint32_t m_nMaxBodyBytes = nDefaultMaxBodyBytes;
+			std::optional<link_conditions> m_link;
+
+			// one datagram socket for every client, and the connections it delivers to by key
+			udp_options<T> m_udpOptions;
+			std::shared_ptr<udp_socket> m_pUdpSocket;
+			std::array<uint8_t, nUdpMaxDatagram> m_vDatagramIn;
+			asio::ip::udp::endpoint m_udpSender;
+			std::mutex m_muxUdpSessions;
+			std::unordered_map<uint64_t, std::weak_ptr<connection<T>>> m_mapUdpSessions;
+
+			// state history for delta snapshots, and the id acknowledgements arrive as
+			snapshot_encoder<T> m_snapshots;
+			std::optional<T> m_idSnapshotAck;
+
+			// handler pool, none unless EnableExecutor was called
+			std::unique_ptr<message_executor<T>> m_pExecutor;
+
+			// logic shards, none unless EnableShards was called
+			std::vector<std::unique_ptr<server_shard<T>>> m_vShards;
+			bool m_bPinShards = false;
+
+			// counters for the server as a whole, plus the traffic of connections already removed
+			server_metrics m_metrics;
+			std::mutex m_muxRetired;
+			connection_stats m_retiredTraffic;
+			std::chrono::steady_clock::time_point m_tLastStats = std::chrono::steady_clock::now();
+			uint64_t m_nLastStatsAccepted = 0;
 		};
 
 	}
@@ -0,0 +1,369 @@
+#pragma once
+// net shard, one of several logic threads a server can split its clients across
+#include "net_common.h"
+#include "net_message.h"
+#include "net_tsqueue.h"
+#include "net_mpscqueue.h"
+#include "net_registry.h"
+#include "net_metrics.h"
+#include "net_connection.h"
+
+namespace olc
+{
+	namespace net
+	{
+		template <typename T>
+		class server_interface;
+
+		// what one shard hands another through its mailbox. Only user mail reaches the server's
+		// OnShardMail, the rest moves clients and their messages between shards
+		template <typename T>
+		struct shard_mail
+		{
+			enum class kind : uint8_t
+			{
+				user,		// msg from shard nFrom, or from outside any shard
+				arriving,	// client is on its way here, hold its messages until adopt
+				message,	// a message of client's that reached its old shard after it moved
+				adopt		// nothing more of client's is left at its old shard
+			};
+
+			kind type = kind::user;
+			size_t nFrom = 0;
+			std::shared_ptr<connection<T>> client;
+			message<T> msg;
+		};
+
+		// sender of mail that did not come from a shard
+		static constexpr size_t nNoShard = SIZE_MAX;
+
+		// keeps a thread on one core, false where that is not supported
+		inline bool pin_thread(std::thread& thread, size_t nCore)
+		{
+#if defined(__linux__)
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(int(nCore), &set);
+			return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+			return SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << nCore) != 0;
+#else
+			return false;
+#endif
+		}
+
+		// A shard owns some of the server's clients: their messages arrive on its queue, and its
+		// thread is the only one that hands them to the server or touches its registry. Shards
+		// share nothing, they talk through each other's mailboxes
+		template <typename T>
+		class server_shard
+		{
+		public:
+			server_shard(server_interface<T>& server, size_t nIndex)
+				: m_server(server), m_nIndex(nIndex)
+			{
+			}
+
+			~server_shard()
+			{
+				Stop();
+
+				m_qMessagesIn.clear();
+				m_connections.clear();
+				m_qNewConnections.clear();
+				m_qMail.clear();
+			}
+
+			size_t Index() const
+			{
+				return m_nIndex;
+			}
+
+			// any thread, approximate while clients are being accepted or moved
+			size_t ClientCount() const
+			{
+				return m_nClients.load(std::memory_order_relaxed);
+			}
+
+			size_t IncomingQueueDepth() const
+			{
+				return m_qMessagesIn.count();
+			}
+
+			// everything below is for this shard's thread only, i.e. from the server's OnShard* calls
+
+			// nullptr if the client is not on this shard
+			std::shared_ptr<connection<T>> GetClient(uint32_t nClientID)
+			{
+				AdoptNewConnections();
+
+				std::shared_ptr<connection<T>>* pClient = m_connections.find(nClientID);
+				return pClient ? *pClient : nullptr;
+			}
+
+			void MessageClient(std::shared_ptr<connection<T>> client, const message<T>& msg)
+			{
+				MessageClient(std::move(client), message<T>(msg));
+			}
+
+			void MessageClient(std::shared_ptr<connection<T>> client, message<T>&& msg)
+			{
+				if (client && client->IsConnected())
+					client->Send(std::move(msg));
+				else if (client)
+					RemoveClient(client);
+			}
+
+			// send message to every client of this shard, the body is shared by all of them
+			void MessageAllClients(const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
+			{
+				MessageAllClients(make_shared_message(msg), std::move(pIgnoreClient));
+			}
+
+			void MessageAllClients(shared_message<T> pMsg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
+			{
+				AdoptNewConnections();
+
+				size_t nClient = 0;
+				while (nClient < m_connections.size())
+				{
+					std::shared_ptr<connection<T>>& client = m_connections.at(nClient);
+					if (client->IsConnected())
+					{
+						if (client != pIgnoreClient)
+							client->Send(pMsg);
+						nClient++;
+					}
+					else
+					{
+						RemoveClient(std::shared_ptr<connection<T>>(client));
+					}
+				}
+			}
+
+			// sends msg to shard nShard, which gets it in OnShardMail. Mail from one shard to
+			// another arrives in the order it was posted
+			void Post(size_t nShard, message<T> msg)
+			{
+				m_server.Shard(nShard).Mail({ shard_mail<T>::kind::user, m_nIndex, nullptr, std::move(msg) });
+			}
+
+			// Hands a client of this shard to shard nShard, e.g. as it joins a room that lives
+			// there. Its messages keep their order: those already on their way here are passed on,
+			// and the new shard holds back later ones until the release marker that follows the
+			// last of them has been taken here
+			void MoveClient(std::shared_ptr<connection<T>> client, size_t nShard)
+			{
+				AdoptNewConnections();
+				if (nShard == m_nIndex || !m_connections.erase(client->GetID()))
+					return;
+
+				m_nClients.fetch_sub(1, std::memory_order_relaxed);
+				m_mapMoving[client->GetID()] = nShard;
+
+				// the new shard has to know before the first message can reach it
+				server_shard<T>& target = m_server.Shard(nShard);
+				target.Mail({ shard_mail<T>::kind::arriving, m_nIndex, client, {} });
+
+				client->SetIncomingQueue(target.m_qMessagesIn, true);
+			}
+
+		private:
+			friend class server_interface<T>;
+
+			// any thread
+			void Mail(shard_mail<T>&& mail)
+			{
+				m_qMail.push_back(std::move(mail));
+				Wake();
+			}
+
+			// io thread - an approved connection whose messages already come here
+			void AddClient(std::shared_ptr<connection<T>> client)
+			{
+				m_qNewConnections.push_back(std::move(client));
+				m_nClients.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			mpscqueue<owned_message<T>>& Incoming()
+			{
+				return m_qMessagesIn;
+			}
+
+			void Start(bool bPin, size_t nCore)
+			{
+				m_bStop = false;
+				m_thread = std::thread([this]() { Run(); });
+				if (bPin)
+					pin_thread(m_thread, nCore);
+			}
+
+			void Stop()
+			{
+				if (!m_thread.joinable())
+					return;
+
+				m_bStop = true;
+				Wake();
+				m_thread.join();
+			}
+
+			// an empty entry gets the thread out of wait, if the queue is full it is awake anyway
+			void Wake()
+			{
+				m_qMessagesIn.try_push_back({ nullptr, {} });
+			}
+
+			void Run()
+			{
+				while (true)
+				{
+					m_qMessagesIn.wait();
+					if (m_bStop)
+						return;
+
+					Update();
+				}
+			}
+
+			void Update()
+			{
+				m_vMessageBatch.clear();
+				m_qMessagesIn.drain(m_vMessageBatch);
+
+				// an arriving mail is posted before the client's first message can get here, so
+				// taking the mail after the drain finds one for every message drained
+				std::deque<shard_mail<T>> deqMail;
+				m_qMail.swap_out(deqMail);
+
+				// after the drain, a message is never taken before its connection was added
+				AdoptNewConnections();
+
+				for (auto& mail : deqMail)
+				{
+					switch (mail.type)
+					{
+					case shard_mail<T>::kind::user:
+						m_server.OnShardMail(*this, mail.nFrom, mail.msg);
+						break;
+
+					case shard_mail<T>::kind::arriving:
+						m_mapArriving[mail.client->GetID()];
+						break;
+
+					case shard_mail<T>::kind::message:
+						m_server.OnShardMessage(*this, mail.client, mail.msg);
+						break;
+
+					case shard_mail<T>::kind::adopt:
+						Adopt(mail.client);
+						break;
+					}
+				}
+
+				for (auto& msg : m_vMessageBatch)
+				{
+					if (!msg.remote)
+						continue;
+
+					uint32_t nID = msg.remote->GetID();
+					if (msg.bReleased)
+					{
+						// the io thread queued this behind the last message a moving client sent
+						// here, everything before it has been passed on so the new shard can take over
+						auto itMoving = m_mapMoving.find(nID);
+						if (itMoving != m_mapMoving.end())
+						{
+							m_server.Shard(itMoving->second).Mail({ shard_mail<T>::kind::adopt, m_nIndex, std::move(msg.remote), {} });
+							m_mapMoving.erase(itMoving);
+						}
+					}
+					else if (m_connections.find(nID))
+					{
+						m_server.OnShardMessage(*this, msg.remote, msg.msg);
+					}
+					else if (auto itMoving = m_mapMoving.find(nID); itMoving != m_mapMoving.end())
+					{
+						m_server.Shard(itMoving->second).Mail({ shard_mail<T>::kind::message, m_nIndex, std::move(msg.remote), std::move(msg.msg) });
+					}
+					else if (auto itArriving = m_mapArriving.find(nID); itArriving != m_mapArriving.end())
+					{
+						itArriving->second.push_back(std::move(msg));
+					}
+					else
+					{
+						// a client removed since it sent this, delivered as Update would
+						m_server.OnShardMessage(*this, msg.remote, msg.msg);
+					}
+				}
+
+				m_vMessageBatch.clear();
+			}
+
+			// a client that has moved here, with whatever of its messages were held back
+			void Adopt(std::shared_ptr<connection<T>> client)
+			{
+				uint32_t nID = client->GetID();
+				m_connections.insert(nID, client);
+				m_nClients.fetch_add(1, std::memory_order_relaxed);
+
+				auto itArriving = m_mapArriving.find(nID);
+				if (itArriving == m_mapArriving.end())
+					return;
+
+				std::vector<owned_message<T>> vHeld = std::move(itArriving->second);
+				m_mapArriving.erase(itArriving);
+				for (auto& msg : vHeld)
+					m_server.OnShardMessage(*this, msg.remote, msg.msg);
+			}
+
+			void AdoptNewConnections()
+			{
+				if (m_qNewConnections.empty())
+					return;
+
+				std::deque<std::shared_ptr<connection<T>>> deqNew;
+				m_qNewConnections.swap_out(deqNew);
+				for (auto& client : deqNew)
+				{
+					uint32_t nID = client->GetID();
+					m_connections.insert(nID, std::move(client));
+				}
+			}
+
+			void RemoveClient(std::shared_ptr<connection<T>> client)
+			{
+				AdoptNewConnections();
+				if (m_connections.erase(client->GetID()))
+				{
+					m_nClients.fetch_sub(1, std::memory_order_relaxed);
+					m_server.RetireClient(client);
+				}
+			}
+
+		private:
+			server_interface<T>& m_server;
+			size_t m_nIndex = 0;
+
+			// messages of this shard's clients, and of clients on their way here
+			mpscqueue<owned_message<T>> m_qMessagesIn;
+			std::vector<owned_message<T>> m_vMessageBatch;
+
+			// clients by id, only touched from this shard's thread
+			id_registry<std::shared_ptr<connection<T>>> m_connections;
+			tsqueue<std::shared_ptr<connection<T>>> m_qNewConnections;
+			std::atomic<size_t> m_nClients{ 0 };
+
+			tsqueue<shard_mail<T>> m_qMail;
+
+			// clients moving away by id, to the shard they are going to
+			std::unordered_map<uint32_t, size_t> m_mapMoving;
+
+			// clients moving here by id, with the messages that got here before they did
+			std::unordered_map<uint32_t, std::vector<owned_message<T>>> m_mapArriving;
+
+			std::thread m_thread;
+			std::atomic<bool> m_bStop{ false };
+		};
+	}
+}
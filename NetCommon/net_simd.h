@@ -0,0 +1,387 @@
+#pragma once
+// net simd, bulk kernels for array payloads with SSE2/AVX2 versions picked at runtime
+#include "net_common.h"
+#include "net_message.h"
+
+namespace olc
+{
+	namespace net
+	{
+		namespace simd
+		{
+			enum class level
+			{
+				scalar,
+				sse2,
+				avx2
+			};
+
+			inline level detect()
+			{
+#ifdef OLC_NET_X64
+#ifdef _MSC_VER
+				// AVX2 needs the cpu to have it and the OS to save the ymm registers
+				int vInfo[4];
+				__cpuid(vInfo, 0);
+				if (vInfo[0] < 7)
+					return level::sse2;
+
+				__cpuid(vInfo, 1);
+				bool bOSXSave = (vInfo[2] & (1 << 27)) != 0;
+				bool bAVX = (vInfo[2] & (1 << 28)) != 0;
+				if (!bOSXSave || !bAVX || (_xgetbv(0) & 6) != 6)
+					return level::sse2;
+
+				__cpuidex(vInfo, 7, 0);
+				return (vInfo[1] & (1 << 5)) ? level::avx2 : level::sse2;
+#else
+				return __builtin_cpu_supports("avx2") ? level::avx2 : level::sse2;
+#endif
+#else
+				return level::scalar;
+#endif
+			}
+
+			// the level every kernel dispatches on, can be lowered to compare or to rule out a path
+			inline level& active()
+			{
+				static level l = detect();
+				return l;
+			}
+
+			// message bodies give no alignment guarantee, so scalar code goes through memcpy
+			inline int16_t load16(const int16_t* p)
+			{
+				int16_t n;
+				std::memcpy(&n, p, sizeof(n));
+				return n;
+			}
+
+			inline void store16(int16_t* p, int16_t n)
+			{
+				std::memcpy(p, &n, sizeof(n));
+			}
+
+			// float to int16 at the given scale, saturating. Clamping happens before the conversion,
+			// the same way in every version, so all of them produce identical output. NaN becomes the maximum
+			inline void quantize_scalar(const float* pIn, int16_t* pOut, size_t nCount, float fScale)
+			{
+				for (size_t i = 0; i < nCount; i++)
+				{
+					float f = pIn[i] * fScale;
+					f = f < 32767.0f ? f : 32767.0f;
+					f = f > -32768.0f ? f : -32768.0f;
+					store16(pOut + i, int16_t(std::nearbyint(f)));
+				}
+			}
+
+			inline void dequantize_scalar(const int16_t* pIn, float* pOut, size_t nCount, float fScale)
+			{
+				float fInverse = 1.0f / fScale;
+				for (size_t i = 0; i < nCount; i++)
+					pOut[i] = float(load16(pIn + i)) * fInverse;
+			}
+
+			// pValues is replaced by its difference from pBaseline, pBaseline by the values
+			inline void delta_encode_scalar(int16_t* pValues, int16_t* pBaseline, size_t nCount)
+			{
+				for (size_t i = 0; i < nCount; i++)
+				{
+					int16_t nValue = load16(pValues + i);
+					store16(pValues + i, int16_t(uint16_t(nValue) - uint16_t(load16(pBaseline + i))));
+					store16(pBaseline + i, nValue);
+				}
+			}
+
+			// pDeltas is replaced by the values they encode, pBaseline is moved on to them as well
+			inline void delta_decode_scalar(int16_t* pDeltas, int16_t* pBaseline, size_t nCount)
+			{
+				for (size_t i = 0; i < nCount; i++)
+				{
+					int16_t nValue = int16_t(uint16_t(load16(pDeltas + i)) + uint16_t(load16(pBaseline + i)));
+					store16(pDeltas + i, nValue);
+					store16(pBaseline + i, nValue);
+				}
+			}
+
+			inline void xor_scalar(uint8_t* pData, const uint8_t* pOther, size_t nCount)
+			{
+				for (size_t i = 0; i < nCount; i++)
+					pData[i] ^= pOther[i];
+			}
+
+#ifdef OLC_NET_X64
+			inline void quantize_sse2(const float* pIn, int16_t* pOut, size_t nCount, float fScale)
+			{
+				const __m128 vScale = _mm_set1_ps(fScale);
+				const __m128 vHi = _mm_set1_ps(32767.0f);
+				const __m128 vLo = _mm_set1_ps(-32768.0f);
+
+				size_t i = 0;
+				for (; i + 8 <= nCount; i += 8)
+				{
+					__m128 a = _mm_mul_ps(_mm_loadu_ps(pIn + i), vScale);
+					__m128 b = _mm_mul_ps(_mm_loadu_ps(pIn + i + 4), vScale);
+					a = _mm_max_ps(_mm_min_ps(a, vHi), vLo);
+					b = _mm_max_ps(_mm_min_ps(b, vHi), vLo);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+				}
+				quantize_scalar(pIn + i, pOut + i, nCount - i, fScale);
+			}
+
+			inline void dequantize_sse2(const int16_t* pIn, float* pOut, size_t nCount, float fScale)
+			{
+				const __m128 vInverse = _mm_set1_ps(1.0f / fScale);
+
+				size_t i = 0;
+				for (; i + 8 <= nCount; i += 8)
+				{
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pIn + i));
+					__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+					__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+					_mm_storeu_ps(pOut + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vInverse));
+					_mm_storeu_ps(pOut + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vInverse));
+				}
+				dequantize_scalar(pIn + i, pOut + i, nCount - i, fScale);
+			}
+
+			inline void delta_encode_sse2(int16_t* pValues, int16_t* pBaseline, size_t nCount)
+			{
+				size_t i = 0;
+				for (; i + 8 <= nCount; i += 8)
+				{
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pValues + i));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBaseline + i));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(pValues + i), _mm_sub_epi16(v, b));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(pBaseline + i), v);
+				}
+				delta_encode_scalar(pValues + i, pBaseline + i, nCount - i);
+			}
+
+			inline void delta_decode_sse2(int16_t* pDeltas, int16_t* pBaseline, size_t nCount)
+			{
+				size_t i = 0;
+				for (; i + 8 <= nCount; i += 8)
+				{
+					__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pDeltas + i));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBaseline + i));
+					__m128i v = _mm_add_epi16(d, b);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(pDeltas + i), v);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(pBaseline + i), v);
+				}
+				delta_decode_scalar(pDeltas + i, pBaseline + i, nCount - i);
+			}
+
+			inline void xor_sse2(uint8_t* pData, const uint8_t* pOther, size_t nCount)
+			{
+				size_t i = 0;
+				for (; i + 16 <= nCount; i += 16)
+				{
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + i));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pOther + i));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(pData + i), _mm_xor_si128(a, b));
+				}
+				xor_scalar(pData + i, pOther + i, nCount - i);
+			}
+
+			OLC_NET_TARGET_AVX2 inline void quantize_avx2(const float* pIn, int16_t* pOut, size_t nCount, float fScale)
+			{
+				const __m256 vScale = _mm256_set1_ps(fScale);
+				const __m256 vHi = _mm256_set1_ps(32767.0f);
+				const __m256 vLo = _mm256_set1_ps(-32768.0f);
+
+				size_t i = 0;
+				for (; i + 16 <= nCount; i += 16)
+				{
+					__m256 a = _mm256_mul_ps(_mm256_loadu_ps(pIn + i), vScale);
+					__m256 b = _mm256_mul_ps(_mm256_loadu_ps(pIn + i + 8), vScale);
+					a = _mm256_max_ps(_mm256_min_ps(a, vHi), vLo);
+					b = _mm256_max_ps(_mm256_min_ps(b, vHi), vLo);
+
+					// packs works within each 128 bit lane, the permute puts the halves back in order
+					__m256i v = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(pOut + i), _mm256_permute4x64_epi64(v, 0xD8));
+				}
+				quantize_sse2(pIn + i, pOut + i, nCount - i, fScale);
+			}
+
+			OLC_NET_TARGET_AVX2 inline void dequantize_avx2(const int16_t* pIn, float* pOut, size_t nCount, float fScale)
+			{
+				const __m256 vInverse = _mm256_set1_ps(1.0f / fScale);
+
+				size_t i = 0;
+				for (; i + 8 <= nCount; i += 8)
+				{
+					__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pIn + i)));
+					_mm256_storeu_ps(pOut + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), vInverse));
+				}
+				dequantize_sse2(pIn + i, pOut + i, nCount - i, fScale);
+			}
+
+			OLC_NET_TARGET_AVX2 inline void delta_encode_avx2(int16_t* pValues, int16_t* pBaseline, size_t nCount)
+			{
+				size_t i = 0;
+				for (; i + 16 <= nCount; i += 16)
+				{
+					__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pValues + i));
+					__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pBaseline + i));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(pValues + i), _mm256_sub_epi16(v, b));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(pBaseline + i), v);
+				}
+				delta_encode_sse2(pValues + i, pBaseline + i, nCount - i);
+			}
+
+			OLC_NET_TARGET_AVX2 inline void delta_decode_avx2(int16_t* pDeltas, int16_t* pBaseline, size_t nCount)
+			{
+				size_t i = 0;
+				for (; i + 16 <= nCount; i += 16)
+				{
+					__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pDeltas + i));
+					__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pBaseline + i));
+					__m256i v = _mm256_add_epi16(d, b);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(pDeltas + i), v);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(pBaseline + i), v);
+				}
+				delta_decode_sse2(pDeltas + i, pBaseline + i, nCount - i);
+			}
+
+			OLC_NET_TARGET_AVX2 inline void xor_avx2(uint8_t* pData, const uint8_t* pOther, size_t nCount)
+			{
+				size_t i = 0;
+				for (; i + 32 <= nCount; i += 32)
+				{
+					__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pData + i));
+					__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pOther + i));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(pData + i), _mm256_xor_si256(a, b));
+				}
+				xor_sse2(pData + i, pOther + i, nCount - i);
+			}
+#endif
+
+			inline void quantize(const float* pIn, int16_t* pOut, size_t nCount, float fScale)
+			{
+#ifdef OLC_NET_X64
+				if (active() == level::avx2) return quantize_avx2(pIn, pOut, nCount, fScale);
+				if (active() == level::sse2) return quantize_sse2(pIn, pOut, nCount, fScale);
+#endif
+				quantize_scalar(pIn, pOut, nCount, fScale);
+			}
+
+			inline void dequantize(const int16_t* pIn, float* pOut, size_t nCount, float fScale)
+			{
+#ifdef OLC_NET_X64
+				if (active() == level::avx2) return dequantize_avx2(pIn, pOut, nCount, fScale);
+				if (active() == level::sse2) return dequantize_sse2(pIn, pOut, nCount, fScale);
+#endif
+				dequantize_scalar(pIn, pOut, nCount, fScale);
+			}
+
+			inline void delta_encode(int16_t* pValues, int16_t* pBaseline, size_t nCount)
+			{
+#ifdef OLC_NET_X64
+				if (active() == level::avx2) return delta_encode_avx2(pValues, pBaseline, nCount);
+				if (active() == level::sse2) return delta_encode_sse2(pValues, pBaseline, nCount);
+#endif
+				delta_encode_scalar(pValues, pBaseline, nCount);
+			}
+
+			inline void delta_decode(int16_t* pDeltas, int16_t* pBaseline, size_t nCount)
+			{
+#ifdef OLC_NET_X64
+				if (active() == level::avx2) return delta_decode_avx2(pDeltas, pBaseline, nCount);
+				if (active() == level::sse2) return delta_decode_sse2(pDeltas, pBaseline, nCount);
+#endif
+				delta_decode_scalar(pDeltas, pBaseline, nCount);
+			}
+
+			inline void xor_bytes(uint8_t* pData, const uint8_t* pOther, size_t nCount)
+			{
+#ifdef OLC_NET_X64
+				if (active() == level::avx2) return xor_avx2(pData, pOther, nCount);
+				if (active() == level::sse2) return xor_sse2(pData, pOther, nCount);
+#endif
+				xor_scalar(pData, pOther, nCount);
+			}
+		}
+
+		// The push/pop pairs below follow operator << and >>: the values go in, then their count,
+		// so they come back out last in first out along with everything else in the body.
+
+		// pushes nCount floats as int16 steps of 1/fScale
+		template <typename T>
+		void push_quantized(message<T>& msg, const float* pValues, size_t nCount, float fScale)
+		{
+			size_t i = msg.body.size();
+			msg.body.resize(i + nCount * sizeof(int16_t));
+			simd::quantize(pValues, reinterpret_cast<int16_t*>(msg.body.data() + i), nCount, fScale);
+			msg << uint32_t(nCount);
+		}
+
+		// false, leaving the body as it was, if it holds fewer values than its count claims
+		template <typename T>
+		bool pop_quantized(message<T>& msg, std::vector<float>& vValues, float fScale)
+		{
+			uint32_t nCount = 0;
+			if (msg.body.size() < sizeof(nCount))
+				return false;
+			std::memcpy(&nCount, msg.body.data() + msg.body.size() - sizeof(nCount), sizeof(nCount));
+
+			size_t nBytes = size_t(nCount) * sizeof(int16_t);
+			if (msg.body.size() - sizeof(nCount) < nBytes)
+				return false;
+
+			size_t i = msg.body.size() - sizeof(nCount) - nBytes;
+			vValues.resize(nCount);
+			simd::dequantize(reinterpret_cast<const int16_t*>(msg.body.data() + i), vValues.data(), nCount, fScale);
+			msg.body.resize(i);
+			msg.header.size = uint32_t(msg.body.size());
+			return true;
+		}
+
+		// As push_quantized, but each value goes as its difference from the same slot in the
+		// previous snapshot, which is mostly zeros for a world that barely moved and leaves the
+		// body far more compressible. vBaseline is that previous snapshot in quantized form,
+		// kept by the caller and moved on to this one. A baseline of another length is reset to
+		// zeros, as the receiving side's will be, so a change in entity count resyncs both ends
+		template <typename T>
+		void push_quantized_delta(message<T>& msg, const float* pValues, size_t nCount, float fScale, std::vector<int16_t>& vBaseline)
+		{
+			if (vBaseline.size() != nCount)
+				vBaseline.assign(nCount, 0);
+
+			size_t i = msg.body.size();
+			msg.body.resize(i + nCount * sizeof(int16_t));
+			int16_t* pOut = reinterpret_cast<int16_t*>(msg.body.data() + i);
+			simd::quantize(pValues, pOut, nCount, fScale);
+			simd::delta_encode(pOut, vBaseline.data(), nCount);
+			msg << uint32_t(nCount);
+		}
+
+		// the baseline must have followed every snapshot the sender encoded against it
+		template <typename T>
+		bool pop_quantized_delta(message<T>& msg, std::vector<float>& vValues, float fScale, std::vector<int16_t>& vBaseline)
+		{
+			uint32_t nCount = 0;
+			if (msg.body.size() < sizeof(nCount))
+				return false;
+			std::memcpy(&nCount, msg.body.data() + msg.body.size() - sizeof(nCount), sizeof(nCount));
+
+			size_t nBytes = size_t(nCount) * sizeof(int16_t);
+			if (msg.body.size() - sizeof(nCount) < nBytes)
+				return false;
+
+			if (vBaseline.size() != nCount)
+				vBaseline.assign(nCount, 0);
+
+			size_t i = msg.body.size() - sizeof(nCount) - nBytes;
+			int16_t* pDeltas = reinterpret_cast<int16_t*>(msg.body.data() + i);
+			simd::delta_decode(pDeltas, vBaseline.data(), nCount);
+
+			vValues.resize(nCount);
+			simd::dequantize(pDeltas, vValues.data(), nCount, fScale);
+			msg.body.resize(i);
+			msg.header.size = uint32_t(msg.body.size());
+			return true;
+		}
+	}
+}
@@ -0,0 +1,261 @@
+#pragma once
+// net snapshot, repeated state messages sent as deltas against what the receiver already holds
+#include "net_common.h"
+#include "net_message.h"
+#include "net_schema.h"
+#include "net_simd.h"
+
+namespace olc
+{
+	namespace net
+	{
+		// A snapshot body, front to back: sequence, baseline sequence, size of the full state, then
+		// the state itself when the baseline is 0, otherwise the state xored with the baseline
+		// and run length coded as [varint zeros][varint literal bytes][literal bytes]... so the
+		// parts that did not change cost next to nothing. Sequences start at 1.
+		struct snapshot_header
+		{
+			uint32_t nSequence = 0;
+			uint32_t nBaseline = 0;
+			uint32_t nSize = 0;
+		};
+
+		// a run of zeros shorter than this is cheaper to carry inside a literal than to break it
+		static constexpr size_t nSnapshotMinZeroRun = 4;
+
+		// largest state sent as a delta. A delta's size costs only a few bytes to claim, so the
+		// receiver refuses more than this rather than allocating whatever it is told. A full
+		// state has to arrive with all of its bytes and is not limited
+		static constexpr size_t nSnapshotMaxDeltaBytes = 16 * 1024 * 1024;
+
+		inline size_t zero_run(const uint8_t* p, size_t nCount)
+		{
+			size_t i = 0;
+			uint64_t nWord;
+			while (i + sizeof(nWord) <= nCount)
+			{
+				std::memcpy(&nWord, p + i, sizeof(nWord));
+				if (nWord != 0)
+					break;
+				i += sizeof(nWord);
+			}
+			while (i < nCount && p[i] == 0)
+				i++;
+			return i;
+		}
+
+		inline void rle_encode(const uint8_t* p, size_t nCount, std::vector<uint8_t>& vOut)
+		{
+			// worst case is a byte of change between every short gap, three bytes out for two in
+			vOut.resize(nCount * 2 + 32);
+			uint8_t* pOut = vOut.data();
+
+			size_t i = 0;
+			while (i < nCount)
+			{
+				size_t nZeros = zero_run(p + i, nCount - i);
+				i += nZeros;
+
+				size_t nStart = i;
+				while (i < nCount)
+				{
+					if (p[i] == 0 && zero_run(p + i, std::min(nSnapshotMinZeroRun, nCount - i)) == std::min(nSnapshotMinZeroRun, nCount - i))
+						break;
+					i++;
+				}
+
+				write_varint(pOut, nZeros);
+				write_varint(pOut, i - nStart);
+				std::memcpy(pOut, p + nStart, i - nStart);
+				pOut += i - nStart;
+			}
+
+			vOut.resize(pOut - vOut.data());
+		}
+
+		// xors the runs into pState, which holds the baseline padded or cut to nCount bytes
+		inline bool rle_apply(message_reader& r, uint8_t* pState, size_t nCount)
+		{
+			size_t i = 0;
+			while (i < nCount)
+			{
+				uint64_t nZeros, nLiteral;
+				if (!read_varint(r, nZeros) || !read_varint(r, nLiteral))
+					return false;
+				if (nZeros > nCount - i || nLiteral > nCount - i - nZeros)
+					return false;
+
+				i += size_t(nZeros);
+				const uint8_t* pLiteral = r.take(size_t(nLiteral));
+				if (pLiteral == nullptr)
+					return false;
+
+				simd::xor_bytes(pState + i, pLiteral, size_t(nLiteral));
+				i += size_t(nLiteral);
+			}
+			return r.remaining() == 0;
+		}
+
+		// copy of a snapshot's state kept so later ones can be sent against it
+		struct snapshot_entry
+		{
+			uint32_t nSequence = 0;
+			std::vector<uint8_t> vState;
+		};
+
+		// Sending side. Keeps the last nHistory snapshots, a receiver that has acknowledged one of
+		// them is sent a delta against it, anyone further behind gets the full state again
+		template <typename T>
+		class snapshot_encoder
+		{
+		public:
+			explicit snapshot_encoder(size_t nHistory = 32) : m_vHistory(std::max<size_t>(nHistory, 1))
+			{}
+
+			// makes msgState the current snapshot, returns its sequence
+			uint32_t Push(const message<T>& msgState)
+			{
+				if (++m_nSequence == 0)
+					m_nSequence = 1;
+
+				snapshot_entry& entry = m_vHistory[m_nSequence % m_vHistory.size()];
+				entry.nSequence = m_nSequence;
+				entry.vState.assign(msgState.body.begin(), msgState.body.end());
+
+				m_id = msgState.header.id;
+				m_vEncoded.clear();
+				return m_nSequence;
+			}
+
+			// the current snapshot for a receiver that last acknowledged nAcked. Receivers on the
+			// same baseline share one encoded message, so a broadcast encodes once per baseline
+			shared_message<T> Encode(uint32_t nAcked)
+			{
+				const snapshot_entry& current = m_vHistory[m_nSequence % m_vHistory.size()];
+				const std::vector<uint8_t>& vState = current.vState;
+
+				const snapshot_entry* pBaseline = vState.size() <= nSnapshotMaxDeltaBytes ? Find(nAcked) : nullptr;
+				uint32_t nBaseline = pBaseline ? nAcked : 0;
+
+				for (auto& encoded : m_vEncoded)
+					if (encoded.first == nBaseline)
+						return encoded.second;
+
+				message<T> msg;
+				msg.header.id = m_id;
+				message_writer<T> writer(msg);
+
+				if (pBaseline)
+				{
+					// xor against the baseline, zero padded where the state has grown
+					m_vXor.assign(vState.begin(), vState.end());
+					simd::xor_bytes(m_vXor.data(), pBaseline->vState.data(), std::min(vState.size(), pBaseline->vState.size()));
+					rle_encode(m_vXor.data(), m_vXor.size(), m_vRuns);
+
+					// a delta that saves nothing is sent as a full state, which needs no baseline
+					if (m_vRuns.size() >= vState.size())
+						nBaseline = 0;
+				}
+
+				writer.reserve(sizeof(snapshot_header) + (nBaseline ? m_vRuns.size() : vState.size()));
+				writer.pack(m_nSequence, nBaseline, uint32_t(vState.size()));
+				if (nBaseline)
+					writer.write(m_vRuns.data(), m_vRuns.size());
+				else
+					writer.write(vState.data(), vState.size());
+
+				shared_message<T> pMsg = make_shared_message(std::move(msg));
+				m_vEncoded.push_back({ nBaseline, pMsg });
+				return pMsg;
+			}
+
+			uint32_t Sequence() const
+			{
+				return m_nSequence;
+			}
+
+		private:
+			// nullptr unless the snapshot is still held and is not the current one
+			const snapshot_entry* Find(uint32_t nSequence) const
+			{
+				if (nSequence == 0 || nSequence == m_nSequence || m_nSequence - nSequence >= m_vHistory.size())
+					return nullptr;
+
+				const snapshot_entry& entry = m_vHistory[nSequence % m_vHistory.size()];
+				return entry.nSequence == nSequence ? &entry : nullptr;
+			}
+
+		private:
+			std::vector<snapshot_entry> m_vHistory;
+			uint32_t m_nSequence = 0;
+			T m_id{};
+
+			// encodings of the current snapshot, by baseline
+			std::vector<std::pair<uint32_t, shared_message<T>>> m_vEncoded;
+
+			// scratch space reused between encodes
+			std::vector<uint8_t> m_vXor;
+			std::vector<uint8_t> m_vRuns;
+		};
+
+		// Receiving side. Keeps the last nHistory snapshots it decoded, which must be at least as
+		// many as the sender keeps, so any baseline the sender picks is still here
+		template <typename T>
+		class snapshot_decoder
+		{
+		public:
+			explicit snapshot_decoder(size_t nHistory = 32) : m_vHistory(std::max<size_t>(nHistory, 1))
+			{}
+
+			// replaces the body of a snapshot message with the full state it carries. Returns the
+			// sequence to acknowledge, or 0 if the message is malformed or its baseline is unknown
+			uint32_t Decode(message<T>& msg)
+			{
+				message_reader r(msg);
+				snapshot_header header;
+				if (!r.unpack(header.nSequence, header.nBaseline, header.nSize) || header.nSequence == 0)
+					return 0;
+
+				// sizes are checked against what the message can hold before anything is allocated
+				if (header.nBaseline == 0)
+				{
+					if (r.remaining() != header.nSize)
+						return 0;
+
+					m_vState.resize(header.nSize);
+					if (!r.read(m_vState.data(), header.nSize))
+						return 0;
+				}
+				else
+				{
+					if (header.nSize > nSnapshotMaxDeltaBytes)
+						return 0;
+
+					const snapshot_entry& baseline = m_vHistory[header.nBaseline % m_vHistory.size()];
+					if (baseline.nSequence != header.nBaseline)
+						return 0;
+
+					m_vState.resize(header.nSize);
+					size_t nKeep = std::min<size_t>(header.nSize, baseline.vState.size());
+					std::copy(baseline.vState.begin(), baseline.vState.begin() + nKeep, m_vState.begin());
+					std::fill(m_vState.begin() + nKeep, m_vState.end(), uint8_t(0));
+
+					if (!rle_apply(r, m_vState.data(), m_vState.size()))
+						return 0;
+				}
+
+				snapshot_entry& entry = m_vHistory[header.nSequence % m_vHistory.size()];
+				entry.nSequence = header.nSequence;
+				entry.vState = m_vState;
+
+				msg.body.assign(m_vState.begin(), m_vState.end());
+				msg.header.size = uint32_t(msg.body.size());
+				return header.nSequence;
+			}
+
+		private:
+			std::vector<snapshot_entry> m_vHistory;
+			std::vector<uint8_t> m_vState;
+		};
+	}
+}
@@ -0,0 +1,212 @@
+#pragma once
+// net socket options, what the server and client set on their sockets, and buffer auto tuning
+#include "net_common.h"
+#include "net_log.h"
+
+namespace olc
+{
+	namespace net
+	{
+		// Given to the server and client constructors. A server applies them to its listening
+		// socket, which accepted sockets inherit the buffer sizes of, and to every accepted one;
+		// a client applies them once connected
+		struct socket_options
+		{
+			bool bNoDelay = false;					// TCP_NODELAY, a small message goes out without waiting on the last one's ack
+			bool bQuickAck = false;					// Linux TCP_QUICKACK, acks straight away. Set again after every read, the kernel clears it
+			bool bReusePort = false;				// SO_REUSEPORT on the listening socket, several servers can share the port
+			int nSendBuffer = 0;					// SO_SNDBUF in bytes, 0 leaves the OS default and its own tuning
+			int nReceiveBuffer = 0;					// SO_RCVBUF in bytes, as above
+			int nDatagramBuffer = 0;				// both buffers of udp sockets, a burst bigger than this is dropped by the kernel
+			bool bAutoTune = false;					// grows the stream buffers to fit the throughput seen, on Linux only those set above, see socket_tuner
+			int nAutoTuneMax = 8 * 1024 * 1024;		// largest buffer auto tuning asks for
+		};
+
+#if defined(__linux__)
+		using tcp_quick_ack = asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_QUICKACK>;
+#endif
+#if defined(SO_REUSEPORT)
+		using socket_reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+		// an option the OS refuses is logged, the socket works either way
+		template <typename Socket, typename Option>
+		void set_socket_option(Socket& socket, const Option& option, const char* sName)
+		{
+			asio::error_code ec;
+			socket.set_option(option, ec);
+			if (ec)
+				OLC_NET_LOG(warn, "[SOCKET] {} not set: {}", sName, ec.message());
+		}
+
+		template <typename Socket>
+		void set_buffer_sizes(Socket& socket, int nSend, int nReceive)
+		{
+			if (nSend > 0)
+				set_socket_option(socket, asio::socket_base::send_buffer_size(nSend), "SO_SNDBUF");
+			if (nReceive > 0)
+				set_socket_option(socket, asio::socket_base::receive_buffer_size(nReceive), "SO_RCVBUF");
+		}
+
+		// io thread - once per read when asked for, as the kernel drops back to delayed acks
+		inline void set_quick_ack(asio::ip::tcp::socket& socket)
+		{
+#if defined(__linux__)
+			asio::error_code ec;
+			socket.set_option(tcp_quick_ack(true), ec);
+#endif
+		}
+
+		inline void apply_socket_options(asio::ip::tcp::socket& socket, const socket_options& options)
+		{
+			if (options.bNoDelay)
+				set_socket_option(socket, asio::ip::tcp::no_delay(true), "TCP_NODELAY");
+			set_buffer_sizes(socket, options.nSendBuffer, options.nReceiveBuffer);
+			if (options.bQuickAck)
+				set_quick_ack(socket);
+		}
+
+		inline void apply_socket_options(asio::ip::udp::socket& socket, const socket_options& options)
+		{
+			set_buffer_sizes(socket, options.nDatagramBuffer, options.nDatagramBuffer);
+		}
+
+		// opens, binds and listens as the acceptor's own constructor would, with the options that
+		// have to be in place before the bind. Throws the same way
+		inline void open_acceptor(asio::ip::tcp::acceptor& acceptor, const asio::ip::tcp::endpoint& endpoint, const socket_options& options)
+		{
+			acceptor.open(endpoint.protocol());
+			acceptor.set_option(asio::socket_base::reuse_address(true));
+#if defined(SO_REUSEPORT)
+			if (options.bReusePort)
+				set_socket_option(acceptor, socket_reuse_port(true), "SO_REUSEPORT");
+#endif
+			// the window scale is agreed in the handshake, so accepted sockets need their
+			// receive buffer from here for a large one to be usable
+			set_buffer_sizes(acceptor, options.nSendBuffer, options.nReceiveBuffer);
+
+			acceptor.bind(endpoint);
+			acceptor.listen();
+		}
+
+		// Grows a connection's buffers towards twice the bandwidth delay product it sees: bytes
+		// moved per second over a short interval times the round trip. The send side only
+		// counts intervals in which the queue never ran dry, otherwise the application rather
+		// than the buffer set the pace. Buffers are never shrunk, and a direction is left alone
+		// for good once the OS gives it less than was asked for.
+		// Linux tunes its buffers itself until one is set, and caps what can be set at
+		// rmem_max / wmem_max, so there only buffers the options fixed are grown
+		class socket_tuner
+		{
+		public:
+			using clock = std::chrono::steady_clock;
+
+			explicit socket_tuner(const socket_options& options)
+				: m_nMax(options.nAutoTuneMax)
+			{
+#if defined(__linux__)
+				m_send.bDone = options.nSendBuffer <= 0;
+				m_receive.bDone = options.nReceiveBuffer <= 0;
+#endif
+			}
+
+			// io thread - after each read
+			void OnRead(asio::ip::tcp::socket& socket, size_t nBytes)
+			{
+				Sample<asio::socket_base::receive_buffer_size>(socket, m_receive, nBytes, true);
+			}
+
+			// io thread - after each write, bBacklogged if more was already waiting to go
+			void OnWrite(asio::ip::tcp::socket& socket, size_t nBytes, bool bBacklogged)
+			{
+				Sample<asio::socket_base::send_buffer_size>(socket, m_send, nBytes, bBacklogged);
+			}
+
+			// true once neither direction will be grown again
+			bool IsSettled() const
+			{
+				return m_send.bDone && m_receive.bDone;
+			}
+
+		private:
+			static constexpr std::chrono::milliseconds tInterval{ 200 };
+
+			struct direction
+			{
+				clock::time_point tStart;
+				size_t nBytes = 0;
+				bool bBusy = true;
+				int nBuffer = 0;
+				bool bDone = false;
+			};
+
+			template <typename Option>
+			void Sample(asio::ip::tcp::socket& socket, direction& d, size_t nBytes, bool bBusy)
+			{
+				if (d.bDone)
+					return;
+
+				auto tNow = clock::now();
+				if (d.nBuffer == 0)
+				{
+					d.nBuffer = Current<Option>(socket);
+					d.tStart = tNow;
+				}
+
+				d.nBytes += nBytes;
+				d.bBusy = d.bBusy && bBusy;
+				if (tNow - d.tStart < tInterval)
+					return;
+
+				double dRate = double(d.nBytes) / std::chrono::duration<double>(tNow - d.tStart).count();
+				double dTarget = std::min(2.0 * dRate * RoundTrip(socket), double(m_nMax));
+				if (d.bBusy && d.nBuffer > 0 && dTarget > 1.25 * d.nBuffer)
+				{
+					asio::error_code ec;
+					socket.set_option(Option(int(dTarget)), ec);
+
+					// the kernel may round or double what it was given, it says what it settled on.
+					// Less than was asked for is its limit, asking again would get no further
+					int nBuffer = Current<Option>(socket);
+					OLC_NET_LOG(debug, "[SOCKET] buffer {} -> {} at {} bytes/s", d.nBuffer, nBuffer, uint64_t(dRate));
+					d.nBuffer = std::max(d.nBuffer, nBuffer);
+					if (ec || nBuffer < int(dTarget))
+					{
+						OLC_NET_LOG(debug, "[SOCKET] buffer held at {}, the system limit", d.nBuffer);
+						d.bDone = true;
+					}
+				}
+
+				d.tStart = tNow;
+				d.nBytes = 0;
+				d.bBusy = true;
+			}
+
+			template <typename Option>
+			static int Current(asio::ip::tcp::socket& socket)
+			{
+				Option option;
+				asio::error_code ec;
+				socket.get_option(option, ec);
+				return ec ? 0 : option.value();
+			}
+
+			// the kernel's smoothed rtt in seconds where it shares it, otherwise a wide area guess
+			static double RoundTrip(asio::ip::tcp::socket& socket)
+			{
+#if defined(__linux__)
+				tcp_info info;
+				socklen_t nSize = sizeof(info);
+				if (getsockopt(socket.native_handle(), IPPROTO_TCP, TCP_INFO, &info, &nSize) == 0 && info.tcpi_rtt > 0)
+					return info.tcpi_rtt * 1e-6;
+#endif
+				return 0.05;
+			}
+
+		private:
+			int m_nMax = 0;
+			direction m_send;
+			direction m_receive;
+		};
+	}
+}
@@ -21,6 +21,15 @@ namespace olc
 			}
 
 			void push_back(const T& item)
+			{
+				std::scoped_lock lock(muxQueue);
+				deqQueue.emplace_back(item);
+
+				std::unique_lock<std::mutex> ul(muxBlocking);
+				cvBlocking.notify_one();
+			}
+
+			void push_back(T&& item)
 			{
 				std::scoped_lock lock(muxQueue);
 				deqQueue.emplace_back(std::move(item));
@@ -30,6 +39,15 @@ namespace olc
 			}
 
 			void push_front(const T& item)
+			{
+				std::scoped_lock lock(muxQueue);
+				deqQueue.emplace_front(item);
+
+				std::unique_lock<std::mutex> ul(muxBlocking);
+				cvBlocking.notify_one();
+			}
+
+			void push_front(T&& item)
 			{
 				std::scoped_lock lock(muxQueue);
 				deqQueue.emplace_front(std::move(item));
@@ -53,7 +71,7 @@ namespace olc
 			size_t count()
 			{
 				std::scoped_lock lock(muxQueue);
-				deqQueue.size();
+				return deqQueue.size();
 			}
 
 			void clear()
@@ -71,6 +89,15 @@ namespace olc
 				}
 			}
 
+			// swaps everything pending into deqOut under a single lock, deqOut should be empty
+			// and is best reused between calls so its storage is recycled
+			size_t swap_out(std::deque<T>& deqOut)
+			{
+				std::scoped_lock lock(muxQueue);
+				deqQueue.swap(deqOut);
+				return deqOut.size();
+			}
+
 			T pop_front()
 			{
 				std::scoped_lock lock(muxQueue);
@@ -0,0 +1,546 @@
+#pragma once
+// net udp, datagram channels next to the tcp stream for traffic that must not wait behind a lost packet
+#include "net_common.h"
+#include "net_message.h"
+#include "net_metrics.h"
+
+namespace olc
+{
+	namespace net
+	{
+		// how messages of an id travel once udp is up, until then they go over tcp like everything else
+		enum class udp_channel : uint8_t
+		{
+			unreliable,		// may be lost, duplicated or arrive out of order
+			sequenced,		// may be lost, anything older than the newest one delivered is discarded
+			reliable		// resent until acknowledged, delivered in the order sent
+		};
+
+		// ids not listed in channels always go over tcp
+		template <typename T>
+		struct udp_options
+		{
+			std::unordered_map<T, udp_channel> channels;
+		};
+
+		// Every datagram starts with this. The key is the value both ends agreed on in the tcp
+		// handshake and is all that ties a datagram to a connection. A packet acknowledges nAck
+		// and, for each bit n set in nAckBits, nAck - 1 - n. The fragment fields are only
+		// meaningful with nUdpFlagFragment set, the payload is then nSize bytes of the message's
+		// header and body, from nFragment * nUdpFragmentBytes on
+		struct udp_packet_header
+		{
+			uint64_t nKey = 0;
+			uint16_t nSequence = 0;
+			uint16_t nAck = 0;
+			uint32_t nAckBits = 0;
+			uint8_t nFlags = 0;
+			uint8_t nChannel = 0;
+			uint8_t nFragment = 0;
+			uint8_t nFragments = 0;
+			uint16_t nMessage = 0;
+			uint16_t nSize = 0;
+		};
+		static_assert(sizeof(udp_packet_header) == 24, "udp_packet_header is sent as is");
+
+		static constexpr uint8_t nUdpFlagHello = 1;		// the sender has not heard from us yet, so its acks mean nothing
+		static constexpr uint8_t nUdpFlagFragment = 2;
+
+		// stays under the path mtu of most networks once the ip and udp headers are added
+		static constexpr size_t nUdpMaxDatagram = 1200;
+		static constexpr size_t nUdpFragmentBytes = nUdpMaxDatagram - sizeof(udp_packet_header);
+		static constexpr size_t nUdpMaxFragments = 255;
+
+		// reliable messages in flight at once, more wait their turn on the sender
+		static constexpr uint16_t nUdpReliableWindow = 256;
+		// messages of the other channels being put back together at once, per channel
+		static constexpr size_t nUdpAssemblySlots = 16;
+		// sent packets remembered for acks, well beyond the 33 an ack covers
+		static constexpr size_t nUdpSentHistory = 1024;
+		// packets received before an ack goes back without waiting for the tick, so a burst
+		// is acknowledged before it slides out of the ack bits
+		static constexpr size_t nUdpAckEvery = 16;
+
+		static constexpr std::chrono::milliseconds nUdpTick{ 10 };
+		static constexpr std::chrono::milliseconds nUdpHelloInterval{ 100 };
+		static constexpr std::chrono::milliseconds nUdpMinResend{ 20 };
+
+		// true if a comes after b, allowing for the 16 bit sequences wrapping
+		inline bool sequence_newer(uint16_t a, uint16_t b)
+		{
+			return a != b && uint16_t(a - b) < 0x8000;
+		}
+
+		// A datagram socket that any io thread may send on. Sends never block, a datagram the
+		// socket has no room for is dropped, which the channels already have to cope with
+		class udp_socket
+		{
+		public:
+			// bound to a local port, a server's one socket for all its clients
+			udp_socket(asio::io_context& context, const asio::ip::udp::endpoint& local)
+				: m_socket(context, local)
+			{
+				m_socket.non_blocking(true);
+			}
+
+			// bound to any port, a client's own socket
+			udp_socket(asio::io_context& context, const asio::ip::udp& protocol)
+				: m_socket(context, protocol)
+			{
+				m_socket.non_blocking(true);
+			}
+
+			void SendTo(const uint8_t* pData, size_t nBytes, const asio::ip::udp::endpoint& remote)
+			{
+				asio::error_code ec;
+				std::scoped_lock lock(m_muxSend);
+				m_socket.send_to(asio::buffer(pData, nBytes), remote, 0, ec);
+			}
+
+			asio::ip::udp::socket& Socket()
+			{
+				return m_socket;
+			}
+
+		private:
+			asio::ip::udp::socket m_socket;
+			std::mutex m_muxSend;
+		};
+
+		// A message being put back together from its fragments
+		struct udp_assembly
+		{
+			bool bActive = false;
+			uint16_t nMessage = 0;
+			size_t nFragments = 0;
+			size_t nReceived = 0;
+			size_t nSize = 0;
+			std::vector<uint8_t> vReceived;
+			std::vector<uint8_t> vData;
+
+			bool Complete() const
+			{
+				return bActive && nReceived == nFragments;
+			}
+
+			// false if the fragment does not belong or was already here
+			bool Add(const udp_packet_header& header, const uint8_t* pPayload)
+			{
+				if (!bActive || nMessage != header.nMessage)
+				{
+					bActive = true;
+					nMessage = header.nMessage;
+					nFragments = header.nFragments;
+					nReceived = 0;
+					vReceived.assign(nFragments, 0);
+					vData.resize(nFragments * nUdpFragmentBytes);
+				}
+
+				if (nFragments != header.nFragments || vReceived[header.nFragment])
+					return false;
+
+				size_t nAt = header.nFragment * nUdpFragmentBytes;
+				std::memcpy(vData.data() + nAt, pPayload, header.nSize);
+				if (header.nFragment + 1u == nFragments)
+					nSize = nAt + header.nSize;
+
+				vReceived[header.nFragment] = 1;
+				nReceived++;
+				return true;
+			}
+		};
+
+		// Per connection state of the udp channels: packet acks, fragmenting, resending and
+		// ordering. It owns no socket, datagrams go out through the sink and come in through
+		// Receive, all on the connection's io thread
+		template <typename T>
+		class udp_session
+		{
+		public:
+			using datagram_sink = std::function<void(const uint8_t*, size_t)>;
+
+			udp_session(uint64_t nKey, connection_metrics& metrics, datagram_sink sink)
+				: m_nKey(nKey), m_metrics(metrics), m_sink(std::move(sink))
+			{
+				m_vSent.resize(nUdpSentHistory);
+				m_vReliableIn.resize(nUdpReliableWindow);
+			}
+
+			// something has arrived from the other end, so it knows where we are
+			bool Established() const
+			{
+				return m_bEstablished;
+			}
+
+			// the largest message, header included, that can be cut into fragments
+			static bool Fits(const message<T>& msg)
+			{
+				return sizeof(message_header<T>) + msg.body.size() <= nUdpFragmentBytes * nUdpMaxFragments;
+			}
+
+			void Send(const shared_message<T>& pMsg, udp_channel channel, std::chrono::steady_clock::time_point tNow)
+			{
+				bump(m_metrics.nMessagesOut);
+
+				if (channel == udp_channel::reliable)
+				{
+					if (m_qReliableOut.size() < nUdpReliableWindow)
+						SendReliable(pMsg, tNow);
+					else
+						m_qReliableWaiting.push_back(pMsg);
+					return;
+				}
+
+				uint8_t nChannel = uint8_t(channel);
+				uint16_t nMessage = m_vNextMessage[nChannel]++;
+				size_t nFragments = FragmentCount(*pMsg);
+				for (size_t i = 0; i < nFragments; i++)
+					SendFragment(*pMsg, nChannel, nMessage, i, nFragments, tNow, false);
+			}
+
+			// false if the datagram is not for this session or is malformed. Complete messages
+			// are handed to deliver as they become available
+			template <typename Deliver>
+			bool Receive(const uint8_t* pData, size_t nBytes, std::chrono::steady_clock::time_point tNow, Deliver&& deliver)
+			{
+				udp_packet_header header;
+				if (nBytes < sizeof(header))
+					return false;
+				std::memcpy(&header, pData, sizeof(header));
+
+				if (header.nKey != m_nKey || !Valid(header, nBytes - sizeof(header)))
+					return false;
+
+				bump(m_metrics.nDatagramsIn);
+				bump(m_metrics.nBytesIn, nBytes);
+
+				ReceiveSequence(header.nSequence);
+				m_bEstablished = true;
+
+				if ((header.nFlags & nUdpFlagHello) == 0)
+					ProcessAcks(header.nAck, header.nAckBits, tNow);
+
+				if (header.nFlags & nUdpFlagFragment)
+					ReceiveFragment(header, pData + sizeof(header), deliver);
+
+				if (header.nFlags & (nUdpFlagHello | nUdpFlagFragment))
+				{
+					m_bAckPending = true;
+					if (++m_nUnacked >= nUdpAckEvery)
+						Emit(udp_packet_header{}, 0, tNow);
+				}
+
+				return true;
+			}
+
+			// every nUdpTick - resends what has not been acknowledged in time, says hello until
+			// the other end answers and acknowledges anything not yet acknowledged
+			void Tick(std::chrono::steady_clock::time_point tNow)
+			{
+				auto tResend = std::max<std::chrono::steady_clock::duration>(nUdpMinResend, m_tRtt * 2);
+				for (auto& pending : m_qReliableOut)
+				{
+					for (size_t i = 0; i < pending.vAcked.size(); i++)
+					{
+						if (!pending.vAcked[i] && tNow - pending.vSent[i] >= tResend)
+						{
+							SendFragment(*pending.pMsg, uint8_t(udp_channel::reliable), pending.nMessage, i, pending.vAcked.size(), tNow, true);
+							pending.vSent[i] = tNow;
+							bump(m_metrics.nDatagramsResent);
+						}
+					}
+				}
+
+				if (!m_bEstablished && tNow - m_tLastHello >= nUdpHelloInterval)
+				{
+					m_tLastHello = tNow;
+					Emit(udp_packet_header{}, 0, tNow);
+				}
+				else if (m_bAckPending)
+				{
+					Emit(udp_packet_header{}, 0, tNow);
+				}
+			}
+
+		private:
+			struct sent_packet
+			{
+				bool bAcked = true;
+				bool bReliable = false;
+				uint16_t nSequence = 0;
+				uint16_t nMessage = 0;
+				size_t nFragment = 0;
+				std::chrono::steady_clock::time_point tSent;
+			};
+
+			struct pending_message
+			{
+				uint16_t nMessage = 0;
+				shared_message<T> pMsg;
+				std::vector<uint8_t> vAcked;
+				std::vector<std::chrono::steady_clock::time_point> vSent;
+				size_t nUnacked = 0;
+			};
+
+			static size_t FragmentCount(const message<T>& msg)
+			{
+				size_t nBytes = sizeof(message_header<T>) + msg.body.size();
+				return (nBytes + nUdpFragmentBytes - 1) / nUdpFragmentBytes;
+			}
+
+			static bool Valid(const udp_packet_header& header, size_t nPayload)
+			{
+				if ((header.nFlags & nUdpFlagFragment) == 0)
+					return nPayload == 0;
+
+				if (header.nChannel > uint8_t(udp_channel::reliable) || header.nFragments == 0 || header.nFragment >= header.nFragments)
+					return false;
+
+				// every fragment but the last is full
+				bool bLast = header.nFragment + 1u == header.nFragments;
+				return header.nSize == nPayload && nPayload <= nUdpFragmentBytes && (bLast || nPayload == nUdpFragmentBytes);
+			}
+
+			void SendReliable(const shared_message<T>& pMsg, std::chrono::steady_clock::time_point tNow)
+			{
+				pending_message pending;
+				pending.nMessage = m_vNextMessage[uint8_t(udp_channel::reliable)]++;
+				pending.pMsg = pMsg;
+				pending.nUnacked = FragmentCount(*pMsg);
+				pending.vAcked.assign(pending.nUnacked, 0);
+				pending.vSent.assign(pending.nUnacked, tNow);
+				m_qReliableOut.push_back(std::move(pending));
+
+				const pending_message& queued = m_qReliableOut.back();
+				for (size_t i = 0; i < queued.nUnacked; i++)
+					SendFragment(*queued.pMsg, uint8_t(udp_channel::reliable), queued.nMessage, i, queued.nUnacked, tNow, true);
+			}
+
+			// the fragment's slice of the header and body, copied in behind the packet header
+			void SendFragment(const message<T>& msg, uint8_t nChannel, uint16_t nMessage, size_t nFragment, size_t nFragments, std::chrono::steady_clock::time_point tNow, bool bReliable)
+			{
+				size_t nTotal = sizeof(message_header<T>) + msg.body.size();
+				size_t nFrom = nFragment * nUdpFragmentBytes;
+				size_t nSize = std::min(nUdpFragmentBytes, nTotal - nFrom);
+
+				uint8_t* pPayload = m_vPacket.data() + sizeof(udp_packet_header);
+				for (size_t i = 0; i < nSize; )
+				{
+					size_t nAt = nFrom + i;
+					if (nAt < sizeof(message_header<T>))
+					{
+						size_t n = std::min(nSize - i, sizeof(message_header<T>) - nAt);
+						std::memcpy(pPayload + i, reinterpret_cast<const uint8_t*>(&msg.header) + nAt, n);
+						i += n;
+					}
+					else
+					{
+						std::memcpy(pPayload + i, msg.body.data() + (nAt - sizeof(message_header<T>)), nSize - i);
+						i = nSize;
+					}
+				}
+
+				udp_packet_header header;
+				header.nFlags = nUdpFlagFragment;
+				header.nChannel = nChannel;
+				header.nFragment = uint8_t(nFragment);
+				header.nFragments = uint8_t(nFragments);
+				header.nMessage = nMessage;
+				header.nSize = uint16_t(nSize);
+
+				uint16_t nSequence = Emit(header, nSize, tNow);
+				sent_packet& sent = m_vSent[nSequence % nUdpSentHistory];
+				sent.bReliable = bReliable;
+				sent.nMessage = nMessage;
+				sent.nFragment = nFragment;
+			}
+
+			// stamps the sequence and acks onto a packet whose payload is already in place
+			uint16_t Emit(udp_packet_header header, size_t nPayload, std::chrono::steady_clock::time_point tNow)
+			{
+				header.nKey = m_nKey;
+				header.nSequence = m_nSequence++;
+				header.nAck = m_nRemoteSequence;
+				header.nAckBits = m_nAckBits;
+				if (!m_bEstablished)
+					header.nFlags |= nUdpFlagHello;
+				std::memcpy(m_vPacket.data(), &header, sizeof(header));
+
+				sent_packet& sent = m_vSent[header.nSequence % nUdpSentHistory];
+				sent = sent_packet{};
+				sent.bAcked = false;
+				sent.nSequence = header.nSequence;
+				sent.tSent = tNow;
+
+				size_t nBytes = sizeof(header) + nPayload;
+				m_bAckPending = false;
+				m_nUnacked = 0;
+				bump(m_metrics.nDatagramsOut);
+				bump(m_metrics.nBytesOut, nBytes);
+
+				m_sink(m_vPacket.data(), nBytes);
+				return header.nSequence;
+			}
+
+			void ReceiveSequence(uint16_t nSequence)
+			{
+				if (!m_bEstablished)
+				{
+					m_nRemoteSequence = nSequence;
+					m_nAckBits = 0;
+				}
+				else if (sequence_newer(nSequence, m_nRemoteSequence))
+				{
+					uint16_t nAhead = uint16_t(nSequence - m_nRemoteSequence);
+					uint64_t nBits = nAhead > 32 ? 0 : ((uint64_t(m_nAckBits) << 1 | 1) << (nAhead - 1));
+					m_nAckBits = uint32_t(nBits);
+					m_nRemoteSequence = nSequence;
+				}
+				else
+				{
+					uint16_t nBehind = uint16_t(m_nRemoteSequence - nSequence);
+					if (nBehind >= 1 && nBehind <= 32)
+						m_nAckBits |= uint32_t(1) << (nBehind - 1);
+				}
+			}
+
+			void ProcessAcks(uint16_t nAck, uint32_t nAckBits, std::chrono::steady_clock::time_point tNow)
+			{
+				PacketAcked(nAck, tNow);
+				for (uint16_t i = 0; i < 32; i++)
+					if (nAckBits & (uint32_t(1) << i))
+						PacketAcked(uint16_t(nAck - 1 - i), tNow);
+
+				// the window moves on past everything acknowledged at its front
+				while (!m_qReliableOut.empty() && m_qReliableOut.front().nUnacked == 0)
+					m_qReliableOut.pop_front();
+
+				while (!m_qReliableWaiting.empty() && m_qReliableOut.size() < nUdpReliableWindow)
+				{
+					SendReliable(m_qReliableWaiting.front(), tNow);
+					m_qReliableWaiting.pop_front();
+				}
+			}
+
+			void PacketAcked(uint16_t nSequence, std::chrono::steady_clock::time_point tNow)
+			{
+				sent_packet& sent = m_vSent[nSequence % nUdpSentHistory];
+				if (sent.bAcked || sent.nSequence != nSequence)
+					return;
+				sent.bAcked = true;
+
+				// smoothed round trip, sets how long a reliable fragment waits before it is resent
+				m_tRtt += (std::chrono::duration_cast<std::chrono::microseconds>(tNow - sent.tSent) - m_tRtt) / 8;
+
+				if (!sent.bReliable || m_qReliableOut.empty())
+					return;
+
+				size_t nIndex = uint16_t(sent.nMessage - m_qReliableOut.front().nMessage);
+				if (nIndex >= m_qReliableOut.size())
+					return;
+
+				pending_message& pending = m_qReliableOut[nIndex];
+				if (!pending.vAcked[sent.nFragment])
+				{
+					pending.vAcked[sent.nFragment] = 1;
+					pending.nUnacked--;
+				}
+			}
+
+			template <typename Deliver>
+			void ReceiveFragment(const udp_packet_header& header, const uint8_t* pPayload, Deliver&& deliver)
+			{
+				udp_channel channel = udp_channel(header.nChannel);
+
+				if (channel == udp_channel::reliable)
+				{
+					// anything outside the window was delivered already, or was sent further ahead
+					// than the sender is allowed to go
+					if (uint16_t(header.nMessage - m_nReliableNext) >= nUdpReliableWindow)
+						return;
+
+					udp_assembly& slot = m_vReliableIn[header.nMessage % nUdpReliableWindow];
+					slot.Add(header, pPayload);
+
+					while (true)
+					{
+						udp_assembly& next = m_vReliableIn[m_nReliableNext % nUdpReliableWindow];
+						if (!next.Complete() || next.nMessage != m_nReliableNext)
+							break;
+
+						Unpack(next, deliver);
+						next.bActive = false;
+						m_nReliableNext++;
+					}
+					return;
+				}
+
+				bool bSequenced = channel == udp_channel::sequenced;
+				if (bSequenced && m_bSequencedAny && !sequence_newer(header.nMessage, m_nSequencedLast))
+					return;
+
+				auto& vSlots = bSequenced ? m_vSequencedIn : m_vUnreliableIn;
+				udp_assembly& slot = vSlots[header.nMessage % nUdpAssemblySlots];
+				if (!slot.Add(header, pPayload) || !slot.Complete())
+					return;
+
+				slot.bActive = false;
+				if (bSequenced)
+				{
+					m_bSequencedAny = true;
+					m_nSequencedLast = header.nMessage;
+				}
+				Unpack(slot, deliver);
+			}
+
+			// the assembled bytes must be a header followed by exactly the body it describes
+			template <typename Deliver>
+			void Unpack(const udp_assembly& slot, Deliver&& deliver)
+			{
+				if (slot.nSize < sizeof(message_header<T>))
+					return;
+
+				message<T> msg;
+				std::memcpy(&msg.header, slot.vData.data(), sizeof(message_header<T>));
+				if (msg.header.size != slot.nSize - sizeof(message_header<T>))
+					return;
+
+				msg.body.assign(slot.vData.begin() + sizeof(message_header<T>), slot.vData.begin() + slot.nSize);
+				bump(m_metrics.nMessagesIn);
+				deliver(std::move(msg));
+			}
+
+		private:
+			uint64_t m_nKey = 0;
+			connection_metrics& m_metrics;
+			datagram_sink m_sink;
+			bool m_bEstablished = false;
+			bool m_bAckPending = false;
+			size_t m_nUnacked = 0;
+			std::chrono::steady_clock::time_point m_tLastHello;
+			std::chrono::microseconds m_tRtt{ 100000 };
+
+			// outgoing packets and what each one carried
+			uint16_t m_nSequence = 0;
+			std::vector<sent_packet> m_vSent;
+			std::array<uint8_t, nUdpMaxDatagram> m_vPacket = {};
+			std::array<uint16_t, 3> m_vNextMessage = {};
+
+			// reliable messages not yet fully acknowledged, in order, and those waiting for room
+			std::deque<pending_message> m_qReliableOut;
+			std::deque<shared_message<T>> m_qReliableWaiting;
+
+			// incoming packets acknowledged by the next one out
+			uint16_t m_nRemoteSequence = 0;
+			uint32_t m_nAckBits = 0;
+
+			// incoming messages, the reliable ones held until those before them have arrived
+			std::array<udp_assembly, nUdpAssemblySlots> m_vUnreliableIn;
+			std::array<udp_assembly, nUdpAssemblySlots> m_vSequencedIn;
+			std::vector<udp_assembly> m_vReliableIn;
+			uint16_t m_nReliableNext = 0;
+			uint16_t m_nSequencedLast = 0;
+			bool m_bSequencedAny = false;
+		};
+	}
+}
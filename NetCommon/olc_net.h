@@ -1,8 +1,22 @@
 #pragma once
 
 #include "net_common.h"
+#include "net_pool.h"
+#include "net_log.h"
 #include "net_message.h"
+#include "net_schema.h"
+#include "net_simd.h"
+#include "net_snapshot.h"
+#include "net_compress.h"
+#include "net_udp.h"
+#include "net_linksim.h"
+#include "net_sockopt.h"
 #include "net_tsqueue.h"
+#include "net_mpscqueue.h"
+#include "net_registry.h"
+#include "net_metrics.h"
 #include "net_connection.h"
+#include "net_shard.h"
+#include "net_executor.h"
 #include "net_client.h"
 #include "net_server.h"
\ No newline at end of file
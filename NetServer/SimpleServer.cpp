@@ -13,10 +13,20 @@ enum class CustomMsgTypes : uint32_t
 class CustomServer : public olc::net::server_interface<CustomMsgTypes>
 {
 public:
-	CustomServer(uint16_t port) : olc::net::server_interface<CustomMsgTypes>(port)
+	CustomServer(uint16_t port) : olc::net::server_interface<CustomMsgTypes>(port, 1, PingOptions())
 	{
 	}
 
+	// pings are small and answered one at a time, so neither side should hold them back
+	// waiting on an ack, quick acks only take effect on Linux
+	static olc::net::socket_options PingOptions()
+	{
+		olc::net::socket_options options;
+		options.bNoDelay = true;
+		options.bQuickAck = true;
+		return options;
+	}
+
 protected:
 	virtual bool OnClientConnect(std::shared_ptr<olc::net::connection<CustomMsgTypes>> client)
 	{
@@ -31,7 +41,10 @@ protected:
 		{
 			std::cout << "[" << client->GetID() << "] ServerPing" << std::endl;
 
-			client->Send(msg);
+			// sent back as the reply, so a ping made with client_interface::request gets it too
+			olc::net::message<CustomMsgTypes> reply = msg;
+			olc::net::reply_to(reply, msg);
+			client->Send(std::move(reply));
 		}
 		break;
 		}
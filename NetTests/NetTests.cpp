@@ -0,0 +1,1796 @@
+// Checks of the networking library, everything runs in process and at most over loopback.
+// The shard test listens on port 60917, the backpressure test on 60918, the executor test
+// on 60919 and 60922, the requests test on 60920 and the receive buffer test on 60921.
+//
+//   NetTests [name...]
+//       runs every test, or only those named, printing each check that fails. Exits with 1
+//       if any did, so it can gate a build.
+//
+// On Linux: g++ -std=c++20 -O2 -pthread -I../NetCommon -I<asio>/include NetTests.cpp
+
+#include <array>
+#include <iostream>
+#include <random>
+#include <string>
+#include <olc_net.h>
+
+#if defined(__linux__)
+#include <poll.h>
+#endif
+
+enum class TestMsgTypes : uint32_t
+{
+	State,
+	Reliable,
+	Sequenced
+};
+
+using test_message = olc::net::message<TestMsgTypes>;
+
+// counts the checks of one test and reports those that fail
+struct test_context
+{
+	std::string sTest;
+	size_t nChecks = 0;
+	size_t nFailed = 0;
+
+	bool Check(bool bPassed, const std::string& sWhat)
+	{
+		nChecks++;
+		if (!bPassed)
+		{
+			nFailed++;
+			std::cout << sTest << ": " << sWhat << std::endl;
+		}
+		return bPassed;
+	}
+};
+
+// nBytes of state, every byte set from nSeed so two states differ throughout
+test_message MakeState(size_t nBytes, uint8_t nSeed)
+{
+	test_message msg;
+	msg.header.id = TestMsgTypes::State;
+	msg.body.resize(nBytes);
+	for (size_t i = 0; i < nBytes; i++)
+		msg.body[i] = uint8_t(i * 31 + nSeed);
+	msg.header.size = uint32_t(nBytes);
+	return msg;
+}
+
+bool SameBody(const test_message& a, const test_message& b)
+{
+	return a.body.size() == b.body.size() && std::equal(a.body.begin(), a.body.end(), b.body.begin());
+}
+
+struct test_fields
+{
+	int16_t x;
+	float y;
+};
+
+void TestMessageStreams(test_context& t)
+{
+	// pack writes front to back with room made once, unpack reads the same order back
+	test_message msg;
+	olc::net::message_writer<TestMsgTypes> writer(msg);
+	uint8_t a = 0xA5;
+	uint32_t b = 0xDEADBEEF;
+	double c = 3.25;
+	test_fields d{ -7, 1.5f };
+	writer.pack(a, b, c, d);
+	size_t nPacked = sizeof(a) + sizeof(b) + sizeof(c) + sizeof(d);
+	t.Check(msg.body.size() == nPacked && msg.header.size == nPacked && msg.body.capacity() >= nPacked, "pack writes every field and sets the header's size");
+	t.Check(msg.body[0] == 0xA5, "the first field packed comes first");
+
+	writer << uint16_t(0x1234);
+	olc::net::message_reader reader(msg);
+	uint8_t a2 = 0;
+	uint32_t b2 = 0;
+	double c2 = 0;
+	test_fields d2{};
+	uint16_t e2 = 0;
+	t.Check(reader.unpack(a2, b2, c2, d2) && a2 == a && b2 == b && c2 == c && d2.x == d.x && d2.y == d.y, "unpack reads fields in the order they were packed");
+	t.Check((reader >> e2).ok() && e2 == 0x1234 && reader.remaining() == 0, "a field written after pack follows it");
+	t.Check(msg.body.size() == nPacked + sizeof(e2), "reading leaves the body alone");
+
+	// a read past the end fails, leaves its destination alone, and every read after it fails too
+	uint8_t vBytes[6] = { 1, 2, 3, 4, 5, 6 };
+	olc::net::message_reader overrun(vBytes, sizeof(vBytes));
+	uint32_t n1 = 0, n2 = 0xCAFEF00D;
+	uint8_t n3 = 0xEE;
+	overrun >> n1 >> n2;
+	t.Check(!overrun.ok() && n2 == 0xCAFEF00D && overrun.position() == sizeof(n1), "an overrun fails without touching the field or moving on");
+	overrun >> n3;
+	t.Check(!overrun.ok() && n3 == 0xEE, "once failed, a read that would fit fails as well");
+	t.Check(!olc::net::message_reader(vBytes, sizeof(vBytes)).unpack(n1, n1), "unpack reports an overrun");
+
+	// take and skip right up to the end
+	olc::net::message_reader edge(vBytes, sizeof(vBytes));
+	t.Check(edge.skip(2) && edge.take(4) == vBytes + 2 && edge.remaining() == 0 && edge.ok(), "take reaches exactly the last byte");
+	t.Check(edge.take(0) == vBytes + sizeof(vBytes) && edge.ok(), "taking nothing at the end is fine");
+	t.Check(!edge.skip(1) && !edge.ok(), "skipping past the end fails");
+	t.Check(edge.take(0) == nullptr, "and nothing is taken after that");
+
+	olc::net::message_reader over(vBytes, sizeof(vBytes));
+	t.Check(over.skip(1) && over.take(6) == nullptr && over.position() == 1 && !over.ok(), "take of one more than is left fails where it stood");
+}
+
+struct schema_point
+{
+	float fX, fY;
+};
+
+struct schema_payload
+{
+	uint32_t nEntity;
+	int16_t nDelta;
+	bool bAlive;
+	TestMsgTypes kind;
+	schema_point position;
+	std::string sName;
+	std::vector<uint16_t> vIds;
+	std::vector<float> vWeights;
+	std::vector<schema_point> vPath;
+	uint64_t nRaw;
+};
+
+namespace olc
+{
+	namespace net
+	{
+		template <> struct schema<schema_point>
+		{
+			using fields = field_list<
+				fixed_field<&schema_point::fX, 100>,
+				fixed_field<&schema_point::fY, 100>>;
+		};
+
+		template <> struct schema<schema_payload>
+		{
+			using fields = field_list<
+				field<&schema_payload::nEntity>,
+				field<&schema_payload::nDelta>,
+				field<&schema_payload::bAlive>,
+				field<&schema_payload::kind>,
+				field<&schema_payload::position>,
+				field<&schema_payload::sName>,
+				field<&schema_payload::vIds>,
+				field<&schema_payload::vWeights>,
+				field<&schema_payload::vPath>,
+				raw_field<&schema_payload::nRaw>>;
+		};
+
+		template <> struct payload_of<TestMsgTypes::Reliable> { using type = schema_payload; };
+	}
+}
+
+bool SamePoint(const schema_point& a, const schema_point& b)
+{
+	return std::abs(a.fX - b.fX) <= 0.005f && std::abs(a.fY - b.fY) <= 0.005f;
+}
+
+// a body of hand picked bytes under the payload's id
+test_message MakeSchemaBody(std::initializer_list<uint8_t> vBytes)
+{
+	test_message msg;
+	msg.header.id = TestMsgTypes::Reliable;
+	msg.body.assign(vBytes.begin(), vBytes.end());
+	msg.header.size = uint32_t(msg.body.size());
+	return msg;
+}
+
+void TestSchema(test_context& t)
+{
+	// varints at the edges of each byte count, and the widest
+	bool bVarints = true;
+	for (uint64_t n : { uint64_t(0), uint64_t(127), uint64_t(128), uint64_t(16383), uint64_t(16384), uint64_t(UINT32_MAX), UINT64_MAX })
+	{
+		uint8_t vBytes[10];
+		uint8_t* p = vBytes;
+		olc::net::write_varint(p, n);
+		olc::net::message_reader r(vBytes, size_t(p - vBytes));
+		uint64_t nRead = 0;
+		bVarints = bVarints && size_t(p - vBytes) == olc::net::varint_size(n) && olc::net::read_varint(r, nRead) && nRead == n && r.remaining() == 0;
+	}
+	t.Check(bVarints, "varints round trip at every byte boundary");
+	t.Check(olc::net::varint_size(127) == 1 && olc::net::varint_size(128) == 2 && olc::net::varint_size(UINT64_MAX) == 10, "varint sizes grow by a byte per 7 bits");
+
+	bool bZigzag = olc::net::zigzag(0) == 0 && olc::net::zigzag(-1) == 1 && olc::net::zigzag(1) == 2 && olc::net::zigzag(-2) == 3;
+	for (int64_t n : { INT64_MIN, int64_t(-300), int64_t(300), INT64_MAX })
+		bZigzag = bZigzag && olc::net::unzigzag(olc::net::zigzag(n)) == n;
+	t.Check(bZigzag, "zigzag keeps small numbers small and round trips the extremes");
+
+	schema_payload payload{ 123456, -300, true, TestMsgTypes::Sequenced, { 12.34f, -0.5f }, "player one",
+		{ 1, 300, 65535 }, { 0.25f, -8.0f }, { { 1.0f, 2.0f }, { -3.33f, 4.44f } }, 0x0123456789ABCDEFull };
+	test_message msg = olc::net::make_message<TestMsgTypes::Reliable>(payload);
+	t.Check(msg.header.id == TestMsgTypes::Reliable && msg.header.size == msg.body.size(), "encode sets the id and size");
+
+	schema_payload decoded{};
+	bool bDecoded = olc::net::decode<TestMsgTypes::Reliable>(msg, decoded);
+	t.Check(bDecoded && decoded.nEntity == payload.nEntity && decoded.nDelta == payload.nDelta && decoded.bAlive && decoded.kind == payload.kind
+		&& decoded.sName == payload.sName && decoded.vIds == payload.vIds && decoded.vWeights == payload.vWeights && decoded.nRaw == payload.nRaw, "every field round trips");
+	t.Check(bDecoded && SamePoint(decoded.position, payload.position) && decoded.vPath.size() == 2
+		&& SamePoint(decoded.vPath[0], payload.vPath[0]) && SamePoint(decoded.vPath[1], payload.vPath[1]), "fixed fields keep two decimal places, nested too");
+
+	// wrong id, a byte too many, and every truncation are refused
+	test_message other = msg;
+	other.header.id = TestMsgTypes::State;
+	t.Check(!olc::net::decode<TestMsgTypes::Reliable>(other, decoded), "a message with another id is refused");
+
+	test_message trailing = msg;
+	trailing.body.push_back(0);
+	t.Check(!olc::net::decode<TestMsgTypes::Reliable>(trailing, decoded), "trailing bytes are refused");
+
+	bool bTruncated = true;
+	for (size_t nSize = 0; nSize < msg.body.size(); nSize++)
+	{
+		test_message cut = msg;
+		cut.body.resize(nSize);
+		bTruncated = bTruncated && !olc::net::decode<TestMsgTypes::Reliable>(cut, decoded);
+	}
+	t.Check(bTruncated, "every truncation is refused");
+
+	// malformed fields, each otherwise valid up to that point
+	t.Check(!olc::net::decode<TestMsgTypes::Reliable>(MakeSchemaBody({ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }), decoded), "a varint longer than 10 bytes is refused");
+	t.Check(!olc::net::decode<TestMsgTypes::Reliable>(MakeSchemaBody({ 0x80, 0x80, 0x80, 0x80, 0x10 }), decoded), "an id beyond uint32_t is refused");
+	t.Check(!olc::net::decode<TestMsgTypes::Reliable>(MakeSchemaBody({ 1, 0x80, 0x80, 0x04 }), decoded), "a delta beyond int16_t is refused");
+	t.Check(!olc::net::decode<TestMsgTypes::Reliable>(MakeSchemaBody({ 1, 0, 2 }), decoded), "a bool other than 0 or 1 is refused");
+	t.Check(!olc::net::decode<TestMsgTypes::Reliable>(MakeSchemaBody({ 1, 0, 1, 0, 0, 0, 50, 'a' }), decoded), "a string longer than the body is refused");
+	t.Check(!olc::net::decode<TestMsgTypes::Reliable>(MakeSchemaBody({ 1, 0, 1, 0, 0, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F }), decoded), "a vector count beyond the body is refused before allocating");
+}
+
+// a copy of an encoded snapshot, as it would come off the wire
+test_message Received(const olc::net::shared_message<TestMsgTypes>& pMsg)
+{
+	return test_message(*pMsg);
+}
+
+// a body made of the given fields followed by nPayload bytes, for hand made malformed snapshots
+test_message MakeSnapshotBody(uint32_t nSequence, uint32_t nBaseline, uint32_t nSize, size_t nPayload)
+{
+	test_message msg;
+	olc::net::message_writer<TestMsgTypes> writer(msg);
+	writer.pack(nSequence, nBaseline, nSize);
+	std::vector<uint8_t> vPayload(nPayload, 0xAB);
+	writer.write(vPayload.data(), vPayload.size());
+	return msg;
+}
+
+void TestSnapshots(test_context& t)
+{
+	olc::net::snapshot_encoder<TestMsgTypes> encoder(4);
+	olc::net::snapshot_decoder<TestMsgTypes> decoder(4);
+
+	// first snapshot, nothing acknowledged yet, goes as a full state
+	test_message state1 = MakeState(1000, 1);
+	uint32_t nSeq1 = encoder.Push(state1);
+	test_message wire1 = Received(encoder.Encode(0));
+	t.Check(decoder.Decode(wire1) == nSeq1, "full state decodes");
+	t.Check(SameBody(wire1, state1), "full state round trips");
+
+	// a few bytes changed travel as a delta far smaller than the state
+	test_message state2 = state1;
+	state2.body[10] ^= 0xFF;
+	state2.body[500] ^= 0x0F;
+	uint32_t nSeq2 = encoder.Push(state2);
+	test_message wire2 = Received(encoder.Encode(nSeq1));
+	t.Check(wire2.body.size() < state2.body.size() / 10, "delta is small");
+	t.Check(decoder.Decode(wire2) == nSeq2, "delta decodes");
+	t.Check(SameBody(wire2, state2), "delta round trips");
+
+	// the next one is lost, the one after still goes against the last acknowledged baseline
+	test_message state3 = state2;
+	state3.body[20] ^= 0x55;
+	encoder.Push(state3);
+	encoder.Encode(nSeq2);
+
+	test_message state4 = state3;
+	state4.body.resize(1200, 7);
+	state4.header.size = uint32_t(state4.body.size());
+	uint32_t nSeq4 = encoder.Push(state4);
+	test_message wire4 = Received(encoder.Encode(nSeq2));
+	t.Check(decoder.Decode(wire4) == nSeq4, "delta after a loss decodes");
+	t.Check(SameBody(wire4, state4), "grown state round trips");
+
+	// shrinking works the same way
+	test_message state5 = state4;
+	state5.body.resize(300);
+	state5.header.size = uint32_t(state5.body.size());
+	uint32_t nSeq5 = encoder.Push(state5);
+	test_message wire5 = Received(encoder.Encode(nSeq4));
+	t.Check(decoder.Decode(wire5) == nSeq5, "shrunk delta decodes");
+	t.Check(SameBody(wire5, state5), "shrunk state round trips");
+
+	// a receiver that has lost its baseline refuses the delta, it is resynced with a full state
+	olc::net::snapshot_decoder<TestMsgTypes> restarted(4);
+	test_message state6 = state5;
+	state6.body[0] ^= 1;
+	uint32_t nSeq6 = encoder.Push(state6);
+	test_message wire6 = Received(encoder.Encode(nSeq5));
+	t.Check(restarted.Decode(wire6) == 0, "delta without its baseline is refused");
+	test_message resync = Received(encoder.Encode(0));
+	t.Check(restarted.Decode(resync) == nSeq6, "resync decodes");
+	t.Check(SameBody(resync, state6), "resync round trips");
+
+	// an acknowledgement older than the encoder's history gets a full state too
+	for (int i = 0; i < 5; i++)
+		encoder.Push(MakeState(300, uint8_t(i)));
+	test_message stale = Received(encoder.Encode(nSeq6));
+	t.Check(restarted.Decode(stale) == encoder.Sequence(), "stale baseline falls back to a full state");
+	t.Check(SameBody(stale, MakeState(300, 4)), "stale resync round trips");
+
+	// malformed bodies are refused before anything is allocated for them
+	test_message tooShort = MakeSnapshotBody(50, 0, 1000, 999);
+	t.Check(decoder.Decode(tooShort) == 0, "full state shorter than its size is refused");
+	test_message tooLong = MakeSnapshotBody(50, 0, 1000, 1001);
+	t.Check(decoder.Decode(tooLong) == 0, "full state longer than its size is refused");
+	test_message hugeFull = MakeSnapshotBody(50, 0, UINT32_MAX, 16);
+	t.Check(decoder.Decode(hugeFull) == 0, "full state claiming 4 GB is refused");
+	test_message hugeDelta = MakeSnapshotBody(50, nSeq5, UINT32_MAX, 16);
+	t.Check(decoder.Decode(hugeDelta) == 0, "delta claiming 4 GB is refused");
+	test_message truncated = Received(encoder.Encode(0));
+	truncated.body.resize(truncated.body.size() - 1);
+	t.Check(decoder.Decode(truncated) == 0, "truncated snapshot is refused");
+	test_message noHeader;
+	noHeader.body.resize(5);
+	t.Check(decoder.Decode(noHeader) == 0, "body shorter than the header is refused");
+}
+
+// compresses vInput, checks the block fits lz_bound and expands back to exactly the input.
+// The block is copied to a buffer of its own size so any read past it is a read past the heap
+std::vector<uint8_t> CompressRoundTrip(test_context& t, olc::net::lz_context& lz, const std::vector<uint8_t>& vInput, const std::string& sWhat)
+{
+	std::vector<uint8_t> vBlock(olc::net::lz_bound(vInput.size()));
+	size_t nBlock = lz.Compress(vInput.data(), vInput.size(), vBlock.data());
+	t.Check(nBlock <= vBlock.size(), sWhat + " fits lz_bound");
+	vBlock.resize(nBlock);
+	vBlock.shrink_to_fit();
+
+	std::vector<uint8_t> vOutput(vInput.size());
+	bool bOk = olc::net::lz_decompress(vBlock.data(), vBlock.size(), vOutput.data(), vOutput.size());
+	t.Check(bOk && vOutput == vInput, sWhat + " round trips");
+	return vBlock;
+}
+
+void TestCompression(test_context& t)
+{
+	// one context for everything, as a connection uses it, so stale match table entries are hit too
+	olc::net::lz_context lz;
+	std::mt19937 rng(17);
+
+	std::vector<uint8_t> vEmpty;
+	CompressRoundTrip(t, lz, vEmpty, "empty");
+
+	// every length around the match fence and the last literals
+	for (size_t n = 1; n < 40; n++)
+	{
+		std::vector<uint8_t> vShort(n, uint8_t('a'));
+		CompressRoundTrip(t, lz, vShort, "repeated " + std::to_string(n) + " bytes");
+	}
+
+	std::vector<uint8_t> vRandom(4096);
+	for (auto& b : vRandom)
+		b = uint8_t(rng());
+	std::vector<uint8_t> vRandomBlock = CompressRoundTrip(t, lz, vRandom, "incompressible");
+	t.Check(vRandomBlock.size() <= olc::net::lz_bound(vRandom.size()), "incompressible stays within its bound");
+
+	std::vector<uint8_t> vZeros(100000, 0);
+	std::vector<uint8_t> vZerosBlock = CompressRoundTrip(t, lz, vZeros, "zeros");
+	t.Check(vZerosBlock.size() < vZeros.size() / 100, "zeros compress well");
+
+	std::string sText;
+	while (sText.size() < 20000)
+		sText += "the quick brown fox jumps over the lazy dog " + std::to_string(sText.size() % 97) + "\n";
+	std::vector<uint8_t> vText(sText.begin(), sText.end());
+	std::vector<uint8_t> vTextBlock = CompressRoundTrip(t, lz, vText, "text");
+	t.Check(vTextBlock.size() < vText.size() / 2, "text compresses");
+
+	// over 64 KB, with a repeat further back than any offset can reach and one just within
+	std::vector<uint8_t> vLarge(200000);
+	for (auto& b : vLarge)
+		b = uint8_t(rng() % 4);
+	std::copy(vLarge.begin(), vLarge.begin() + 1000, vLarge.begin() + 100000);
+	std::copy(vLarge.begin() + 120000, vLarge.begin() + 121000, vLarge.begin() + 120000 + olc::net::nLZMaxOffset);
+	std::vector<uint8_t> vLargeBlock = CompressRoundTrip(t, lz, vLarge, "over 64 KB");
+
+	// a block cut short anywhere, or expanded into the wrong size, is refused
+	const std::vector<uint8_t>* vBlocks[] = { &vZerosBlock, &vTextBlock, &vLargeBlock };
+	const std::vector<uint8_t>* vInputs[] = { &vZeros, &vText, &vLarge };
+	for (size_t k = 0; k < 3; k++)
+	{
+		const std::vector<uint8_t>& vBlock = *vBlocks[k];
+		size_t nOut = vInputs[k]->size();
+
+		bool bAllRefused = true;
+		for (size_t nCut = 0; nCut < vBlock.size(); nCut += std::max<size_t>(1, vBlock.size() / 500))
+		{
+			std::vector<uint8_t> vCut(vBlock.begin(), vBlock.begin() + nCut);
+			std::vector<uint8_t> vOutput(nOut);
+			bAllRefused = bAllRefused && !olc::net::lz_decompress(vCut.data(), vCut.size(), vOutput.data(), vOutput.size());
+		}
+		t.Check(bAllRefused, "truncated block " + std::to_string(k) + " is refused");
+
+		std::vector<uint8_t> vSmaller(nOut - 1), vLarger(nOut + 1);
+		t.Check(!olc::net::lz_decompress(vBlock.data(), vBlock.size(), vSmaller.data(), vSmaller.size()), "block " + std::to_string(k) + " into too small a buffer is refused");
+		t.Check(!olc::net::lz_decompress(vBlock.data(), vBlock.size(), vLarger.data(), vLarger.size()), "block " + std::to_string(k) + " into too large a buffer is refused");
+	}
+
+	// corrupt bytes may still make a valid block, but never one that reads or writes out of bounds
+	for (int i = 0; i < 2000; i++)
+	{
+		std::vector<uint8_t> vCorrupt = vTextBlock;
+		for (int j = 0; j < 3; j++)
+			vCorrupt[rng() % vCorrupt.size()] = uint8_t(rng());
+		std::vector<uint8_t> vOutput(vText.size());
+		olc::net::lz_decompress(vCorrupt.data(), vCorrupt.size(), vOutput.data(), vOutput.size());
+	}
+
+	// the same sequence with an offset of 1 is fine, reaching before the output or an offset
+	// of 0 is refused
+	const uint8_t vGoodOffset[] = { 0x10, 'a', 0x01, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a' };
+	const uint8_t vBadOffset[] = { 0x10, 'a', 0x05, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a' };
+	const uint8_t vZeroOffset[] = { 0x10, 'a', 0x00, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a' };
+	std::vector<uint8_t> vOutput(10);
+	t.Check(olc::net::lz_decompress(vGoodOffset, sizeof(vGoodOffset), vOutput.data(), vOutput.size()) && vOutput == std::vector<uint8_t>(10, 'a'), "overlapping match expands");
+	t.Check(!olc::net::lz_decompress(vBadOffset, sizeof(vBadOffset), vOutput.data(), vOutput.size()), "offset before the output is refused");
+	t.Check(!olc::net::lz_decompress(vZeroOffset, sizeof(vZeroOffset), vOutput.data(), vOutput.size()), "offset of 0 is refused");
+}
+
+// what every kernel made of the same input at one simd level
+struct simd_outputs
+{
+	std::vector<int16_t> vQuantized;
+	std::vector<float> vDequantized;
+	std::vector<int16_t> vDeltas, vEncodeBaseline;
+	std::vector<int16_t> vDecoded, vDecodeBaseline;
+	std::vector<uint8_t> vXored;
+};
+
+// runs the kernels on nCount values starting one element in, so no vector load is aligned
+simd_outputs RunSimdKernels(const std::vector<float>& vFloats, const std::vector<int16_t>& vInts, size_t nCount, float fScale)
+{
+	simd_outputs out;
+
+	std::vector<int16_t> vQuantized(nCount + 1);
+	olc::net::simd::quantize(vFloats.data() + 1, vQuantized.data() + 1, nCount, fScale);
+	out.vQuantized.assign(vQuantized.begin() + 1, vQuantized.end());
+
+	std::vector<float> vDequantized(nCount + 1);
+	olc::net::simd::dequantize(vInts.data() + 1, vDequantized.data() + 1, nCount, fScale);
+	out.vDequantized.assign(vDequantized.begin() + 1, vDequantized.end());
+
+	std::vector<int16_t> vValues(vInts.begin(), vInts.begin() + nCount + 1);
+	std::vector<int16_t> vBaseline(vInts.rbegin(), vInts.rbegin() + nCount + 1);
+	olc::net::simd::delta_encode(vValues.data() + 1, vBaseline.data() + 1, nCount);
+	out.vDeltas.assign(vValues.begin() + 1, vValues.end());
+	out.vEncodeBaseline.assign(vBaseline.begin() + 1, vBaseline.end());
+
+	std::vector<int16_t> vDeltas(vInts.begin(), vInts.begin() + nCount + 1);
+	std::vector<int16_t> vDecodeBaseline(vInts.rbegin(), vInts.rbegin() + nCount + 1);
+	olc::net::simd::delta_decode(vDeltas.data() + 1, vDecodeBaseline.data() + 1, nCount);
+	out.vDecoded.assign(vDeltas.begin() + 1, vDeltas.end());
+	out.vDecodeBaseline.assign(vDecodeBaseline.begin() + 1, vDecodeBaseline.end());
+
+	std::vector<uint8_t> vBytes(nCount * 2 + 1), vOther(nCount * 2 + 1);
+	for (size_t i = 0; i < vBytes.size(); i++)
+	{
+		vBytes[i] = uint8_t(vInts[i % vInts.size()]);
+		vOther[i] = uint8_t(vInts[i % vInts.size()] >> 8);
+	}
+	olc::net::simd::xor_bytes(vBytes.data() + 1, vOther.data() + 1, nCount * 2);
+	out.vXored.assign(vBytes.begin() + 1, vBytes.end());
+	return out;
+}
+
+template <typename Value>
+bool SameBits(const std::vector<Value>& a, const std::vector<Value>& b)
+{
+	return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(Value)) == 0);
+}
+
+void TestSimdParity(test_context& t)
+{
+	// in range, halfway cases for the rounding, far out of range both ways, infinities, NaN
+	// and negative zero, in a pattern that lands on every lane position
+	const float vSpecial[] = { 0.0f, -0.0f, 1.5f, 2.5f, -1.5f, -2.5f, 0.49999997f, 511.99f, -512.0f, 1e9f, -1e9f,
+		std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN(),
+		-std::numeric_limits<float>::quiet_NaN(), 32767.0f / 64.0f, 32767.5f / 64.0f, -32768.5f / 64.0f, 123.456f };
+
+	std::mt19937 rng(15);
+	std::vector<float> vFloats(1100);
+	std::vector<int16_t> vInts(1100);
+	for (size_t i = 0; i < vFloats.size(); i++)
+	{
+		vFloats[i] = i % 3 == 0 ? vSpecial[(i / 3) % (sizeof(vSpecial) / sizeof(float))] : std::uniform_real_distribution<float>(-600.0f, 600.0f)(rng);
+		vInts[i] = int16_t(rng());
+	}
+	vInts[5] = INT16_MIN;
+	vInts[6] = INT16_MAX;
+
+	// every tail length past the widest vector, and one long run
+	std::vector<size_t> vCounts;
+	for (size_t n = 0; n <= 40; n++)
+		vCounts.push_back(n);
+	vCounts.push_back(1000 + 13);
+
+	const olc::net::simd::level detected = olc::net::simd::detect();
+	const char* vLevels[] = { "scalar", "sse2", "avx2" };
+	for (size_t nCount : vCounts)
+	{
+		olc::net::simd::active() = olc::net::simd::level::scalar;
+		simd_outputs reference = RunSimdKernels(vFloats, vInts, nCount, 64.0f);
+
+		for (int nLevel = 1; nLevel <= int(detected); nLevel++)
+		{
+			olc::net::simd::active() = olc::net::simd::level(nLevel);
+			simd_outputs out = RunSimdKernels(vFloats, vInts, nCount, 64.0f);
+
+			std::string sWhere = std::string(vLevels[nLevel]) + " with " + std::to_string(nCount) + " values";
+			t.Check(SameBits(out.vQuantized, reference.vQuantized), "quantize differs from scalar, " + sWhere);
+			t.Check(SameBits(out.vDequantized, reference.vDequantized), "dequantize differs from scalar, " + sWhere);
+			t.Check(SameBits(out.vDeltas, reference.vDeltas) && SameBits(out.vEncodeBaseline, reference.vEncodeBaseline), "delta encode differs from scalar, " + sWhere);
+			t.Check(SameBits(out.vDecoded, reference.vDecoded) && SameBits(out.vDecodeBaseline, reference.vDecodeBaseline), "delta decode differs from scalar, " + sWhere);
+			t.Check(SameBits(out.vXored, reference.vXored), "xor differs from scalar, " + sWhere);
+		}
+	}
+	olc::net::simd::active() = detected;
+
+	// the scalar reference itself: clamped at both ends, NaN to the maximum, halfway to even
+	const float vEdges[] = { 1e9f, -1e9f, std::numeric_limits<float>::quiet_NaN(), 2.5f / 64.0f, 3.5f / 64.0f };
+	const int16_t vExpected[] = { INT16_MAX, INT16_MIN, INT16_MAX, 2, 4 };
+	int16_t vOut[5];
+	olc::net::simd::quantize_scalar(vEdges, vOut, 5, 64.0f);
+	t.Check(std::equal(vOut, vOut + 5, vExpected), "scalar quantize clamps, maps NaN and rounds half to even");
+
+	// and a message round trip at the active level
+	olc::net::message<TestMsgTypes> msg;
+	std::vector<float> vBack;
+	olc::net::push_quantized(msg, vFloats.data() + 1, 37, 64.0f);
+	t.Check(olc::net::pop_quantized(msg, vBack, 64.0f) && vBack.size() == 37, "quantized message round trips");
+	bool bClose = true;
+	for (size_t i = 0; i < vBack.size(); i++)
+	{
+		float f = std::max(-512.0f, std::min(vFloats[i + 1], 32767.0f / 64.0f));
+		bClose = bClose && (std::isnan(vFloats[i + 1]) || std::abs(vBack[i] - f) <= 0.5f / 64.0f);
+	}
+	t.Check(bClose, "quantized values come back within half a step");
+}
+
+// one end of a udp link: a session whose datagrams cross a simulated link to the other end's socket
+struct udp_end
+{
+	udp_end(asio::io_context& context, const olc::net::link_conditions& link)
+		: pSocket(std::make_shared<olc::net::udp_socket>(context, asio::ip::udp::endpoint(asio::ip::make_address("127.0.0.1"), 0))),
+		stream(context), sim(stream, link, {})
+	{
+	}
+
+	std::shared_ptr<olc::net::udp_socket> pSocket;
+	asio::ip::tcp::socket stream; // the simulator's stream side, unused here
+	olc::net::link_simulator sim;
+	olc::net::connection_metrics metrics;
+	std::unique_ptr<olc::net::udp_session<TestMsgTypes>> pSession;
+	std::array<uint8_t, 2048> vBuffer;
+	asio::ip::udp::endpoint sender;
+};
+
+void TestUdpSession(test_context& t)
+{
+	asio::io_context context;
+
+	olc::net::link_conditions link;
+	link.tLatency = std::chrono::milliseconds(2);
+	link.tJitter = std::chrono::milliseconds(3);
+	link.dLoss = 0.1;
+	link.dReorder = 0.1;
+	link.dDuplicate = 0.1;
+
+	udp_end a(context, link), b(context, link);
+	auto Connect = [](udp_end& from, udp_end& to)
+	{
+		from.pSession = std::make_unique<olc::net::udp_session<TestMsgTypes>>(42, from.metrics,
+			[&from, remote = to.pSocket->Socket().local_endpoint()](const uint8_t* pData, size_t nBytes)
+			{
+				from.sim.SendTo(from.pSocket, pData, nBytes, remote);
+			});
+	};
+	Connect(a, b);
+	Connect(b, a);
+
+	// the reliable messages are the odd numbered ones
+	uint32_t nReliableNext = 1;
+	size_t nReliableBad = 0;
+	uint32_t nSequencedLast = 0;
+	size_t nSequenced = 0, nSequencedBad = 0;
+	auto Deliver = [&](olc::net::message<TestMsgTypes>&& msg)
+	{
+		uint32_t n = 0;
+		if (msg.body.size() >= sizeof(n))
+			std::memcpy(&n, msg.body.data(), sizeof(n));
+
+		if (msg.header.id == TestMsgTypes::Reliable)
+		{
+			if (n != nReliableNext)
+				nReliableBad++;
+			nReliableNext = n + 2;
+		}
+		else
+		{
+			if (nSequenced > 0 && n <= nSequencedLast)
+				nSequencedBad++;
+			nSequencedLast = n;
+			nSequenced++;
+		}
+	};
+
+	std::function<void(udp_end&)> Read = [&](udp_end& end)
+	{
+		end.pSocket->Socket().async_receive_from(asio::buffer(end.vBuffer), end.sender,
+			[&](std::error_code ec, size_t nBytes)
+			{
+				if (ec)
+					return;
+				end.pSession->Receive(end.vBuffer.data(), nBytes, std::chrono::steady_clock::now(), Deliver);
+				Read(end);
+			});
+	};
+	Read(a);
+	Read(b);
+
+	asio::steady_timer tick(context);
+	std::function<void()> Tick = [&]()
+	{
+		tick.expires_after(olc::net::nUdpTick);
+		tick.async_wait([&](std::error_code ec)
+			{
+				if (ec)
+					return;
+				a.pSession->Tick(std::chrono::steady_clock::now());
+				b.pSession->Tick(std::chrono::steady_clock::now());
+				Tick();
+			});
+	};
+	Tick();
+
+	// every 50th message is several fragments, the window of 256 is overrun so some wait their turn
+	const uint32_t nMessages = 1000;
+	for (uint32_t i = 0; i < nMessages; i++)
+	{
+		olc::net::message<TestMsgTypes> msg;
+		msg.header.id = i % 2 ? TestMsgTypes::Reliable : TestMsgTypes::Sequenced;
+		msg.body.resize(i % 50 == 0 ? 5000 : 8 + i % 100, uint8_t(i));
+		std::memcpy(msg.body.data(), &i, sizeof(i));
+		msg.header.size = uint32_t(msg.body.size());
+
+		olc::net::udp_channel channel = i % 2 ? olc::net::udp_channel::reliable : olc::net::udp_channel::sequenced;
+		a.pSession->Send(olc::net::make_shared_message(std::move(msg)), channel, std::chrono::steady_clock::now());
+	}
+
+	auto tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+	while (nReliableNext <= nMessages && std::chrono::steady_clock::now() < tGiveUp)
+		context.run_for(std::chrono::milliseconds(10));
+
+	t.Check(nReliableNext == nMessages + 1, "every reliable message arrived, next " + std::to_string(nReliableNext));
+	t.Check(nReliableBad == 0, "reliable messages arrived once each and in order");
+	t.Check(nSequenced > 0 && nSequenced < nMessages / 2, "some sequenced messages arrived, lost ones were not resent");
+	t.Check(nSequencedBad == 0, "sequenced messages only ever went forwards");
+	t.Check(a.metrics.Snapshot(0).nDatagramsResent > 0, "the lossy link made the sender resend");
+}
+
+// hits the calling thread's pool served from cache since before
+uint64_t PoolHits(const olc::net::pool_stats& before)
+{
+	return olc::net::buffer_pool::local()->stats().nHits - before.nHits;
+}
+
+void TestPool(test_context& t)
+{
+	using olc::net::buffer_pool;
+
+	// runs on threads of their own, so the pools are only ever touched by the checks here
+	std::thread([&]()
+		{
+			olc::net::pool_stats before = buffer_pool::local()->stats();
+
+			// every size up to a class's bound shares its blocks
+			buffer_pool::deallocate(buffer_pool::allocate(64), 64);
+			void* p = buffer_pool::allocate(1);
+			t.Check(PoolHits(before) == 1, "1 byte reuses a 64 byte block");
+			buffer_pool::deallocate(p, 1);
+
+			before = buffer_pool::local()->stats();
+			p = buffer_pool::allocate(65);
+			t.Check(PoolHits(before) == 0, "65 bytes is the next class up");
+			buffer_pool::deallocate(p, 65);
+
+			// 64 KB is the largest class, one byte more goes to the heap every time
+			before = buffer_pool::local()->stats();
+			buffer_pool::deallocate(buffer_pool::allocate(64 * 1024), 64 * 1024);
+			buffer_pool::deallocate(buffer_pool::allocate(64 * 1024), 64 * 1024);
+			t.Check(PoolHits(before) == 1, "64 KB blocks are pooled");
+
+			before = buffer_pool::local()->stats();
+			buffer_pool::deallocate(buffer_pool::allocate(64 * 1024 + 1), 64 * 1024 + 1);
+			buffer_pool::deallocate(buffer_pool::allocate(64 * 1024 + 1), 64 * 1024 + 1);
+			olc::net::pool_stats after = buffer_pool::local()->stats();
+			t.Check(after.nHits == before.nHits && after.nFrees == before.nFrees && after.nAllocations == before.nAllocations + 2, "bigger blocks come from the heap and go back to it");
+		}).join();
+
+	// blocks freed on another thread go onto the owner's remote list, and are reused once its
+	// own run dry
+	const size_t nBlocks = 100;
+	std::vector<void*> vBlocks;
+	std::mutex mux;
+	std::condition_variable cv;
+	int nStage = 0;
+	auto WaitFor = [&](int n)
+	{
+		std::unique_lock<std::mutex> lock(mux);
+		cv.wait(lock, [&]() { return nStage == n; });
+	};
+	auto Advance = [&]()
+	{
+		{
+			std::scoped_lock lock(mux);
+			nStage++;
+		}
+		cv.notify_all();
+	};
+
+	buffer_pool* pOwner = nullptr;
+	uint64_t nRemoteHits = 0, nRemoteFrees = 0;
+	std::thread thrOwner([&]()
+		{
+			pOwner = buffer_pool::local();
+			for (size_t i = 0; i < nBlocks; i++)
+				vBlocks.push_back(buffer_pool::allocate(200));
+			olc::net::pool_stats before = pOwner->stats();
+			Advance();
+			WaitFor(2);
+
+			for (auto& p : vBlocks)
+				p = buffer_pool::allocate(256);
+			nRemoteHits = PoolHits(before);
+			nRemoteFrees = pOwner->stats().nFrees - before.nFrees;
+
+			// some blocks are left cached and one still out as the thread exits
+			for (size_t i = 1; i < nBlocks; i++)
+				buffer_pool::deallocate(vBlocks[i], 256);
+		});
+
+	WaitFor(1);
+	for (auto& p : vBlocks)
+		buffer_pool::deallocate(p, 200);
+	Advance();
+	thrOwner.join();
+	t.Check(nRemoteHits == nBlocks && nRemoteFrees == nBlocks, "blocks freed on another thread were all reused, " + std::to_string(nRemoteHits) + " hits");
+
+	// the exited thread's pool gives its cache back and waits for a new thread to adopt it.
+	// The block still out finds its way back to that thread
+	t.Check(pOwner->stats().nBytesHeld == 0, "an exited thread's pool holds nothing");
+	buffer_pool::deallocate(vBlocks[0], 256);
+
+	buffer_pool* pAdopted = nullptr;
+	uint64_t nAdoptedHits = 0;
+	std::thread([&]()
+		{
+			pAdopted = buffer_pool::local();
+			olc::net::pool_stats before = pAdopted->stats();
+			buffer_pool::deallocate(buffer_pool::allocate(256), 256);
+			nAdoptedHits = PoolHits(before);
+		}).join();
+	t.Check(pAdopted == pOwner, "the next new thread adopts the abandoned pool");
+	t.Check(nAdoptedHits == 1, "and reuses the block freed after its old thread had gone");
+}
+
+void TestQueue(test_context& t)
+{
+	// a full queue turns pushes away, with the item left as it was, until the consumer makes room
+	olc::net::mpscqueue<std::string> qSmall(4);
+	bool bFilled = true;
+	for (int i = 0; i < 4; i++)
+		bFilled = bFilled && qSmall.try_push_back(std::to_string(i));
+	std::string sExtra = "extra";
+	t.Check(bFilled && qSmall.count() == 4, "a queue of 4 takes 4");
+	t.Check(!qSmall.try_push_back(std::move(sExtra)) && sExtra == "extra", "a full queue refuses a push and leaves the item alone");
+	t.Check(qSmall.pop_front() == "0" && qSmall.try_push_back(std::move(sExtra)), "a pop makes room for one more");
+
+	// round and round the ring, in order every lap
+	bool bInOrder = true;
+	int nNext = 1;
+	for (int nLap = 0; nLap < 1000; nLap++)
+	{
+		std::vector<std::string> vOut;
+		qSmall.drain(vOut);
+		for (auto& item : vOut)
+		{
+			if (item == "extra")
+				continue;
+			bInOrder = bInOrder && item == std::to_string(nNext++);
+		}
+		for (int i = 0; i < 3; i++)
+			qSmall.push_back(std::to_string(nNext + i));
+		bInOrder = bInOrder && qSmall.count() == 3;
+	}
+	t.Check(bInOrder, "items wrap around the ring in order");
+
+	// many producers on a small queue, so it is full and wrapping all the time. Each producer's
+	// items come out in its own order and none are lost. The consumer sleeps whenever it runs
+	// dry, a lost wake up would leave it waiting out the whole timeout
+	const size_t nProducers = 4;
+	const uint32_t nItems = 200000;
+	olc::net::mpscqueue<std::pair<size_t, uint32_t>> q(64);
+	std::vector<std::thread> vProducers;
+	for (size_t p = 0; p < nProducers; p++)
+	{
+		vProducers.emplace_back([&q, p]()
+			{
+				for (uint32_t n = 0; n < nItems; n++)
+					while (!q.try_push_back({ p, n }))
+						std::this_thread::yield();
+			});
+	}
+
+	std::vector<uint32_t> vNext(nProducers, 0);
+	size_t nTaken = 0, nOutOfOrder = 0, nTimedOut = 0;
+	std::vector<std::pair<size_t, uint32_t>> vBatch;
+	while (nTaken < nProducers * nItems)
+	{
+		if (!q.wait_for(std::chrono::seconds(2)))
+		{
+			nTimedOut++;
+			break;
+		}
+		vBatch.clear();
+		nTaken += q.drain(vBatch);
+		for (auto& item : vBatch)
+		{
+			if (item.second != vNext[item.first])
+				nOutOfOrder++;
+			vNext[item.first] = item.second + 1;
+		}
+	}
+	for (auto& thread : vProducers)
+		thread.join();
+
+	t.Check(nTaken == nProducers * nItems && q.empty(), "every item was taken, " + std::to_string(nTaken));
+	t.Check(nOutOfOrder == 0, "each producer's items came out in order");
+	t.Check(nTimedOut == 0, "the consumer was woken for every push it slept through");
+
+	// ping pong, the consumer goes to sleep before nearly every push
+	olc::net::mpscqueue<uint32_t> qPing, qPong;
+	const uint32_t nRounds = 20000;
+	std::thread thrPong([&]()
+		{
+			for (uint32_t n = 0; n < nRounds; n++)
+			{
+				if (!qPing.wait_for(std::chrono::seconds(2)))
+					return;
+				qPong.push_back(qPing.pop_front());
+			}
+		});
+	uint32_t nRounded = 0;
+	for (uint32_t n = 0; n < nRounds; n++)
+	{
+		qPing.push_back(n);
+		if (!qPong.wait_for(std::chrono::seconds(2)) || qPong.pop_front() != n)
+			break;
+		nRounded++;
+	}
+	thrPong.join();
+	t.Check(nRounded == nRounds, "no wake up was lost in " + std::to_string(nRounds) + " round trips, " + std::to_string(nRounded) + " made it");
+
+#if defined(__linux__)
+	// the descriptor only turns readable for a push after reset_event
+	olc::net::mpscqueue<uint32_t> qPolled;
+	pollfd fd{ qPolled.event_fd(), POLLIN, 0 };
+	t.Check(fd.fd >= 0 && poll(&fd, 1, 0) == 0, "an empty queue's descriptor is not readable");
+	qPolled.push_back(1);
+	t.Check(poll(&fd, 1, 1000) == 1, "a push makes the descriptor readable");
+	qPolled.reset_event();
+	t.Check(poll(&fd, 1, 0) == 1, "resetting with items still queued leaves it readable");
+	qPolled.clear();
+	qPolled.reset_event();
+	t.Check(poll(&fd, 1, 0) == 0, "reset once emptied, it is quiet again");
+#endif
+}
+
+// every id maps to its own item and the dense arrays agree with the table
+bool RegistryConsistent(olc::net::id_registry<uint32_t>& registry, const std::unordered_map<uint32_t, uint32_t>& mapModel)
+{
+	if (registry.size() != mapModel.size())
+		return false;
+	for (auto& entry : mapModel)
+	{
+		uint32_t* pItem = registry.find(entry.first);
+		if (!pItem || *pItem != entry.second)
+			return false;
+	}
+	for (size_t i = 0; i < registry.size(); i++)
+	{
+		uint32_t* pItem = registry.find(registry.id_at(i));
+		if (pItem != &registry.at(i))
+			return false;
+	}
+	return true;
+}
+
+void TestRegistry(test_context& t)
+{
+	olc::net::id_registry<uint32_t> registry;
+	std::unordered_map<uint32_t, uint32_t> mapModel;
+
+	// ids that are 7 mod 16 all hash to the last of the 16 starting slots, so their chain wraps
+	// round to the front of the table. An id of 16 hashes to slot 0, in the middle of it
+	for (uint32_t nID : { 7u, 23u, 39u, 16u, 55u, 71u })
+	{
+		registry.insert(nID, nID * 10);
+		mapModel[nID] = nID * 10;
+	}
+	t.Check(!registry.insert(23, 0), "an id already present is refused");
+	t.Check(RegistryConsistent(registry, mapModel), "a wrapped cluster is found in full");
+
+	// erasing from the head of the chain, which sits at the end of the table, shifts the rest back round
+	for (uint32_t nID : { 7u, 39u, 16u })
+	{
+		bool bErased = registry.erase(nID);
+		mapModel.erase(nID);
+		t.Check(bErased && !registry.find(nID), "erased " + std::to_string(nID) + " is gone");
+		t.Check(RegistryConsistent(registry, mapModel), "the cluster is intact after erasing " + std::to_string(nID));
+	}
+	t.Check(!registry.erase(7), "erasing an id not present does nothing");
+
+	// the last item is swap removed with itself
+	uint32_t nLastID = registry.id_at(registry.size() - 1);
+	uint32_t nBeforeID = registry.id_at(registry.size() - 2);
+	registry.erase(nLastID);
+	mapModel.erase(nLastID);
+	t.Check(registry.id_at(registry.size() - 1) == nBeforeID && RegistryConsistent(registry, mapModel), "erasing the last item leaves the others in place");
+
+	// churn against a model, growing past several rehashes and shrinking again
+	std::mt19937 rng(1234);
+	uint32_t nNextID = 1;
+	bool bConsistent = true;
+	for (int nStep = 0; nStep < 20000 && bConsistent; nStep++)
+	{
+		bool bGrow = (nStep / 5000) % 2 == 0;
+		if (mapModel.empty() || rng() % 100 < (bGrow ? 65u : 35u))
+		{
+			uint32_t nID = nNextID++;
+			registry.insert(nID, nID ^ 0x5A5A);
+			mapModel[nID] = nID ^ 0x5A5A;
+		}
+		else
+		{
+			// erase either the last in the dense array or one at random
+			size_t nIndex = rng() % 4 == 0 ? registry.size() - 1 : rng() % registry.size();
+			uint32_t nID = registry.id_at(nIndex);
+			bConsistent = registry.erase(nID);
+			mapModel.erase(nID);
+		}
+
+		if (nStep % 97 == 0)
+			bConsistent = bConsistent && RegistryConsistent(registry, mapModel);
+	}
+	t.Check(bConsistent && RegistryConsistent(registry, mapModel), "registry matches its model through insert and erase churn, " + std::to_string(registry.size()) + " left");
+
+	for (uint32_t nID = 1; nID < nNextID; nID++)
+		bConsistent = bConsistent && (registry.find(nID) != nullptr) == (mapModel.count(nID) == 1);
+	t.Check(bConsistent, "erased ids are not found, present ones are");
+
+	registry.clear();
+	t.Check(registry.empty() && !registry.find(1) && registry.insert(1, 1), "clear empties it for reuse");
+}
+
+// checks every client's messages reach it in order and one at a time, while they keep being
+// moved between shards. Ids are handed out from 10000
+struct shard_server : olc::net::server_interface<TestMsgTypes>
+{
+	static constexpr size_t nMaxClients = 64;
+
+	shard_server(uint16_t nPort, size_t nIOThreads)
+		: olc::net::server_interface<TestMsgTypes>(nPort, nIOThreads)
+	{
+	}
+
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<TestMsgTypes>> /*client*/) override
+	{
+		return true;
+	}
+
+	void OnShardMessage(olc::net::server_shard<TestMsgTypes>& shard, std::shared_ptr<olc::net::connection<TestMsgTypes>> client, olc::net::message<TestMsgTypes>& msg) override
+	{
+		size_t nClient = client->GetID() - 10000;
+		if (nClient >= nMaxClients)
+			return;
+
+		if (vBusy[nClient].exchange(true))
+			nOverlapped++;
+
+		uint32_t n = 0;
+		std::memcpy(&n, msg.body.data(), sizeof(n));
+		if (n != vNext[nClient])
+			nOutOfOrder++;
+		vNext[nClient] = n + 1;
+
+		// most messages move their client on, so many are still on their way to the old shard
+		if (n % 3 != 0 && shard.GetClient(client->GetID()))
+		{
+			shard.MoveClient(client, (shard.Index() + 1 + n % 2) % ShardCount());
+			nMoved++;
+		}
+
+		vBusy[nClient] = false;
+		nReceived++;
+	}
+
+	std::array<std::atomic<bool>, nMaxClients> vBusy{};
+	std::array<uint32_t, nMaxClients> vNext{};
+	std::atomic<size_t> nReceived{ 0 };
+	std::atomic<size_t> nOutOfOrder{ 0 };
+	std::atomic<size_t> nOverlapped{ 0 };
+	std::atomic<size_t> nMoved{ 0 };
+};
+
+void TestShardMoves(test_context& t)
+{
+	// several io threads push into each shard's queue at once
+	shard_server server(60917, 8);
+	server.EnableShards(4);
+	if (!t.Check(server.Start(), "server starts"))
+		return;
+
+	const size_t nClients = 32;
+	const uint32_t nMessages = 4000;
+	std::vector<std::unique_ptr<olc::net::client_interface<TestMsgTypes>>> vClients;
+	for (size_t i = 0; i < nClients; i++)
+	{
+		vClients.push_back(std::make_unique<olc::net::client_interface<TestMsgTypes>>());
+		vClients.back()->Connect("127.0.0.1", 60917);
+	}
+
+	auto tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (server.GetStats().nConnections < nClients && std::chrono::steady_clock::now() < tGiveUp)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	for (uint32_t n = 0; n < nMessages; n++)
+	{
+		for (auto& client : vClients)
+		{
+			olc::net::message<TestMsgTypes> msg;
+			msg.header.id = TestMsgTypes::Sequenced;
+			msg << n;
+			client->Send(msg);
+		}
+	}
+
+	tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+	while (server.nReceived < nClients * nMessages && std::chrono::steady_clock::now() < tGiveUp)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	server.Stop();
+
+	t.Check(server.nReceived == nClients * nMessages, "every message arrived, " + std::to_string(server.nReceived) + " of " + std::to_string(nClients * nMessages));
+	t.Check(server.nOutOfOrder == 0, "each client's messages arrived in order, " + std::to_string(server.nOutOfOrder) + " did not");
+	t.Check(server.nOverlapped == 0, "no client was handled on two shards at once");
+	t.Check(server.nMoved > nClients * 10, "clients kept moving, " + std::to_string(server.nMoved) + " moves");
+}
+
+// checks every client's messages reach OnMessage in order and one at a time on the executor's
+// workers, while different clients' run at once. Ids are handed out from 10000
+struct executor_server : olc::net::server_interface<TestMsgTypes>
+{
+	static constexpr size_t nMaxClients = 64;
+
+	using olc::net::server_interface<TestMsgTypes>::server_interface;
+
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<TestMsgTypes>> /*client*/) override
+	{
+		return true;
+	}
+
+	void OnMessage(std::shared_ptr<olc::net::connection<TestMsgTypes>> client, const olc::net::message<TestMsgTypes>& msg) override
+	{
+		size_t nClient = client->GetID() - 10000;
+		if (nClient >= nMaxClients)
+			return;
+
+		if (vBusy[nClient].exchange(true))
+			nOverlapped++;
+
+		size_t nRunning = ++nRunningNow;
+		size_t nPeak = nRunningPeak.load();
+		while (nRunning > nPeak && !nRunningPeak.compare_exchange_weak(nPeak, nRunning));
+
+		uint32_t n = 0;
+		std::memcpy(&n, msg.body.data(), sizeof(n));
+		if (n != vNext[nClient])
+			nOutOfOrder++;
+		vNext[nClient] = n + 1;
+
+		// a slow handler now and then, so others' messages pile up behind it
+		if (n % 64 == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		nRunningNow--;
+		vBusy[nClient] = false;
+		nReceived++;
+	}
+
+	std::array<std::atomic<bool>, nMaxClients> vBusy{};
+	std::array<uint32_t, nMaxClients> vNext{};
+	std::atomic<size_t> nRunningNow{ 0 };
+	std::atomic<size_t> nRunningPeak{ 0 };
+	std::atomic<size_t> nReceived{ 0 };
+	std::atomic<size_t> nOutOfOrder{ 0 };
+	std::atomic<size_t> nOverlapped{ 0 };
+};
+
+// every handler waits until the gate opens
+struct gated_server : olc::net::server_interface<TestMsgTypes>
+{
+	using olc::net::server_interface<TestMsgTypes>::server_interface;
+
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<TestMsgTypes>> /*client*/) override
+	{
+		return true;
+	}
+
+	void OnClientValidated(std::shared_ptr<olc::net::connection<TestMsgTypes>> /*client*/) override
+	{
+		bValidated = true;
+	}
+
+	void OnMessage(std::shared_ptr<olc::net::connection<TestMsgTypes>> /*client*/, const olc::net::message<TestMsgTypes>& msg) override
+	{
+		while (!bOpen)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		uint32_t n = 0;
+		std::memcpy(&n, msg.body.data(), sizeof(n));
+		if (n != nNext++)
+			nOutOfOrder++;
+		nReceived++;
+	}
+
+	std::atomic<bool> bValidated{ false };
+	std::atomic<bool> bOpen{ false };
+	uint32_t nNext = 0;
+	std::atomic<size_t> nReceived{ 0 };
+	std::atomic<size_t> nOutOfOrder{ 0 };
+};
+
+void TestExecutor(test_context& t)
+{
+	executor_server server(60919, 4);
+	server.EnableExecutor(4);
+	if (!t.Check(server.Start(), "server starts"))
+		return;
+
+	const size_t nClients = 16;
+	const uint32_t nMessages = 2000;
+	std::vector<std::unique_ptr<olc::net::client_interface<TestMsgTypes>>> vClients;
+	for (size_t i = 0; i < nClients; i++)
+	{
+		vClients.push_back(std::make_unique<olc::net::client_interface<TestMsgTypes>>());
+		vClients.back()->Connect("127.0.0.1", 60919);
+	}
+
+	auto tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (server.GetStats().nConnections < nClients && std::chrono::steady_clock::now() < tGiveUp)
+		server.Update(-1, std::chrono::milliseconds(10));
+
+	for (uint32_t n = 0; n < nMessages; n++)
+	{
+		for (auto& client : vClients)
+		{
+			olc::net::message<TestMsgTypes> msg;
+			msg.header.id = TestMsgTypes::Sequenced;
+			msg << n;
+			client->Send(msg);
+		}
+	}
+
+	tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+	while (server.nReceived < nClients * nMessages && std::chrono::steady_clock::now() < tGiveUp)
+		server.Update(-1, std::chrono::milliseconds(10));
+	server.Stop();
+
+	t.Check(server.nReceived == nClients * nMessages, "every message was handled, " + std::to_string(server.nReceived) + " of " + std::to_string(nClients * nMessages));
+	t.Check(server.nOutOfOrder == 0, "each client's messages were handled in order, " + std::to_string(server.nOutOfOrder) + " were not");
+	t.Check(server.nOverlapped == 0, "no client's messages were handled two at once");
+	t.Check(server.nRunningPeak > 1, "different clients were handled in parallel, at most " + std::to_string(server.nRunningPeak) + " at once");
+
+	// once stopped, what is still dispatched is handled straight away on the caller's thread
+	std::thread::id idHandler;
+	olc::net::message_executor<TestMsgTypes> executor(2,
+		[&](std::shared_ptr<olc::net::connection<TestMsgTypes>>, olc::net::message<TestMsgTypes>&) { idHandler = std::this_thread::get_id(); });
+	executor.Stop();
+	std::vector<olc::net::owned_message<TestMsgTypes>> vLate(1);
+	executor.Dispatch(vLate);
+	t.Check(idHandler == std::this_thread::get_id(), "a message dispatched after Stop is handled on the calling thread");
+
+	// handlers that cannot keep up leave what the executor has no room for in the incoming queue
+	gated_server gated(60922);
+	gated.EnableExecutor(2, 16);
+	if (!t.Check(gated.Start(), "gated server starts"))
+		return;
+
+	olc::net::client_interface<TestMsgTypes> client;
+	client.Connect("127.0.0.1", 60922);
+	tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (!gated.bValidated && std::chrono::steady_clock::now() < tGiveUp)
+		gated.Update(-1, std::chrono::milliseconds(10));
+
+	const uint32_t nFlood = 200;
+	for (uint32_t n = 0; n < nFlood; n++)
+	{
+		olc::net::message<TestMsgTypes> msg;
+		msg.header.id = TestMsgTypes::Sequenced;
+		msg << n;
+		client.Send(msg);
+	}
+
+	tGiveUp = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+	while (std::chrono::steady_clock::now() < tGiveUp)
+		gated.Update(-1, std::chrono::milliseconds(10));
+	size_t nQueued = gated.GetStats().nIncomingQueueDepth;
+	t.Check(nQueued >= nFlood - 16, "messages beyond the executor's limit stay in the incoming queue, " + std::to_string(nQueued) + " of " + std::to_string(nFlood));
+
+	gated.bOpen = true;
+	tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (gated.nReceived < nFlood && std::chrono::steady_clock::now() < tGiveUp)
+		gated.Update(-1, std::chrono::milliseconds(10));
+	gated.Stop();
+	t.Check(gated.nReceived == nFlood && gated.nOutOfOrder == 0, "once the handlers catch up every message is handled, in order");
+}
+
+// two ends of a tcp connection over loopback, on a port the OS picks
+struct tcp_pair
+{
+	explicit tcp_pair(asio::io_context& context)
+		: a(context), b(context)
+	{
+		asio::ip::tcp::acceptor acceptor(context, asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+		a.connect(acceptor.local_endpoint());
+		acceptor.accept(b);
+	}
+
+	asio::ip::tcp::socket a;
+	asio::ip::tcp::socket b;
+};
+
+template <typename Option>
+int BufferSize(asio::ip::tcp::socket& socket)
+{
+	Option option;
+	socket.get_option(option);
+	return option.value();
+}
+
+// feeds a tuner two intervals far busier than any buffer could need, so each direction wants
+// nAutoTuneMax. Returns whether the tuner gave up
+bool RunTuner(asio::ip::tcp::socket& socket, const olc::net::socket_options& options)
+{
+	olc::net::socket_tuner tuner(options);
+	for (int i = 0; i < 3; i++)
+	{
+		tuner.OnRead(socket, size_t(1) << 40);
+		tuner.OnWrite(socket, size_t(1) << 40, true);
+		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+	}
+	return tuner.IsSettled();
+}
+
+void TestSocketTuner(test_context& t)
+{
+	asio::io_context context;
+	tcp_pair pair(context);
+
+	olc::net::socket_options defaults;
+	olc::net::apply_socket_options(pair.a, defaults);
+	asio::ip::tcp::no_delay noDelay;
+	pair.a.get_option(noDelay);
+	t.Check(!noDelay.value(), "Nagle stays on unless asked for");
+
+#if defined(__linux__)
+	// Linux's own tuning is left alone while no buffer is set
+	olc::net::socket_options untouched;
+	untouched.bAutoTune = true;
+	t.Check(olc::net::socket_tuner(untouched).IsSettled(), "buffers the options did not set are not tuned");
+#endif
+
+	olc::net::socket_options options;
+	options.nSendBuffer = 8192;
+	options.nReceiveBuffer = 8192;
+	options.bAutoTune = true;
+	options.nAutoTuneMax = 64 * 1024;
+	olc::net::apply_socket_options(pair.a, options);
+
+	// within what the system allows it grows to the target and keeps going
+	bool bSettled = RunTuner(pair.a, options);
+	t.Check(BufferSize<asio::socket_base::send_buffer_size>(pair.a) >= options.nAutoTuneMax, "send buffer grew to the target");
+	t.Check(BufferSize<asio::socket_base::receive_buffer_size>(pair.a) >= options.nAutoTuneMax, "receive buffer grew to the target");
+	t.Check(!bSettled, "a buffer the system gave in full is tuned further");
+
+	// asked for more than the system's limit it takes what it gets and stops there, never shrinking
+	options.nAutoTuneMax = 1 << 30;
+	int nSendBefore = BufferSize<asio::socket_base::send_buffer_size>(pair.a);
+	bSettled = RunTuner(pair.a, options);
+	int nSend = BufferSize<asio::socket_base::send_buffer_size>(pair.a);
+	t.Check(nSend >= nSendBefore && nSend < options.nAutoTuneMax, "send buffer grew up to the system limit, " + std::to_string(nSend));
+	t.Check(bSettled, "the tuner stops at the system limit");
+}
+
+void TestLinkClose(test_context& t)
+{
+	asio::io_context context;
+	tcp_pair pair(context);
+
+	// at 1000 bytes a second the second write is still waiting to get onto the link for seconds
+	olc::net::link_conditions link;
+	link.nBytesPerSecond = 1000;
+	olc::net::link_simulator sim(pair.a, link, {});
+
+	std::vector<uint8_t> vData(2000, 7);
+	std::vector<asio::const_buffer> vBuffers = { asio::buffer(vData) };
+	std::vector<std::error_code> vResults;
+	auto Record = [&](std::error_code ec, std::size_t) { vResults.push_back(ec); };
+
+	sim.Write(vBuffers, Record);
+	sim.Write(vBuffers, Record);
+	context.run_for(std::chrono::milliseconds(50));
+	t.Check(vResults.empty(), "writes wait on the capped link");
+
+	pair.a.close();
+	sim.Close();
+	sim.Write(vBuffers, Record);
+	t.Check(vResults.empty(), "handlers are not called from inside Close or Write");
+
+	context.run_for(std::chrono::milliseconds(100));
+	bool bAllAborted = vResults.size() == 3;
+	for (auto& ec : vResults)
+		bAllAborted = bAllAborted && ec == asio::error::operation_aborted;
+	t.Check(bAllAborted, "writes pending at the close and made after it fail as aborted, " + std::to_string(vResults.size()) + " completed");
+
+	context.restart();
+	t.Check(context.run_for(std::chrono::milliseconds(10)) == 0, "no timer fires after the close");
+}
+
+// keeps its one client's connection and every OnBackpressure call, with the queue depth then
+struct backpressure_server : olc::net::server_interface<TestMsgTypes>
+{
+	using olc::net::server_interface<TestMsgTypes>::server_interface;
+
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<TestMsgTypes>> /*client*/) override
+	{
+		return true;
+	}
+
+	void OnClientValidated(std::shared_ptr<olc::net::connection<TestMsgTypes>> client) override
+	{
+		std::scoped_lock lock(mux);
+		pClient = client;
+	}
+
+	void OnBackpressure(std::shared_ptr<olc::net::connection<TestMsgTypes>> client, bool bActive) override
+	{
+		std::scoped_lock lock(mux);
+		vEvents.push_back({ bActive, client->GetStats().nOutQueueDepth });
+	}
+
+	std::shared_ptr<olc::net::connection<TestMsgTypes>> Client()
+	{
+		std::scoped_lock lock(mux);
+		return pClient;
+	}
+
+	std::mutex mux;
+	std::shared_ptr<olc::net::connection<TestMsgTypes>> pClient;
+	std::vector<std::pair<bool, uint64_t>> vEvents;
+};
+
+struct backpressure_run
+{
+	size_t nSent = 0;
+	std::vector<uint32_t> vReceived;
+	olc::net::connection_stats stats;
+	std::vector<std::pair<bool, uint64_t>> vEvents;
+	std::chrono::steady_clock::duration tSending{};
+};
+
+// The server sends nMessages numbered 1000 byte State messages at once to a client behind a
+// 200 kB/s link, far faster than they can leave, and the client counts what arrives
+backpressure_run RunBackpressure(const olc::net::backpressure_limits& limits, uint32_t nMessages)
+{
+	backpressure_run run;
+
+	olc::net::link_conditions link;
+	link.nBytesPerSecond = 200 * 1000;
+
+	backpressure_server server(60918);
+	server.SetBackpressure(limits);
+	server.SetLinkConditions(link);
+	if (!server.Start())
+		return run;
+
+	olc::net::client_interface<TestMsgTypes> client;
+	client.Connect("127.0.0.1", 60918);
+
+	auto tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (!server.Client() && std::chrono::steady_clock::now() < tGiveUp)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	auto pConnection = server.Client();
+	if (!pConnection)
+		return run;
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (uint32_t n = 0; n < nMessages; n++)
+	{
+		test_message msg = MakeState(1000, uint8_t(n));
+		std::memcpy(msg.body.data(), &n, sizeof(n));
+		pConnection->Send(std::move(msg));
+		run.nSent++;
+	}
+	run.tSending = std::chrono::steady_clock::now() - tStart;
+
+	// done once the queue has emptied and nothing more has arrived for a while
+	tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	auto tQuiet = std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+	while (std::chrono::steady_clock::now() < tGiveUp)
+	{
+		if (client.Incoming().wait_for(std::chrono::milliseconds(10)))
+		{
+			auto msg = client.Incoming().pop_front();
+			uint32_t n = 0;
+			std::memcpy(&n, msg.msg.body.data(), sizeof(n));
+			run.vReceived.push_back(n);
+			tQuiet = std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+		}
+		else if (pConnection->GetStats().nOutQueueDepth == 0 && std::chrono::steady_clock::now() > tQuiet)
+		{
+			break;
+		}
+	}
+
+	run.stats = pConnection->GetStats();
+	client.Disconnect();
+	server.Stop();
+
+	std::scoped_lock lock(server.mux);
+	run.vEvents = server.vEvents;
+	return run;
+}
+
+bool InOrder(const std::vector<uint32_t>& v)
+{
+	return std::is_sorted(v.begin(), v.end()) && std::adjacent_find(v.begin(), v.end()) == v.end();
+}
+
+void TestBackpressure(test_context& t)
+{
+	olc::net::backpressure_limits limits;
+	limits.nHighMessages = 20;
+	limits.nLowMessages = 5;
+	const uint32_t nMessages = 200;
+
+	// none queues everything and only reports. Backpressure starts at the high watermark and
+	// only ends at the low one, once per crossing
+	limits.policy = olc::net::backpressure_policy::none;
+	backpressure_run run = RunBackpressure(limits, nMessages);
+	t.Check(run.vReceived.size() == nMessages && InOrder(run.vReceived), "none: every message arrived in order, " + std::to_string(run.vReceived.size()));
+	t.Check(run.stats.nMessagesDropped == 0, "none: nothing dropped");
+	bool bAlternates = !run.vEvents.empty() && run.vEvents.size() % 2 == 0;
+	for (size_t i = 0; i < run.vEvents.size(); i++)
+		bAlternates = bAlternates && run.vEvents[i].first == (i % 2 == 0);
+	t.Check(bAlternates, "none: OnBackpressure alternates on and off and ends off, " + std::to_string(run.vEvents.size()) + " calls");
+	bool bHysteresis = true;
+	for (auto& event : run.vEvents)
+		bHysteresis = bHysteresis && (event.first || event.second <= limits.nLowMessages);
+	t.Check(bHysteresis, "none: backpressure only ends at the low watermark");
+
+	// drop_newest keeps the front of the stream
+	limits.policy = olc::net::backpressure_policy::drop_newest;
+	run = RunBackpressure(limits, nMessages);
+	t.Check(run.stats.nMessagesDropped > 0 && run.vReceived.size() + run.stats.nMessagesDropped == nMessages, "drop_newest: what did not arrive was dropped, " + std::to_string(run.stats.nMessagesDropped));
+	t.Check(InOrder(run.vReceived) && !run.vReceived.empty() && run.vReceived.front() == 0, "drop_newest: the oldest arrived, in order");
+	t.Check(run.vReceived.size() >= limits.nHighMessages && run.vReceived.back() != nMessages - 1, "drop_newest: the newest were the ones dropped");
+
+	// drop_oldest keeps the end of the stream
+	limits.policy = olc::net::backpressure_policy::drop_oldest;
+	run = RunBackpressure(limits, nMessages);
+	t.Check(run.stats.nMessagesDropped > 0 && run.vReceived.size() + run.stats.nMessagesDropped == nMessages, "drop_oldest: what did not arrive was dropped, " + std::to_string(run.stats.nMessagesDropped));
+	t.Check(InOrder(run.vReceived) && !run.vReceived.empty() && run.vReceived.back() == nMessages - 1, "drop_oldest: the newest arrived, in order");
+
+	// coalesce, every message has the same id so a queued one is replaced by the latest
+	limits.policy = olc::net::backpressure_policy::coalesce;
+	run = RunBackpressure(limits, nMessages);
+	t.Check(run.stats.nMessagesCoalesced > 0 && run.vReceived.size() + run.stats.nMessagesCoalesced == nMessages, "coalesce: what did not arrive was replaced, " + std::to_string(run.stats.nMessagesCoalesced));
+	t.Check(InOrder(run.vReceived) && !run.vReceived.empty() && run.vReceived.back() == nMessages - 1, "coalesce: the latest arrived, in order");
+	t.Check(run.stats.nMessagesDropped == 0, "coalesce: nothing dropped");
+
+	// block holds the sender back while the link drains, 200 kB take a second to leave
+	limits.policy = olc::net::backpressure_policy::block;
+	limits.tBlockTimeout = std::chrono::seconds(5);
+	run = RunBackpressure(limits, nMessages);
+	t.Check(run.vReceived.size() == nMessages && InOrder(run.vReceived), "block: every message arrived in order, " + std::to_string(run.vReceived.size()));
+	t.Check(run.stats.nMessagesDropped == 0, "block: nothing dropped");
+	t.Check(run.tSending > std::chrono::milliseconds(500), "block: the sender waited for the link");
+
+	// and gives up, dropping, once tBlockTimeout has passed
+	limits.tBlockTimeout = std::chrono::milliseconds(1);
+	run = RunBackpressure(limits, nMessages);
+	t.Check(run.stats.nMessagesDropped > 0 && run.vReceived.size() + run.stats.nMessagesDropped == nMessages, "block: dropped after the timeout, " + std::to_string(run.stats.nMessagesDropped));
+	t.Check(run.tSending < std::chrono::milliseconds(500), "block: the sender did not wait past the timeout");
+}
+
+// waits for the client's next message, an empty one if none comes
+test_message NextMessage(olc::net::client_interface<TestMsgTypes>& client)
+{
+	if (!client.Incoming().wait_for(std::chrono::seconds(5)))
+		return {};
+	return client.Incoming().pop_front().msg;
+}
+
+void TestReceiveBuffer(test_context& t)
+{
+	backpressure_server server(60921);
+	if (!server.Start())
+	{
+		t.Check(false, "server starts");
+		return;
+	}
+
+	olc::net::client_interface<TestMsgTypes> client;
+	client.SetMaxBodySize(256 * 1024);
+	client.Connect("127.0.0.1", 60921);
+
+	auto tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (!server.Client() && std::chrono::steady_clock::now() < tGiveUp)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	auto pConnection = server.Client();
+	if (!pConnection)
+	{
+		t.Check(false, "client connects");
+		return;
+	}
+
+	uint64_t nIdleBytes = client.GetStats().nRecvBufferBytes;
+	t.Check(nIdleBytes > 0 && nIdleBytes <= 16 * 1024, "a new connection starts with a small receive buffer, " + std::to_string(nIdleBytes));
+
+	// a frame up to the limit is made room for, and the room given back once it is consumed
+	test_message big = MakeState(200 * 1024, 7);
+	pConnection->Send(big);
+	test_message received = NextMessage(client);
+	t.Check(SameBody(received, big), "a frame bigger than the buffer arrives whole");
+
+	pConnection->Send(MakeState(16, 1));
+	received = NextMessage(client);
+	t.Check(received.body.size() == 16, "a small frame after it arrives");
+
+	// the io thread resizes as it starts the next read, just after handing the message over
+	tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	while (client.GetStats().nRecvBufferBytes != nIdleBytes && std::chrono::steady_clock::now() < tGiveUp)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	t.Check(client.GetStats().nRecvBufferBytes == nIdleBytes, "the buffer shrinks back once the big frame is consumed, " + std::to_string(client.GetStats().nRecvBufferBytes));
+
+	// a frame over the limit closes the connection before anything is allocated for it
+	pConnection->Send(MakeState(300 * 1024, 3));
+	tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (client.IsConnected() && std::chrono::steady_clock::now() < tGiveUp)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	t.Check(!client.IsConnected(), "a frame over the limit closes the connection");
+	t.Check(client.Incoming().empty(), "a frame over the limit is never delivered");
+	t.Check(client.GetStats().nRecvBufferBytes <= nIdleBytes, "no room was made for it");
+
+	client.Disconnect();
+	server.Stop();
+}
+
+#ifdef ASIO_HAS_CO_AWAIT
+olc::net::message<TestMsgTypes> MakeRequest(TestMsgTypes id, uint32_t n)
+{
+	olc::net::message<TestMsgTypes> msg;
+	msg.header.id = id;
+	msg << n;
+	return msg;
+}
+
+uint32_t BodyNumber(const olc::net::message<TestMsgTypes>& msg)
+{
+	uint32_t n = 0;
+	if (msg.body.size() >= sizeof(n))
+		std::memcpy(&n, msg.body.data(), sizeof(n));
+	return n;
+}
+
+// Reliable is answered through reply_to, Sequenced is echoed back as it came, which is not a
+// reply, and State has the server drop the client
+struct request_server : olc::net::server_interface<TestMsgTypes>
+{
+	using olc::net::server_interface<TestMsgTypes>::server_interface;
+
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<TestMsgTypes>> /*client*/) override
+	{
+		return true;
+	}
+
+	void OnMessage(std::shared_ptr<olc::net::connection<TestMsgTypes>> client, const olc::net::message<TestMsgTypes>& msg) override
+	{
+		olc::net::message<TestMsgTypes> reply = msg;
+		switch (msg.header.id)
+		{
+		case TestMsgTypes::Reliable:
+			olc::net::reply_to(reply, msg);
+			client->Send(std::move(reply));
+			break;
+
+		case TestMsgTypes::Sequenced:
+			client->Send(std::move(reply));
+			break;
+
+		case TestMsgTypes::State:
+			// a number other than 0 is sent back as an ordinary message just before the drop
+			if (BodyNumber(msg) != 0)
+				client->Send(MakeRequest(TestMsgTypes::Sequenced, BodyNumber(msg)));
+			client->Disconnect();
+			break;
+		}
+	}
+};
+
+asio::awaitable<void> RunRequests(test_context& t, olc::net::client_interface<TestMsgTypes>& client, olc::net::client_interface<TestMsgTypes>& never)
+{
+	using namespace std::chrono_literals;
+
+	auto reply = co_await client.request(MakeRequest(TestMsgTypes::Reliable, 7), 5s);
+	t.Check(reply && BodyNumber(*reply) == 7, "a request gets its reply");
+	t.Check(client.Incoming().empty(), "a reply skips Incoming()");
+
+	// several at once, each resumed with its own reply
+	const uint32_t nRequests = 8;
+	uint32_t nMatched = 0, nDone = 0;
+	auto executor = co_await asio::this_coro::executor;
+	for (uint32_t i = 0; i < nRequests; i++)
+	{
+		asio::co_spawn(executor,
+			[&client, &nMatched, &nDone, i]() -> asio::awaitable<void>
+			{
+				auto reply = co_await client.request(MakeRequest(TestMsgTypes::Reliable, 100 + i), 5s);
+				if (reply && BodyNumber(*reply) == 100 + i)
+					nMatched++;
+				nDone++;
+			}, asio::detached);
+	}
+	asio::steady_timer pause(executor);
+	while (nDone < nRequests)
+	{
+		pause.expires_after(1ms);
+		co_await pause.async_wait(asio::use_awaitable);
+	}
+	t.Check(nMatched == nRequests, "concurrent requests each got their own reply, " + std::to_string(nMatched) + " of " + std::to_string(nRequests));
+
+	// an echo of the request is not its reply, the request times out and the echo is an ordinary message
+	auto tStart = std::chrono::steady_clock::now();
+	reply = co_await client.request(MakeRequest(TestMsgTypes::Sequenced, 9), 200ms);
+	t.Check(!reply && std::chrono::steady_clock::now() - tStart >= 200ms, "a request with no reply times out");
+	auto msg = co_await client.receive();
+	t.Check(msg && msg->msg.header.id == TestMsgTypes::Sequenced && BodyNumber(msg->msg) == 9, "the echo arrives through receive");
+
+	// a receive waiting when the server drops the client is woken by the close
+	client.Send(MakeRequest(TestMsgTypes::State, 0));
+	tStart = std::chrono::steady_clock::now();
+	msg = co_await client.receive();
+	auto tWoken = std::chrono::steady_clock::now() - tStart;
+	t.Check(!msg, "receive returns nothing once disconnected");
+	t.Check(tWoken < 1s, "the close woke receive, after " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(tWoken).count()) + " ms");
+
+	tStart = std::chrono::steady_clock::now();
+	reply = co_await client.request(MakeRequest(TestMsgTypes::Reliable, 1), 5s);
+	t.Check(!reply && std::chrono::steady_clock::now() - tStart < 1s, "a request on a closed connection returns at once");
+
+	tStart = std::chrono::steady_clock::now();
+	reply = co_await never.request(MakeRequest(TestMsgTypes::Reliable, 1), 5s);
+	t.Check(!reply && std::chrono::steady_clock::now() - tStart < 1s, "a request on a client never connected returns at once");
+}
+
+// a message that arrived before the close is still received, nothing after it
+asio::awaitable<void> RunCloseAfterMessage(test_context& t, olc::net::client_interface<TestMsgTypes>& late)
+{
+	using namespace std::chrono_literals;
+
+	late.Send(MakeRequest(TestMsgTypes::State, 42));
+	asio::steady_timer pause(co_await asio::this_coro::executor);
+	auto tStart = std::chrono::steady_clock::now();
+	while (late.IsConnected() && std::chrono::steady_clock::now() - tStart < 5s)
+	{
+		pause.expires_after(1ms);
+		co_await pause.async_wait(asio::use_awaitable);
+	}
+	auto msg = co_await late.receive();
+	t.Check(msg && BodyNumber(msg->msg) == 42, "a message that arrived before the close is still received");
+	msg = co_await late.receive();
+	t.Check(!msg, "receive returns nothing once those are taken");
+}
+
+void TestRequests(test_context& t)
+{
+	request_server server(60920);
+	if (!t.Check(server.Start(), "server starts"))
+		return;
+
+	std::atomic<bool> bStop{ false };
+	std::thread thrServer([&]()
+		{
+			while (!bStop)
+				server.Update(-1, std::chrono::milliseconds(10));
+		});
+
+	olc::net::client_interface<TestMsgTypes> client, late, never;
+	client.Connect("127.0.0.1", 60920);
+	late.Connect("127.0.0.1", 60920);
+	auto tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (server.GetStats().nConnections < 2 && std::chrono::steady_clock::now() < tGiveUp)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	asio::io_context context;
+	bool bFinished = false;
+	asio::co_spawn(context, [&]() -> asio::awaitable<void> { co_await RunRequests(t, client, never); co_await RunCloseAfterMessage(t, late); bFinished = true; }, asio::detached);
+	context.run_for(std::chrono::seconds(30));
+	t.Check(bFinished, "the requests ran to the end");
+
+	client.Disconnect();
+	late.Disconnect();
+	bStop = true;
+	thrServer.join();
+	server.Stop();
+}
+#endif
+
+struct test_entry
+{
+	const char* sName;
+	void (*fnTest)(test_context&);
+};
+
+int main(int argc, char* argv[])
+{
+	const test_entry vTests[] = {
+		{ "streams", TestMessageStreams },
+		{ "schema", TestSchema },
+		{ "snapshot", TestSnapshots },
+		{ "compress", TestCompression },
+		{ "udp", TestUdpSession },
+		{ "simd", TestSimdParity },
+		{ "pool", TestPool },
+		{ "queue", TestQueue },
+		{ "registry", TestRegistry },
+		{ "shard", TestShardMoves },
+		{ "executor", TestExecutor },
+		{ "tuner", TestSocketTuner },
+		{ "linkclose", TestLinkClose },
+		{ "backpressure", TestBackpressure },
+		{ "recvbuffer", TestReceiveBuffer },
+#ifdef ASIO_HAS_CO_AWAIT
+		{ "requests", TestRequests },
+#endif
+	};
+
+	size_t nFailed = 0;
+	for (auto& test : vTests)
+	{
+		bool bWanted = argc < 2;
+		for (int i = 1; i < argc; i++)
+			bWanted = bWanted || std::string(argv[i]) == test.sName;
+		if (!bWanted)
+			continue;
+
+		test_context t;
+		t.sTest = test.sName;
+		test.fnTest(t);
+		std::cout << test.sName << "\t" << t.nChecks - t.nFailed << " / " << t.nChecks << " passed" << std::endl;
+		nFailed += t.nFailed;
+	}
+
+	return nFailed > 0 ? 1 : 0;
+}